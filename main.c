@@ -21,8 +21,8 @@ gcc -o my_program main.c -lncurses
 #include <curses.h>
 
 
-#define MAX_LINES 1024
-#define MAX_LINE_LENGTH 256
+#define LINE_INITIAL_GAP 16  // 새 줄에 미리 비워 두는 바이트 수
+#define LINES_INITIAL 64     // 줄 배열의 처음 크기
 
 // 자료구조 정의
 typedef struct Node {
@@ -31,6 +31,13 @@ typedef struct Node {
     struct Node *next;
 } Node;
 
+typedef struct Line {
+    char *text;             // 줄 내용 (가운데에 빈 칸이 있음)
+    int gap_start;          // 빈 칸 시작 = 빈 칸 앞 글자 수
+    int gap_end;            // 빈 칸 끝 (text[gap_end..capacity)가 빈 칸 뒤 글자)
+    int capacity;           // text 전체 크기
+} Line;
+
 typedef struct TextBuffer {
     Node *head;             // 리스트의 첫 번째 노드
     Node *tail;             // 리스트의 마지막 노드
@@ -38,7 +45,12 @@ typedef struct TextBuffer {
     int modified;           // 파일이 수정되었는지를 나타내는 플래그
     char filename[256];     // 파일 이름 저장
     int num_lines;          // 총 줄 수
-    char *lines[MAX_LINES]; // 각 줄 관리 배열
+    Line *lines;            // 줄 배열 (가운데에 빈 자리가 있어 줄 추가/삭제가 그 자리에서 끝남)
+    int line_gap_start;     // 빈 자리 시작 = 빈 자리 앞 줄 수
+    int line_gap_end;       // 빈 자리 끝
+    int line_capacity;      // 줄 배열 전체 크기
+    int top_row;            // 화면 맨 위 줄
+    int left_col;           // 화면 맨 왼쪽 열 (긴 줄은 가로로 스크롤)
     int cursor_row;         // 커서 위치 (행)
     int cursor_col;         // 커서 위치 (열)
 } TextBuffer;
@@ -52,6 +64,98 @@ Node* create_node(char character) {
     return new_node;
 }
 
+// 줄 길이 함수
+int line_length(const Line *line) {
+    return line->capacity - (line->gap_end - line->gap_start);
+}
+
+// 줄 초기화 함수 (내용을 앞에 두고 빈 칸은 끝에)
+void init_line(Line *line, const char *text, int len) {
+    line->capacity = len + LINE_INITIAL_GAP;
+    line->text = (char*)malloc(line->capacity);
+    memcpy(line->text, text, len);
+    line->gap_start = len;
+    line->gap_end = line->capacity;
+}
+
+// 빈 칸을 col 위치로 옮기는 함수 (사이에 있는 글자만 한 번에 옮김)
+void move_gap(Line *line, int col) {
+    if (col < line->gap_start) {
+        int n = line->gap_start - col;
+        memmove(line->text + line->gap_end - n, line->text + col, n);
+        line->gap_start -= n;
+        line->gap_end -= n;
+    } else if (col > line->gap_start) {
+        int n = col - line->gap_start;
+        memmove(line->text + line->gap_start, line->text + line->gap_end, n);
+        line->gap_start += n;
+        line->gap_end += n;
+    }
+}
+
+// 빈 칸을 need 바이트 이상으로 늘리는 함수 (두 배씩 키워 삽입 비용을 나눔)
+void reserve_gap(Line *line, int need) {
+    if (line->gap_end - line->gap_start >= need) {
+        return;
+    }
+    int len = line_length(line);
+    int capacity = line->capacity * 2;
+    while (capacity - len < need) {
+        capacity *= 2;
+    }
+    int tail = line->capacity - line->gap_end;
+    line->text = (char*)realloc(line->text, capacity);
+    memmove(line->text + capacity - tail, line->text + line->gap_end, tail);
+    line->gap_end = capacity - tail;
+    line->capacity = capacity;
+}
+
+// row번째 줄 함수
+Line* get_line(TextBuffer *buffer, int row) {
+    if (row >= buffer->line_gap_start) {
+        row += buffer->line_gap_end - buffer->line_gap_start;
+    }
+    return &buffer->lines[row];
+}
+
+// 줄 배열의 빈 자리를 row 위치로 옮기는 함수
+void move_line_gap(TextBuffer *buffer, int row) {
+    if (row < buffer->line_gap_start) {
+        int n = buffer->line_gap_start - row;
+        memmove(&buffer->lines[buffer->line_gap_end - n], &buffer->lines[row], n * sizeof(Line));
+        buffer->line_gap_start -= n;
+        buffer->line_gap_end -= n;
+    } else if (row > buffer->line_gap_start) {
+        int n = row - buffer->line_gap_start;
+        memmove(&buffer->lines[buffer->line_gap_start], &buffer->lines[buffer->line_gap_end], n * sizeof(Line));
+        buffer->line_gap_start += n;
+        buffer->line_gap_end += n;
+    }
+}
+
+// row 위치에 빈 줄 자리를 만드는 함수 (내용은 호출한 쪽에서 채움)
+Line* insert_line(TextBuffer *buffer, int row) {
+    move_line_gap(buffer, row);
+    if (buffer->line_gap_start == buffer->line_gap_end) {
+        int capacity = buffer->line_capacity * 2;
+        int tail = buffer->line_capacity - buffer->line_gap_end;
+        buffer->lines = (Line*)realloc(buffer->lines, capacity * sizeof(Line));
+        memmove(&buffer->lines[capacity - tail], &buffer->lines[buffer->line_gap_end], tail * sizeof(Line));
+        buffer->line_gap_end = capacity - tail;
+        buffer->line_capacity = capacity;
+    }
+    buffer->num_lines++;
+    return &buffer->lines[buffer->line_gap_start++];
+}
+
+// row번째 줄 삭제 함수
+void remove_line(TextBuffer *buffer, int row) {
+    free(get_line(buffer, row)->text);
+    move_line_gap(buffer, row + 1);
+    buffer->line_gap_start--;
+    buffer->num_lines--;
+}
+
 // 텍스트 버퍼 생성 함수
 TextBuffer* create_text_buffer(const char *filename) {
     TextBuffer *buffer = (TextBuffer*)malloc(sizeof(TextBuffer));
@@ -59,21 +163,119 @@ TextBuffer* create_text_buffer(const char *filename) {
     buffer->tail = NULL;
     buffer->cursor = NULL;
     buffer->modified = 0;
-    buffer->num_lines = 1;
+    buffer->num_lines = 0;
+    buffer->top_row = 0;
+    buffer->left_col = 0;
     buffer->cursor_row = 0;
     buffer->cursor_col = 0;
 
     strncpy(buffer->filename, filename ? filename : "[No Name]", sizeof(buffer->filename) - 1);
     buffer->filename[sizeof(buffer->filename) - 1] = '\0';
 
-    for (int i = 0; i < MAX_LINES; i++) {
-        buffer->lines[i] = NULL;
-    }
-    buffer->lines[0] = (char*)calloc(MAX_LINE_LENGTH, sizeof(char));
+    buffer->line_capacity = LINES_INITIAL;
+    buffer->lines = (Line*)malloc(buffer->line_capacity * sizeof(Line));
+    buffer->line_gap_start = 0;
+    buffer->line_gap_end = buffer->line_capacity;
 
     return buffer;
 }
 
+// 파일 불러오기 함수 (파일이 없으면 빈 버퍼)
+void load_file(TextBuffer *buffer) {
+    FILE *file = fopen(buffer->filename, "rb");
+    if (file != NULL) {
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        char *data = (char*)malloc(size > 0 ? size : 1);
+        size = (long)fread(data, 1, size > 0 ? size : 0, file);
+        fclose(file);
+
+        long start = 0;
+        for (long i = 0; i <= size; i++) {
+            if (i == size || data[i] == '\n') {
+                if (i == size && start == size && buffer->num_lines > 0) {
+                    break;  // 마지막 줄바꿈 뒤의 빈 줄은 만들지 않음
+                }
+                init_line(insert_line(buffer, buffer->num_lines), data + start, (int)(i - start));
+                start = i + 1;
+            }
+        }
+        free(data);
+    }
+    if (buffer->num_lines == 0) {
+        init_line(insert_line(buffer, 0), "", 0);
+    }
+}
+
+// 텍스트 줄 수
+int text_rows(void) {
+    return LINES - 3;
+}
+
+// 한 줄 그리는 함수 (빈 칸 앞뒤 두 조각에서 left_col부터 화면 폭만큼 이어 그림)
+void draw_line(TextBuffer *buffer, int row) {
+    int y = row - buffer->top_row;
+    if (y < 0 || y >= text_rows()) {
+        return;
+    }
+    move(y, 0);
+    clrtoeol();
+    if (row >= buffer->num_lines) {
+        return;
+    }
+    Line *line = get_line(buffer, row);
+    int skip = buffer->left_col;
+    int width = COLS;
+    int before = line->gap_start;
+    int after = line->capacity - line->gap_end;
+    if (skip < before) {
+        int n = before - skip < width ? before - skip : width;
+        addnstr(line->text + skip, n);
+        width -= n;
+        skip = 0;
+    } else {
+        skip -= before;
+    }
+    if (width > 0 && skip < after) {
+        int n = after - skip < width ? after - skip : width;
+        addnstr(line->text + line->gap_end + skip, n);
+    }
+}
+
+// row번째 줄부터 화면 끝까지 다시 그리는 함수
+void draw_lines_from(TextBuffer *buffer, int row) {
+    if (row < buffer->top_row) {
+        row = buffer->top_row;
+    }
+    for (; row < buffer->top_row + text_rows(); row++) {
+        draw_line(buffer, row);
+    }
+}
+
+// 커서가 화면 밖이면 스크롤하는 함수 (위아래, 좌우 모두, 스크롤했으면 1)
+int scroll_to_cursor(TextBuffer *buffer) {
+    int top = buffer->top_row;
+    if (buffer->cursor_row < top) {
+        top = buffer->cursor_row;
+    } else if (buffer->cursor_row >= top + text_rows()) {
+        top = buffer->cursor_row - text_rows() + 1;
+    }
+    int left = buffer->left_col;
+    if (buffer->cursor_col < left) {
+        left = buffer->cursor_col;
+    } else if (buffer->cursor_col >= left + COLS) {
+        left = buffer->cursor_col - COLS + 1;
+    }
+    if (top == buffer->top_row && left == buffer->left_col) {
+        return 0;
+    }
+    buffer->top_row = top;
+    buffer->left_col = left;
+    draw_lines_from(buffer, top);
+    return 1;
+}
+
 // 상태 바 업데이트 함수
 void update_status_bar(TextBuffer *buffer) {
     char status[256];
@@ -94,6 +296,7 @@ void update_status_bar(TextBuffer *buffer) {
     int cursor_position_col = COLS - strlen(cursor_position);
     mvprintw(LINES - 3, cursor_position_col, "%s", cursor_position);
     attroff(A_REVERSE);
+    move(buffer->cursor_row - buffer->top_row, buffer->cursor_col - buffer->left_col);
     refresh();
 }
 
@@ -109,87 +312,99 @@ void update_message_bar(const char *message) {
 
 // 문자 삽입 함수
 void insert_character(TextBuffer *buffer, char character) {
-    char *line = buffer->lines[buffer->cursor_row];
-    int len = strlen(line);
-
-    if (len < MAX_LINE_LENGTH - 1) {
-        for (int i = len; i > buffer->cursor_col; i--) {
-            line[i] = line[i - 1];
-        }
-        line[buffer->cursor_col] = character;
-        line[len + 1] = '\0';
-
-        buffer->cursor_col++;
-        mvaddch(buffer->cursor_row, buffer->cursor_col - 1, character);
-        refresh();
-    }
+    Line *line = get_line(buffer, buffer->cursor_row);
+    move_gap(line, buffer->cursor_col);
+    reserve_gap(line, 1);
+    line->text[line->gap_start++] = character;
+
+    buffer->cursor_col++;
+    buffer->modified = 1;
+    draw_line(buffer, buffer->cursor_row);
 }
 
 // 백스페이스 처리 함수
 void delete_character(TextBuffer *buffer) {
     if (buffer->cursor_col > 0) {
-        char *line = buffer->lines[buffer->cursor_row];
-        int len = strlen(line);
+        Line *line = get_line(buffer, buffer->cursor_row);
+        move_gap(line, buffer->cursor_col);
+        line->gap_start--;
 
-        for (int i = buffer->cursor_col - 1; i < len; i++) {
-            line[i] = line[i + 1];
-        }
         buffer->cursor_col--;
-        move(buffer->cursor_row, buffer->cursor_col);
-        clrtoeol();
-        mvprintw(buffer->cursor_row, 0, "%s", line);
-        refresh();
+        buffer->modified = 1;
+        draw_line(buffer, buffer->cursor_row);
     } else if (buffer->cursor_row > 0) {
         // 현재 줄 삭제 및 이전 줄 병합
-        char *current_line = buffer->lines[buffer->cursor_row];
-        char *prev_line = buffer->lines[buffer->cursor_row - 1];
-        int prev_len = strlen(prev_line);
-
-        if (prev_len + strlen(current_line) < MAX_LINE_LENGTH) {
-            strcat(prev_line, current_line);
-            free(current_line);
+        Line *current_line = get_line(buffer, buffer->cursor_row);
+        Line *prev_line = get_line(buffer, buffer->cursor_row - 1);
+        int prev_len = line_length(prev_line);
+        int current_len = line_length(current_line);
+
+        move_gap(prev_line, prev_len);
+        move_gap(current_line, current_len);
+        reserve_gap(prev_line, current_len);
+        memcpy(prev_line->text + prev_line->gap_start, current_line->text, current_len);
+        prev_line->gap_start += current_len;
+        remove_line(buffer, buffer->cursor_row);
+
+        buffer->cursor_row--;
+        buffer->cursor_col = prev_len;
+        buffer->modified = 1;
+
+        if (!scroll_to_cursor(buffer)) {
+            draw_lines_from(buffer, buffer->cursor_row);
+        }
+    }
+}
 
-            for (int i = buffer->cursor_row; i < buffer->num_lines - 1; i++) {
-                buffer->lines[i] = buffer->lines[i + 1];
-            }
-            buffer->lines[buffer->num_lines - 1] = NULL;
-            buffer->num_lines--;
+// 커서 이동 함수들: 열만 바꾸고 빈 칸은 다음 편집 때 옮김 (이동만 할 때는 memmove 없음)
+void move_cursor_left(TextBuffer *buffer) {
+    if (buffer->cursor_col > 0) {
+        buffer->cursor_col--;
+    } else if (buffer->cursor_row > 0) {
+        buffer->cursor_row--;
+        buffer->cursor_col = line_length(get_line(buffer, buffer->cursor_row));
+    }
+}
 
-            buffer->cursor_row--;
-            buffer->cursor_col = prev_len;
+void move_cursor_right(TextBuffer *buffer) {
+    if (buffer->cursor_col < line_length(get_line(buffer, buffer->cursor_row))) {
+        buffer->cursor_col++;
+    } else if (buffer->cursor_row < buffer->num_lines - 1) {
+        buffer->cursor_row++;
+        buffer->cursor_col = 0;
+    }
+}
 
-            clear();
-            for (int i = 0; i < buffer->num_lines; i++) {
-                mvprintw(i, 0, "%s", buffer->lines[i]);
-            }
-            refresh();
-        }
+void move_cursor_vertical(TextBuffer *buffer, int delta) {
+    int row = buffer->cursor_row + delta;
+    if (row < 0 || row >= buffer->num_lines) {
+        return;
+    }
+    int len = line_length(get_line(buffer, row));
+    buffer->cursor_row = row;
+    if (buffer->cursor_col > len) {
+        buffer->cursor_col = len;
     }
 }
 
 // 엔터 처리 함수
 void insert_newline(TextBuffer *buffer) {
-    if (buffer->num_lines < MAX_LINES) {
-        char *line = buffer->lines[buffer->cursor_row];
-        char *new_line = (char*)calloc(MAX_LINE_LENGTH, sizeof(char));
-
-        strcpy(new_line, &line[buffer->cursor_col]);
-        line[buffer->cursor_col] = '\0';
+    Line *line = get_line(buffer, buffer->cursor_row);
+    move_gap(line, buffer->cursor_col);
 
-        for (int i = buffer->num_lines; i > buffer->cursor_row + 1; i--) {
-            buffer->lines[i] = buffer->lines[i - 1];
-        }
-        buffer->lines[buffer->cursor_row + 1] = new_line;
-        buffer->num_lines++;
+    // 커서 뒤 내용은 새 줄로 옮기고 현재 줄에서는 잘라 냄
+    int tail = line->capacity - line->gap_end;
+    Line new_line;
+    init_line(&new_line, line->text + line->gap_end, tail);
+    line->gap_end = line->capacity;
+    *insert_line(buffer, buffer->cursor_row + 1) = new_line;
 
-        buffer->cursor_row++;
-        buffer->cursor_col = 0;
+    buffer->cursor_row++;
+    buffer->cursor_col = 0;
+    buffer->modified = 1;
 
-        clear();
-        for (int i = 0; i < buffer->num_lines; i++) {
-            mvprintw(i, 0, "%s", buffer->lines[i]);
-        }
-        refresh();
+    if (!scroll_to_cursor(buffer)) {
+        draw_lines_from(buffer, buffer->cursor_row - 1);
     }
 }
 
@@ -202,8 +417,14 @@ int main(int argc, char *argv[]) {
     curs_set(1);
 
     TextBuffer *buffer = create_text_buffer((argc > 1) ? argv[1] : "[No Name]");
-    update_status_bar(buffer);
+    if (argc > 1) {
+        load_file(buffer);
+    } else {
+        init_line(insert_line(buffer, 0), "", 0);
+    }
+    draw_lines_from(buffer, 0);
     update_message_bar(NULL);
+    update_status_bar(buffer);
 
     int ch;
     while ((ch = getch()) != 17) {  // Ctrl+Q 종료
@@ -213,15 +434,29 @@ int main(int argc, char *argv[]) {
             insert_newline(buffer);
         } else if (isprint(ch)) {
             insert_character(buffer, ch);
+        } else if (ch == KEY_LEFT) {
+            move_cursor_left(buffer);
+        } else if (ch == KEY_RIGHT) {
+            move_cursor_right(buffer);
+        } else if (ch == KEY_UP) {
+            move_cursor_vertical(buffer, -1);
+        } else if (ch == KEY_DOWN) {
+            move_cursor_vertical(buffer, 1);
+        } else if (ch == KEY_HOME) {
+            buffer->cursor_col = 0;
+        } else if (ch == KEY_END) {
+            buffer->cursor_col = line_length(get_line(buffer, buffer->cursor_row));
         }
+        scroll_to_cursor(buffer);
 
         update_status_bar(buffer);
 
     }
 
     for (int i = 0; i < buffer->num_lines; i++) {
-        free(buffer->lines[i]);
+        free(get_line(buffer, i)->text);
     }
+    free(buffer->lines);
     free(buffer);
 
     endwin();
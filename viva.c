@@ -3,733 +3,8883 @@
 #define SAVE_KEY    "Ctrl+S"
 #define QUIT_KEY    "Ctrl+Q"
 #define FIND_KEY    "Ctrl+F"
+#define UNDO_KEY    "Ctrl+Z"
 #elif defined(__APPLE__)
 #define SAVE_KEY    "ESC+S"
 #define QUIT_KEY    "ESC+Q"
 #define FIND_KEY    "ESC+F"
+#define UNDO_KEY    "ESC+Z"
 #else
 #define SAVE_KEY    "Ctrl+S"
 #define QUIT_KEY    "Ctrl+Q"
 #define FIND_KEY    "Ctrl+F"
+#define UNDO_KEY    "Ctrl+Z"
 #endif
 
+#ifdef __linux__
+#define _GNU_SOURCE     // SO_PEERCRED (서버 연결 확인)
+#endif
+#ifdef _WIN32
+#include <windows.h>    // 이벤트 대기 (PDCurses보다 먼저 넣어야 MOUSE_MOVED 등이 겹치지 않음)
+#endif
 #include <curses.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifndef _WIN32
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/xattr.h>
+#endif
+
+/* 이벤트 루프 설정 */
+#define AUTOSAVE_INTERVAL_MS 30000      // 자동 저장 주기
+#define AUTOSAVE_SUFFIX      ".autosave"
+#define MAX_TIMERS           16
+#define SAVE_TEMP_SUFFIX     ".viva-save"   // 저장 중 임시 파일 (뒤에 mkstemp의 XXXXXX가 붙음)
+#define RESIZE_DEBOUNCE_MS   40         // 창 크기 변경이 이만큼 잠잠해지면 한 번만 다시 배치
+
+
+/* 버퍼 설정 */
+#define NODE_MAX_SIZE        65536      // 노드(텍스트 조각) 하나의 최대 바이트 수
+#define NODE_MIN_SIZE        1024       // 이보다 작아진 노드는 이웃과 병합
+#define NODE_GAP_SPLIT       4096       // 커서 뒤가 이보다 길면 편집 전에 노드를 나눔
+#define RESIDENT_LIMIT_MB    64         // 압축 해제 상태로 둘 최대 크기 (VIVA_RESIDENT_MB로 변경)
+#define LZ_HASH_BITS         12
+#define LZ_MIN_MATCH         4
+#define MEM_BUDGET_MB        512        // 압축본까지 포함한 메모리 예산 (VIVA_MEM_BUDGET_MB로 변경)
+#define INDEX_READ_SIZE      (1 << 20)  // 줄 색인 스레드가 한 번에 읽는 크기
+#define GZIP_BUFFER_SIZE     (1 << 17)  // gzip 입력 버퍼 크기
+#define GZIP_IN_FLIGHT       64         // 풀기 스레드가 메인 루프보다 앞서 둘 수 있는 조각 수
+#define SNAPSHOT_ARENA_SIZE  (1 << 19)  // 스냅샷 자식의 deflate 상태를 둘 정적 영역
+#define EOL_LF               0          // 줄 끝 형식: '\n'만
+#define EOL_CRLF             1          // "\r\n"만 (불러올 때 '\n'으로 바꾸고 저장할 때 되돌림)
+#define EOL_MIXED            2          // 섞여 있음 (바이트 그대로 둠)
+#define TEXT_ROWS            (LINES - 2) // 상태 바, 메시지 바를 뺀 본문 줄 수
+#define HEX_OFFSET_WIDTH     12         // 16진 보기의 위치 칸 ("%010llx  ")
+#define TABLE_CACHE          256        // 표 보기에서 칸 경계를 기억해 둘 줄 수
+#define TABLE_SAMPLE         64         // 칸 너비를 어림할 때 파일 전체에서 골라 읽는 줄 수
+#define TABLE_MAX_WIDTH      32         // 한 칸의 최대 표시 너비
+#define TABLE_LINE_MAX       65536      // 칸을 나눌 때 읽는 줄 앞부분의 최대 길이
+#define WRAP_CACHE           512        // 줄 바꿈 지도에 길이를 기억해 둘 줄 수 (2의 거듭제곱)
+
+/* 편집 기록, 줄 단위 명령 설정 */
+#define UNDO_LIMIT           10000      // 보관할 되돌리기 기록 수
+#define MAX_THREADS          64         // 병렬 작업에 쓸 최대 스레드 수
+#define SORT_CUTOFF          32         // 이보다 짧은 구간은 삽입 정렬
+#define KILL_RING_SIZE       8          // 잘라내기/복사 기록 수
+#define PIPE_CHUNK           65536      // 외부 명령과 한 번에 주고받는 크기
+#define PIPE_REPORT_MS       100        // 진행 표시 갱신 간격
+#define SERVER_MAX_CLIENTS   32         // 서버에 동시에 붙을 수 있는 클라이언트 수 (버퍼 수도 같음)
+#define SEARCH_HISTORY       16         // 파일마다 기억할 검색어 수
+#define SESSION_MAGIC        "VIVASES1" // 세션 캐시 파일 머리
+#define SESSION_TAIL         4096       // 덧붙이기만 했는지 확인할 때 비교하는 파일 끝 바이트 수
+#define GREP_MAX_FILE_MB     512        // 파일 검색에서 이보다 큰 파일은 건너뜀 (VIVA_GREP_MAX_MB로 변경)
+#define GREP_MAX_RESULTS     100000     // 파일 검색 결과 최대 수 (넘으면 검색을 멈춤)
+#define GREP_TEXT            200        // 결과마다 보관하는 줄 앞부분 길이
+#define GREP_PROBE           8192       // NUL 바이트로 이진 파일을 가려낼 때 보는 앞부분 크기
+#define GREP_SLICE           (4 << 20)  // 큰 파일을 이만큼씩 훑으며 취소를 확인
+#define GREP_BATCH           1024       // 워커가 한 번에 메인 루프로 넘기는 결과 수
+#define STATS_SAMPLES        1024       // 백분위수를 낼 때 쓰는 최근 프레임 수
+#define STATS_STALE          32         // 통계 합계에서 빼 두고 아직 다시 세지 않은 노드 수 한도
+#define STATS_WALK           64         // 가장 긴 줄을 고칠 때 앞뒤로 훑는 노드 수 한도
+#define DIFF_MAX_EDITS       2048       // 줄 단위 차이 계산에서 따라갈 최대 편집 수 (넘으면 가운데를 한 덩어리로)
+#define DIFF_MAX_BYTES       (64 << 20) // 공통 앞뒤를 뺀 가운데가 이보다 크면 합치지 않음
+#define MACRO_CHECK_EVERY    1024       // 매크로 반복 중 Esc를 확인하는 간격
+#define MACRO_TEXT           0          // 이어서 입력한 글자들
+#define MACRO_SEARCH         1          // 검색 후 이동
+#define MACRO_KEYS           2          // 그 밖의 키 묶음 (handleKey로 재생)
 
 
 /* 구조체 정의 */
-typedef struct Node {       // 노드 구조체
-    char character;
+typedef struct NodeStats {  // 노드 내용 요약 (통계 패널이 이웃 노드 요약과 이어 붙여 전체 값을 구함)
+    int chars;              // UTF-8 글자 수 (이어지는 바이트 10xxxxxx는 세지 않음)
+    int words;              // 단어 시작 수 (노드 첫 바이트 앞은 공백으로 봄)
+    int newlines;
+    int head;               // 첫 '\n' 앞 글자 수 (줄바꿈이 없으면 전체)
+    int tail;               // 마지막 '\n' 뒤 글자 수
+    int widest;             // 노드 안에서 시작하고 끝난 줄 중 가장 긴 것 (글자 수)
+    char first_word;        // 첫 바이트가 단어 글자인지
+    char last_word;         // 마지막 바이트가 단어 글자인지
+    char known;             // 요약이 내용과 맞는지 (내용이 바뀌면 0)
+} NodeStats;
+
+typedef struct Node {       // 노드 구조체 (텍스트 한 조각)
+    char *data;             // 압축 해제된 내용 (NULL이면 packed에만 있음)
+    int *data_refs;         // data를 함께 가리키는 노드 수 (NULL이면 혼자 씀, 쓰기 전에 복사)
+    int len;                // 바이트 수
+    int cap;                // data 할당 크기
+    int lines;              // 조각 안의 '\n' 개수 (-1이면 아직 색인 전)
+    unsigned char *packed;  // LZ 압축본 (data와 내용이 같을 때만 유지, 여러 노드가 공유 가능)
+    int packed_len;
+    long long file_off;     // 원본 파일에서의 위치 (편집되지 않은 페이지만, 아니면 -1)
+    long long swap_off;     // 스크래치 파일에 내보낸 위치 (없으면 -1)
+    long long swap_slot;    // 예전에 내보냈던 자리 (다시 내보낼 때 재사용)
+    int swap_room;          // 그 자리의 크기
     struct Node *prev;
     struct Node *next;
+    struct Node *lru_prev;  // 압축 해제된 노드들의 LRU 목록
+    struct Node *lru_next;
+    int bracket_open[4];    // 노드 안에서 짝을 못 찾은 여는 괄호 수 ((, [, {, 종류 무관)
+    int bracket_close[4];   // 짝을 못 찾은 닫는 괄호 수 (노드는 ")))(((" 꼴로 요약됨)
+    int brackets_known;     // 괄호 요약이 내용과 맞는지 (내용이 바뀌면 0)
+    NodeStats stats;
 } Node;
 
+typedef struct Cursor {     // 커서 구조체
+    Node *current;          // 커서가 놓인 노드 (빈 버퍼면 NULL)
+    int offset;             // 노드 안에서의 위치 (0 ~ len)
+    long long pos;          // 버퍼 전체에서의 바이트 위치
+    long long row;          // 줄 번호 (0부터)
+    int col;                // 줄 안에서의 열
+    int y, x;               // 화면상의 위치 (displayList가 계산)
+} Cursor;
+
+typedef struct TextScan {   // 불러올 때 훑어본 줄 끝과 인코딩
+    long long lf;           // '\n' 수
+    long long crlf;         // 그중 바로 앞이 '\r'인 수
+    long long pos;          // 지금까지 훑은 바이트 수
+    long long bad_at;       // 첫 잘못된 UTF-8 바이트 위치
+    int bad_utf8;
+    int need;               // 아직 나와야 할 UTF-8 이어지는 바이트 수
+    unsigned char lo, hi;   // 다음 이어지는 바이트의 허용 범위
+    int after_cr;           // 앞 조각이 '\r'로 끝났는지
+} TextScan;
+
+typedef struct IndexJob {   // 페이지별 줄 수를 세는 백그라운드 작업
+    int fd;                 // 원본 파일 (별도로 연 것)
+    long long size;
+    int pages;
+    int *page_lines;        // 페이지 번호 -> 줄 수
+    NodeStats *page_stats;  // 페이지 번호 -> 내용 요약 (줄 수와 함께 셈)
+    TextScan scan;          // 줄 끝 형식, UTF-8 검사 (읽은 페이지만)
+    int done;               // 끝낸 페이지 수 (__atomic으로 접근)
+    int cancel;             // 종료 요청 (__atomic으로 접근)
+    int reported;           // 마지막으로 알린 진행률 (%)
+    struct TextBuffer *tb;
+    pthread_t thread;
+} IndexJob;
+
+typedef struct GzipJob {    // gzip 파일을 백그라운드에서 풀어 버퍼 끝에 붙이는 작업
+    gzFile gz;
+    struct TextBuffer *tb;
+    TextScan scan;          // 줄 끝 형식, UTF-8 검사 (푼 내용 기준)
+    int in_flight;          // 메인 루프가 아직 붙이지 않은 조각 수 (lock으로 보호)
+    int cancel;             // 종료 요청 (lock으로 보호)
+    int failed;             // 잘리거나 깨진 압축 데이터
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+} GzipJob;
+
+typedef struct GzipChunk {  // 푼 조각 하나 (메인 루프가 그대로 노드로 씀)
+    GzipJob *job;
+    char *data;             // NODE_MAX_SIZE 바이트 할당
+    int len;
+} GzipChunk;
+
+typedef struct Chain {      // 버퍼에 연결되지 않은 노드 사슬 (대량 편집 결과, 떼어 낸 범위)
+    Node *head;
+    Node *tail;
+    long long len;          // 전체 바이트 수
+} Chain;
+
+typedef struct UndoRecord { // 되돌리기 기록: [pos, pos + len)을 old로 바꾸면 이전 상태가 됨
+    long long pos;
+    long long len;          // 지금 그 자리에 있는 바이트 수
+    Chain old;              // 원래 있던 내용 (떼어 낸 노드를 복사 없이 보관)
+    long long cursor_pos;   // 적용한 뒤 커서를 둘 위치
+    long group;             // 같은 번호의 기록은 한 번에 되돌림
+    int open;               // 연속 타이핑을 이어 붙일 수 있는지
+    struct UndoRecord *prev;
+} UndoRecord;
+
+typedef struct LineSpan {   // 줄 단위 명령에서 한 줄의 위치
+    long long off;          // 읽어 온 범위 안에서의 시작
+    long long len;          // '\n'을 뺀 길이
+    double key;             // 숫자 정렬 키
+} LineSpan;
+
+#define LINE_SORT     0
+#define LINE_UNIQUE   1
+#define LINE_REVERSE  2
+#define LINE_KEEP     3
+#define LINE_DROP     4
+
+typedef struct LineOp {     // 줄 단위 명령의 작업 상태
+    char *text;             // 대상 범위 전체 (연속 메모리)
+    LineSpan *spans;
+    LineSpan *tmp;          // 병합용 임시 배열
+    long long count;
+    int numeric;
+    const char *pattern;    // keep, drop의 검색어
+    int keep_matching;      // 1이면 검색어를 포함하는 줄을 남김
+    unsigned char *keep;    // 줄별 남김 여부
+} LineOp;
+
+typedef struct LineJob {    // 스레드 하나가 맡는 구간
+    LineOp *op;
+    long long lo, mid, hi;
+} LineJob;
+
+typedef struct CellLine {   // 한 줄의 칸 경계 (표 보기 캐시)
+    long long pos;          // 줄 시작 위치 (-1이면 빈 자리)
+    long long end;          // 줄 끝 ('\n' 위치 또는 버퍼 끝)
+    int count;              // 칸 수
+    int *starts;            // 칸 시작 (줄 시작 기준), starts[count]는 마지막 칸 끝 + 1
+    int cap;
+} CellLine;
+
+typedef struct WrapLine {   // 줄 바꿈 지도 한 칸: 논리 줄 하나의 범위
+    long long start;        // 줄 시작 위치
+    long long next;         // 줄 끝 ('\n' 위치 또는 버퍼 끝) + 1 (0이면 빈 자리)
+} WrapLine;
+
+typedef struct WrapMap {    // 화면 줄 지도: 한 바이트가 한 칸이라 줄 길이만 알면 COLS 배수 자리에서 꺾임
+    WrapLine by_start[WRAP_CACHE];  // 줄 시작으로 찾음 (아래로 이동, 화면 위치 계산)
+    WrapLine by_end[WRAP_CACHE];    // 줄 끝으로 찾음 (위로 이동)
+} WrapMap;
+
+typedef struct TableView {  // CSV/TSV 표 보기
+    char delim;             // ',' 또는 '\t'
+    int first_col;          // 화면 왼쪽 첫 칸 (가로 스크롤은 칸 단위)
+    int *widths;            // 칸별 표시 너비 (지금까지 본 줄 중 가장 넓은 값)
+    int width_count;
+    CellLine cache[TABLE_CACHE];
+    int cache_next;         // 다음에 덮어쓸 캐시 자리
+} TableView;
+
+typedef struct Fold {       // 접은 구간: 머리줄 다음 줄부터 [start, end)를 숨김
+    long long start;
+    long long end;          // 줄 시작 위치
+    long long lines;        // 숨긴 줄 수
+} Fold;
+
+typedef struct TextStats {  // 버퍼 전체 통계 (ESC+I 패널)
+    long long bytes;
+    long long chars;        // chars, words, newlines는 노드를 잇고 뗄 때마다 고쳐 가는 합계
+    long long words;
+    long long newlines;
+    long long lines;
+    long long longest;      // 가장 긴 줄의 글자 수
+    int longest_known;      // 0이면 다음 갱신 때 요약을 훑어 가장 긴 줄을 다시 구함
+    int valid;              // 합계가 버퍼 내용과 맞는지 (0이면 패널을 그릴 때 처음부터 셈)
+    int pending;            // 색인 스레드가 페이지 요약을 만드는 중
+    Node *stale[STATS_STALE];   // 합계에서 뺀 뒤 내용이 바뀌어 다시 세야 하는 노드
+    int stale_count;
+} TextStats;
+
 typedef struct TextBuffer { // 텍스트 버퍼 구조체
     Node *head;
     Node *tail;
     int modified;
     char *filename;
+    long version;           // 편집할 때마다 증가 (저장 중 편집 여부 판단)
+    long long size;         // 논리 크기 (바이트)
+    long long lines;        // 전체 '\n' 개수
+    int node_count;
+    long long resident;     // 압축 해제되어 상주하는 바이트 (할당 크기 기준)
+    long long packed;       // 압축본이 차지하는 바이트
+    long long resident_limit;
+    long long packed_limit; // 압축본 한도 (넘으면 스크래치 파일로 내보냄)
+    int source_fd;          // 페이지를 읽어 오는 원본 파일 (-1이면 없음)
+    int swap_fd;            // 편집된 페이지를 내보내는 스크래치 파일 (-1이면 아직 없음)
+    long long swap_size;
+    int unindexed;          // 줄 수를 아직 모르는 페이지 수
+    int rows_stale;         // 앞쪽 페이지의 줄 수가 새로 밝혀져 줄 번호를 다시 세야 하는지
+    IndexJob *index_job;
+    Node *lru_head;         // 가장 최근에 쓴 상주 노드
+    Node *lru_tail;         // 가장 오래된 상주 노드 (먼저 압축됨)
+    long long top_pos;      // 화면 첫 줄의 시작 위치
+    long long top_row;      // 화면 첫 줄의 줄 번호
+    long long mark;         // 영역의 다른 끝 (-1이면 없음)
+    UndoRecord *undo;       // 되돌리기 기록 (가장 최근 것부터)
+    UndoRecord *redo;       // 다시 실행 기록
+    int undo_count;
+    int undo_trim_at;       // 기록 수가 이를 넘으면 오래된 기록을 정리
+    long undo_group;        // 키 입력마다 증가
+    long long *cursors;     // 추가 커서 위치 (오름차순, 주 커서는 Cursor에 따로)
+    int cursor_count;
+    int cursor_cap;
+    char cursor_query[256]; // 다음 일치에 커서를 더할 때 쓰는 검색어
+    int hex_view;           // 16진 보기 모드
+    long long hex_top;      // 16진 보기 첫 줄의 위치 (한 줄 바이트 수의 배수)
+    int hex_nibble;         // 16진 칸에서 다음에 바꿀 자리 (0: 위 4비트, 1: 아래 4비트)
+    int hex_ascii;          // 문자 칸에서 편집 중
+    TableView *table;       // 표 보기 (NULL이면 일반 보기)
+    WrapMap wraps;          // 줄 길이 캐시 (편집된 줄만 버리고 뒤쪽 줄은 위치만 옮김)
+    Fold *folds;            // 접은 구간 (시작 위치 순, 겹치지 않음)
+    int fold_count;
+    int fold_cap;
+    int *page_lines;        // 원본 파일의 페이지별 줄 수 (-1: 모름, 세션 캐시에 저장)
+    int page_count;
+    long long disk_size;    // 열 때의 원본 파일 상태 (색인이 아직 디스크 내용과 맞는지 판단)
+    long long disk_mtime;
+    long long disk_inode;
+    unsigned long long disk_tail;   // 그때 파일 끝의 해시 (덧붙이기만 했는지 확인)
+    int base_fd;            // 기준본 (마지막으로 읽거나 저장한 파일, rename으로 바뀌어도 예전 내용을 읽음)
+    char history[SEARCH_HISTORY][256];  // 최근 검색어 (0번이 가장 최근)
+    int history_count;
+    TextStats text_stats;
+    int eol;                // 파일의 줄 끝 형식 (EOL_LF, EOL_CRLF, EOL_MIXED)
+    int crlf;               // 불러올 때 "\r\n"을 '\n'으로 바꿨는지 (저장할 때 되돌림)
+    int bom;                // 불러올 때 UTF-8 BOM을 뗐는지 (저장할 때 다시 붙임)
+    int bad_utf8;           // 원본에 잘못된 UTF-8이 있는지
+    long long bad_utf8_at;  // 그 첫 위치 (원본 기준)
+    int gzip;               // gzip 파일 (저장할 때 다시 압축)
+    GzipJob *gzip_job;      // 진행 중인 gzip 풀기 (없으면 NULL)
 } TextBuffer;
 
-typedef struct Cursor {     // 커서 구조체
-    Node *current;
-    int row;
-    int col;
-} Cursor;
+typedef struct DiffLine {   // 차이 계산에서 한 줄
+    const char *text;
+    int len;                // '\n' 포함
+    unsigned long long hash;
+} DiffLine;
+
+typedef struct Hunk {       // a의 [a0, a1) 줄을 b의 [b0, b1) 줄로 바꿈
+    int a0, a1;
+    int b0, b1;
+} Hunk;
+
+typedef struct DiffSide {   // 비교할 내용 (버퍼 또는 파일)
+    TextBuffer *tb;         // NULL이면 text 또는 fd
+    int fd;
+    long long size;
+    char *text;             // 버퍼 형식으로 바꿔 읽어 둔 파일 (줄 끝을 바꿔 불러온 버퍼용)
+} DiffSide;
+
+typedef struct SessionHeader {  // 세션 캐시 파일 머리 (뒤에 경로, 검색어, 페이지별 줄 수가 이어짐)
+    char magic[8];
+    long long size;         // 기록할 때의 파일 크기, 수정 시각, inode
+    long long mtime;
+    long long inode;
+    unsigned long long tail_hash;   // 파일 끝 SESSION_TAIL 바이트의 해시
+    long long cursor_pos;
+    long long top_pos;
+    int path_len;
+    int history_count;
+    int pages;              // 0이면 색인 없음
+} SessionHeader;
 
 typedef struct SearchContext {    // 탐색된 개체 구조체
     char query[256];
-    Node **results;         // 찾은 노드들의 주소를 저장(포인터)
+    long long *results;     // 찾은 위치 (버퍼 전체 기준 바이트 오프셋)
     int result_count;
     int current_index;
-    Cursor original_cursor;     // 원래 커서를 복사
+    long long original_pos;     // 검색 이전의 커서 위치 (다른 세션의 편집에도 노드를 가리키지 않음)
+    long long original_top_pos; // 원래 화면 위치
+    long long original_top_row;
 } SearchContext;
 
+typedef void (*EventCallback)(void *arg);
+
+typedef struct Timer {      // 타이머 구조체
+    long long deadline;     // 만료 시각 (단조 시계 기준 ms, 0이면 비어 있음)
+    EventCallback callback;
+    void *arg;
+} Timer;
+
+typedef struct PostedEvent {    // 워커 스레드가 메인 루프로 넘긴 작업
+    EventCallback callback;
+    void *arg;
+    struct PostedEvent *next;
+} PostedEvent;
+
+typedef struct SaveJob {    // 백그라운드 저장 작업
+    TextBuffer *tb;
+    char *path;             // 최종 저장 경로
+    long version;           // 스냅샷을 뜬 시점의 버퍼 버전
+    int autosave;           // 자동 저장이면 modified 플래그를 건드리지 않음
+    int status;             // 0이면 성공
+    long long started;      // 시작 시각 (ms)
+#ifndef _WIN32
+    pid_t pid;              // 스냅샷을 쓰는 자식 프로세스
+    int source_fd;          // 제자리 쓰기 전에 옮겨 둘 원본 (없으면 -1)
+    int copy_fd;            // 원본을 옮길 이름 없는 파일
+    int go_fd;              // 옮기기가 끝나면 자식에게 알리는 pipe (1이면 계속, 0이면 중단)
+#endif
+} SaveJob;
+
+typedef struct PipeJob {    // 영역을 외부 명령에 통과시키는 작업
+    char command[256];
+    long long start, end;   // 결과로 바꿀 범위
+    Cursor feed;            // 다음에 보낼 위치
+    Chain output;           // 지금까지 받은 출력
+    int in_fd;              // 자식의 stdin (다 보내면 -1)
+    int out_fd;             // 자식의 stdout (EOF면 -1)
+    int err_fd;             // 자식의 stderr (EOF면 -1)
+    char errors[256];       // stderr 앞부분 (메시지 바에 표시)
+    int error_len;
+    int code;               // 종료 코드 (끝나기 전에는 -1)
+    long long started;
+    long long reported;     // 마지막으로 진행을 알린 시각
+#ifndef _WIN32
+    pid_t pid;
+#endif
+} PipeJob;
+
+typedef struct GrepHit {    // 파일 검색 결과 한 줄
+    int file;               // GrepJob.files 번호
+    long long line;         // 줄 번호 (1부터)
+    long long offset;       // 줄 시작 바이트 위치 (열 때 이 자리로 감)
+    char *text;             // 줄 앞부분 (제어 문자는 '.')
+} GrepHit;
+
+typedef struct GrepBatch {  // 워커가 파일 하나에서 찾은 결과 (메인 루프로 넘김)
+    struct GrepJob *job;
+    char *path;
+    GrepHit *hits;
+    int count;
+    int cap;
+} GrepBatch;
+
+typedef struct GrepJob {    // 디렉터리 트리 병렬 검색
+    char query[256];
+    int query_len;
+    char root[4096];        // 검색을 시작한 디렉터리
+    int display_skip;       // 결과 목록에서 경로 앞에서 떼고 보여 줄 길이 (root + '/')
+    long long max_size;
+    int cancel;             // Esc나 결과 수 한도로 멈춤 (워커는 파일마다, 큰 파일은 조각마다 확인)
+    pthread_t threads[MAX_THREADS + 1];     // 0은 디렉터리 순회, 나머지는 검색 워커
+    int thread_count;
+    pthread_mutex_t lock;   // 경로 큐 보호
+    pthread_cond_t ready;
+    char **queue;           // 순회 스레드가 찾은 파일 경로
+    int queue_head;
+    int queue_count;
+    int queue_cap;
+    int walking;            // 순회가 아직 끝나지 않음
+    int active;             // 아직 끝나지 않은 워커 수
+    long long files_scanned;    // 워커들이 원자적으로 더함
+    long long bytes_scanned;
+    long long skipped;          // 이진 파일, 크기 초과 파일
+    char **files;           // 결과가 있는 파일 경로 (이하 메인 스레드 소유)
+    int file_count;
+    int file_cap;
+    GrepHit *hits;
+    int hit_count;
+    int hit_cap;
+    int truncated;          // 결과 수 한도에 닿음
+    int selected;           // 결과 목록에서 고른 줄
+    int top;                // 결과 목록 첫 줄
+    int shown;              // 결과 목록을 보여 주는 중
+    int running;
+    int timer;              // 진행 표시 갱신 타이머
+    long long started;
+    long long elapsed;
+} GrepJob;
+
+typedef void (*PromptCallback)(TextBuffer *tb, Cursor *cursor, const char *answer);
+
+typedef struct Prompt {     // 입력 중인 프롬프트 (키는 handleKey가 넘겨 주므로 기다리는 동안에도 루프가 돎)
+    int active;
+    char label[300];
+    char text[256];
+    int len;
+    int size;               // 받을 수 있는 바이트 수 + 1
+    int pick;               // 불러온 기록 번호 (-1이면 새 입력)
+    char (*history)[256];
+    int history_count;
+    PromptCallback done;    // Enter면 입력한 글자, Esc면 NULL로 부름
+    char saved[256];        // 앞 프롬프트에서 받은 입력 (바꾸기의 찾을 말)
+    SearchContext *search;  // 검색 결과 사이를 오가는 중 (없으면 NULL)
+} Prompt;
+
+typedef struct Session {    // 서버에 붙은 클라이언트 하나
+    int sock;               // 클라이언트 연결 (끊기면 세션 종료)
+    FILE *in;               // 클라이언트가 넘겨준 터미널
+    FILE *out;
+    SCREEN *screen;
+    TextBuffer *tb;
+    Cursor cursor;
+    long long pos;          // 비활성일 때의 커서 위치 (다른 세션의 편집에 맞춰 옮김)
+    long long top_pos;
+    long long mark;
+    char message[256];
+    Prompt prompt;          // 이 세션의 프롬프트 (비활성일 때 보관)
+    int dirty;
+    int key_ready;          // 터미널에 입력이 있음
+    int sock_ready;         // 연결에 메시지나 끊김이 있음
+} Session;
+
+typedef struct Server {     // 클라이언트/서버 모드
+    int enabled;
+    int listen_fd;
+    Session *sessions[SERVER_MAX_CLIENTS];
+    int count;
+    Session *active;        // 지금 터미널과 버퍼 화면 상태가 맞춰진 세션
+    TextBuffer *buffers[SERVER_MAX_CLIENTS];  // 경로별 버퍼 (마지막 클라이언트가 나가도 유지)
+    int buffer_count;
+    Session **retired;      // 닫았지만 화면을 아직 지우지 않은 세션
+    int retired_count;
+    int retired_cap;
+} Server;
+
+typedef struct MacroOp {    // 녹화한 키를 버퍼 연산으로 옮긴 것
+    int kind;               // MACRO_TEXT, MACRO_SEARCH, MACRO_KEYS
+    char *text;             // 입력할 글자 또는 검색어
+    int *keys;              // MACRO_KEYS: 키 하나로 시작해 끝난 입력 전체
+    int len;
+    int skip;               // MACRO_SEARCH: 오른쪽 화살표로 넘긴 결과 수
+} MacroOp;
+
+typedef struct Macro {      // 키보드 매크로
+    MacroOp *ops;
+    int count;
+    int cap;
+} Macro;
+
+typedef struct FrameStats { // 화면 갱신 계측 (ESC+D 오버레이, 종료 시 VIVA_STATS 파일)
+    long long frame_us[STATS_SAMPLES];      // 최근 프레임 그리기 시간 (링)
+    long long latency_us[STATS_SAMPLES];    // 키 입력부터 그 키를 반영한 그리기가 끝날 때까지
+    long long bytes[STATS_SAMPLES];         // 프레임마다 터미널에 쓴 바이트
+    long long frames;       // 잰 프레임 수
+    long long keyed;        // 잰 키 지연 수
+    long long key_at;       // 아직 그리지 않은 첫 키를 읽은 시각 (0이면 없음)
+    int overlay;
+    int enabled;            // 오버레이가 켜졌거나 VIVA_STATS가 있을 때만 잼
+} FrameStats;
+
+typedef struct EventLoop {  // 이벤트 루프 구조체
+    WINDOW *win;
+    TextBuffer *tb;
+    Cursor *cursor;
+    int running;
+    int dirty;              // 다음 반복에서 다시 그려야 하는지
+    char message[256];      // 메시지 바에 표시할 알림 (비어 있으면 도움말)
+    Timer timers[MAX_TIMERS];
+    int autosave_timer;     // 예약된 자동 저장 타이머 번호 (-1이면 없음)
+    int resize_timer;       // 창 크기 변경 뒤 다시 배치할 타이머 번호 (-1이면 없음)
+    int wake_fd[2];         // 워커 깨우기 (리눅스는 eventfd 하나, 그 외에는 pipe)
+#ifdef _WIN32
+    HANDLE wake_event;      // 워커 깨우기 (Windows, 창 메시지와 함께 기다림)
+#endif
+    int timer_fd;           // timerfd (리눅스)
+    int watch_fd;           // inotify
+    int watch_wd;
+    const char *watch_name; // 감시 중인 파일의 이름 부분
+    long long known_mtime;  // 마지막으로 확인한 파일 상태
+    long long known_size;
+    SaveJob *save_job;      // 진행 중인 백그라운드 저장 (없으면 NULL)
+    int save_again;         // 저장 중에 다시 저장 요청이 들어왔는지
+    pthread_mutex_t lock;   // posted 큐 보호
+    PostedEvent *posted_head;
+    PostedEvent *posted_tail;
+    Chain kill_ring[KILL_RING_SIZE];    // 잘라내기/복사한 범위 (노드 사슬째 보관)
+    int kill_count;
+    int kill_newest;
+    long long yank_pos;     // 마지막 붙여넣기 범위 (ESC+V로 이전 항목과 바꿈)
+    long long yank_len;
+    int yank_index;
+    long yank_version;      // 붙여넣은 직후의 버퍼 버전 (그 뒤 편집이 없어야 바꿀 수 있음)
+    PipeJob *pipe_job;      // 진행 중인 외부 명령 (없으면 NULL)
+    GrepJob *grep;          // 파일 검색 (결과 목록을 버릴 때까지 유지)
+    FrameStats stats;
+    int text_panel;         // 통계 패널 표시 중
+    Macro macro;            // 마지막으로 녹화한 매크로
+    Macro recording;        // 녹화 중인 매크로
+    int is_recording;
+    int *stroke;            // 지금 처리 중인 키 하나에 딸려 읽힌 키들
+    int stroke_len;
+    int stroke_cap;
+    int replaying;          // 매크로 재생 중 (화면 그리기 생략)
+    const int *replay_keys; // 재생 중 readKey가 돌려줄 키
+    int replay_left;
+    Prompt prompt;          // 활성 세션의 프롬프트 (서버는 세션을 바꿀 때 message처럼 맞바꿈)
+} EventLoop;
+
+static EventLoop loop;
+static Server server;
+
+typedef struct Command {    // ESC+X로 실행하는 명령
+    const char *name;
+    void (*run)(TextBuffer *tb, Cursor *cursor, const char *arg);
+    int needs_arg;
+} Command;
+
+/* 함수 선언 */
+void displayList(WINDOW *win, TextBuffer *tb, Cursor *cursor);
+void openPrompt(const char *label, int size, char (*history)[256], int history_count, PromptCallback done);
+void promptKey(TextBuffer *tb, Cursor *cursor, int ch);
+void closePrompt(void);
+void rememberSearch(TextBuffer *tb, const char *query);
+void findMatches(TextBuffer *tb, SearchContext *sc);
+void highlightMatch(WINDOW *win, Cursor *cursor, SearchContext *sc);
+void gotoPosition(TextBuffer *tb, Cursor *cursor, long long pos);
+void setMessage(const char *fmt, ...);
+void rememberFileState(const char *filename);
+void clearAutosave(TextBuffer *tb);
+void saveFileAsync(TextBuffer *tb);
+int readKey(void);
+int pollEvents(void);
+void dispatchBackground(TextBuffer *tb, int pending);
+void postEvent(EventCallback callback, void *arg);
+void pumpPipe(TextBuffer *tb);
+void confirmPipe(TextBuffer *tb, int ch);
+void commandPipe(TextBuffer *tb, Cursor *cursor, const char *arg);
+void commandGrep(TextBuffer *tb, Cursor *cursor, const char *arg);
+void handleKey(WINDOW *win, TextBuffer *tb, Cursor *cursor, int ch);
+int isTextKey(int ch);
+void clearCursors(TextBuffer *tb);
+void handleEditKey(TextBuffer *tb, Cursor *cursor, int ch);
+void handleHexKey(TextBuffer *tb, Cursor *cursor, int ch);
+void displayHex(WINDOW *win, TextBuffer *tb, Cursor *cursor);
+void relocateRows(TextBuffer *tb, Cursor *cursor);
+void invalidateCells(TextBuffer *tb, long long pos);
+void adjustSessions(TextBuffer *tb, long long start, long long end, long long inserted);
+void cancelPipe(void);
+void endStroke(void);
+void freeResource(TextBuffer *tb);
+void saveFile(TextBuffer *tb);
+void refreshScreen(WINDOW *win, TextBuffer *tb, Cursor *cursor);
+void displayTable(WINDOW *win, TextBuffer *tb, Cursor *cursor);
+void handleTableKey(TextBuffer *tb, Cursor *cursor, int ch);
+void moveCursorUp(TextBuffer *tb, Cursor *cursor);
+void moveCursorDown(TextBuffer *tb, Cursor *cursor);
+void moveLineUp(TextBuffer *tb, Cursor *cursor);
+void moveLineDown(TextBuffer *tb, Cursor *cursor);
+void adjustWraps(TextBuffer *tb, long long start, long long end, long long inserted);
+void replaceNodes(TextBuffer *tb, Cursor *cursor, long long start, long long end, Chain *with, Chain *cut, int park);
+Fold* foldAt(TextBuffer *tb, long long pos);
+Fold* foldStartingAt(TextBuffer *tb, long long pos);
+void revealCursor(TextBuffer *tb, Cursor *cursor);
+long long countLinesBetween(TextBuffer *tb, long long start, long long end);
+void adjustFolds(TextBuffer *tb, long long start, long long end, long long inserted);
+int nextVisibleLine(TextBuffer *tb, Cursor *c);
+int prevVisibleLine(TextBuffer *tb, Cursor *c);
+int matchAt(TextBuffer *tb, Node *node, int off, const char *query, int query_len);
+int firstMatchAfter(SearchContext *sc, long long pos);
+void recordInsert(TextBuffer *tb, long long pos, long long n);
+void recordDelete(TextBuffer *tb, long long pos, const char *bytes, long long n);
+long long monotonicMs(void);
+void scheduleResize(void);
+void addStats(TextBuffer *tb, Node *node);
+void dropStats(TextBuffer *tb, Node *node, int stale);
+#ifndef _WIN32
+long long loadSession(TextBuffer *tb, const char *filename, const struct stat *st, int want_index);
+long long statMtime(const struct stat *st);
+#endif
+void mergeDiskChanges(TextBuffer *tb, Cursor *cursor);
+void rememberBase(TextBuffer *tb);
+long long shiftPosition(long long x, long long start, long long end, long long inserted);
+void storeSession(TextBuffer *tb, Cursor *cursor);
+void waitForSave(void);
+void stopIndexer(TextBuffer *tb);
+void watchFile(const char *filename);
+void releaseBuffer(TextBuffer *tb);
+void freeGrep(GrepJob *job);
+int cpuCount(void);
+void formatSize(char *buf, size_t size, long long bytes);
+int addTimer(int delay_ms, EventCallback callback, void *arg);
+void cancelTimer(int id);
+#ifndef _WIN32
+TextBuffer* serverBuffer(const char *path);
+#endif
+
+/* LZ 압축 함수 (LZ4 블록 형식)
+ * 화면에서 먼 노드를 메모리 안에서 압축해 둘 때 사용 */
+static unsigned int lzRead32(const unsigned char *p) {
+    unsigned int v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned char* lzPutLength(unsigned char *op, int len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/* 압축 결과의 최대 크기 */
+int lzBound(int len) {
+    return len + len / 255 + 16;
+}
+
+/* 압축 함수: dst는 lzBound(len) 이상이어야 하며 압축된 크기를 반환 */
+int lzCompress(const char *in, int len, unsigned char *dst) {
+    const unsigned char *src = (const unsigned char*)in;
+    int table[1 << LZ_HASH_BITS];   // 4바이트 해시 -> 마지막 위치 + 1 (0은 빈 칸)
+    unsigned char *op = dst;
+    int anchor = 0, i = 0;
+
+    memset(table, 0, sizeof(table));
+    if (len > 12) {
+        int limit = len - 12;       // 끝 12바이트 안에서는 매치를 시작하지 않음 (LZ4 규칙)
+        while (i < limit) {
+            unsigned int seq = lzRead32(src + i);
+            unsigned int h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+            int ref = table[h] - 1;
+            table[h] = i + 1;
+            if (ref < 0 || i - ref > 65535 || lzRead32(src + ref) != seq) {
+                i += 1 + ((i - anchor) >> 6);   // 압축이 안 되는 구간은 점점 크게 건너뜀
+                continue;
+            }
+            int mlen = LZ_MIN_MATCH;
+            while (i + mlen < len - 5 && src[ref + mlen] == src[i + mlen]) {
+                mlen++;
+            }
+
+            int lit = i - anchor;
+            int m = mlen - LZ_MIN_MATCH;
+            unsigned char *token = op++;
+            *token = (unsigned char)(((lit >= 15 ? 15 : lit) << 4) | (m >= 15 ? 15 : m));
+            if (lit >= 15) {
+                op = lzPutLength(op, lit - 15);
+            }
+            memcpy(op, src + anchor, lit);
+            op += lit;
+            *op++ = (unsigned char)((i - ref) & 0xff);
+            *op++ = (unsigned char)((i - ref) >> 8);
+            if (m >= 15) {
+                op = lzPutLength(op, m - 15);
+            }
+            i += mlen;
+            anchor = i;
+        }
+    }
+
+    // 마지막 시퀀스는 리터럴만 가짐
+    int lit = len - anchor;
+    *op++ = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) {
+        op = lzPutLength(op, lit - 15);
+    }
+    memcpy(op, src + anchor, lit);
+    op += lit;
+    return (int)(op - dst);
+}
+
+/* 압축 해제 함수: 풀린 크기를 반환 (손상된 입력이면 -1) */
+int lzDecompress(const unsigned char *src, int srclen, char *out, int outcap) {
+    const unsigned char *ip = src;
+    const unsigned char *end = src + srclen;
+    unsigned char *dst = (unsigned char*)out;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + outcap;
+
+    while (ip < end) {
+        int token = *ip++;
+        int lit = token >> 4;
+        if (lit == 15) {
+            int b;
+            do {
+                if (ip >= end) return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > end - ip || lit > oend - op) return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip >= end) {
+            break;
+        }
+
+        if (end - ip < 2) return -1;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - dst) return -1;
+        int mlen = token & 15;
+        if (mlen == 15) {
+            int b;
+            do {
+                if (ip >= end) return -1;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ_MIN_MATCH;
+        if (mlen > oend - op) return -1;
+        const unsigned char *ref = op - offset;
+        while (mlen-- > 0) {
+            *op++ = *ref++;     // 겹치는 복사가 있으므로 한 바이트씩
+        }
+    }
+    return (int)(op - dst);
+}
+
+/* 줄바꿈 개수 계산 함수 */
+int countNewlines(const char *p, int len) {
+    int n = 0;
+    const char *end = p + len;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        n++;
+        p++;
+    }
+    return n;
+}
+
+#define BYTES_HIGH 0x8080808080808080ULL
+
+/* UTF-8 글자 수, 단어 시작 수 계산 함수 (8바이트씩 한 번에 셈)
+ * ' ' 이하의 바이트를 공백으로 보고, prev는 앞 바이트가 단어 글자였는지 (끝나면 마지막 바이트 기준으로 바뀜) */
+void countText(const char *p, int len, int *chars, int *words, int *prev) {
+    int c = 0, w = 0;
+    unsigned long long carry = *prev ? 0x80 : 0;
+    int i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= len; i += 8) {
+        unsigned long long x;
+        memcpy(&x, p + i, 8);
+        // 이어지는 바이트 (10xxxxxx)와 단어 글자 (0x21 이상)의 최상위 비트만 남김
+        unsigned long long cont = x & ~(x << 1) & BYTES_HIGH;
+        unsigned long long word = (((x & ~BYTES_HIGH) + 0x5f5f5f5f5f5f5f5fULL) | x) & BYTES_HIGH;
+        c += 8 - __builtin_popcountll(cont);
+        w += __builtin_popcountll(word & ~((word << 8) | carry));
+        carry = word >> 56;
+    }
+#endif
+    for (; i < len; i++) {
+        unsigned char b = (unsigned char)p[i];
+        c += (b & 0xc0) != 0x80;
+        w += b > ' ' && !carry;
+        carry = b > ' ' ? 0x80 : 0;
+    }
+    *chars = c;
+    *words = w;
+    *prev = carry != 0;
+}
+
+/* 바이트 열 요약 함수: 글자, 단어, 줄바꿈 수와 첫/마지막 줄 조각, 안에서 끝난 가장 긴 줄 */
+void summarizeBytes(NodeStats *s, const char *data, int len) {
+    memset(s, 0, sizeof(NodeStats));
+    int prev = 0;
+    int start = 0;
+    while (1) {
+        const char *nl = (const char*)memchr(data + start, '\n', len - start);
+        int end = nl != NULL ? (int)(nl - data) : len;
+        int chars, words;
+        countText(data + start, end - start, &chars, &words, &prev);
+        s->chars += chars;
+        s->words += words;
+        if (nl == NULL) {
+            s->tail = chars;
+            if (s->newlines == 0) {
+                s->head = chars;
+            }
+            break;
+        }
+        if (s->newlines == 0) {
+            s->head = chars;
+        } else if (chars > s->widest) {
+            s->widest = chars;
+        }
+        s->newlines++;
+        s->chars++;         // '\n'도 글자로 셈
+        prev = 0;
+        start = end + 1;
+    }
+    s->first_word = len > 0 && (unsigned char)data[0] > ' ';
+    s->last_word = (char)prev;
+    s->known = 1;
+}
+
+/* 불러올 텍스트 훑기 함수: 줄 끝 형식과 UTF-8 오류를 조각 단위로 이어서 셈
+ * '\n', '\r'은 memchr로 찾고, UTF-8 검사는 8바이트가 모두 ASCII면 한 번에 건너뜀 */
+void scanText(TextScan *scan, const char *p, int len) {
+    const char *end = p + len;
+    if (scan->after_cr && len > 0 && p[0] == '\n') {
+        scan->crlf++;
+    }
+    scan->lf += countNewlines(p, len);
+    for (const char *q = p; q < end && (q = (const char*)memchr(q, '\r', end - q)) != NULL; q++) {
+        if (q + 1 < end && q[1] == '\n') {
+            scan->crlf++;
+        }
+    }
+    scan->after_cr = len > 0 && p[len - 1] == '\r';
+
+    for (int i = 0; i < len && !scan->bad_utf8; i++) {
+        if (scan->need == 0) {
+            while (i + 8 <= len) {
+                unsigned long long x;
+                memcpy(&x, p + i, 8);
+                if (x & BYTES_HIGH) break;
+                i += 8;
+            }
+            if (i >= len) break;
+        }
+        unsigned char b = (unsigned char)p[i];
+        if (scan->need > 0) {
+            // 이어지는 바이트: 첫 바이트가 정한 범위 안이어야 함 (과잉 표현, 서로게이트 제외)
+            if (b < scan->lo || b > scan->hi) {
+                scan->bad_utf8 = 1;
+                scan->bad_at = scan->pos + i;
+            }
+            scan->need--;
+            scan->lo = 0x80;
+            scan->hi = 0xbf;
+        } else if (b >= 0x80) {
+            scan->lo = 0x80;
+            scan->hi = 0xbf;
+            if (b >= 0xc2 && b <= 0xdf) {
+                scan->need = 1;
+            } else if (b >= 0xe0 && b <= 0xef) {
+                scan->need = 2;
+                if (b == 0xe0) scan->lo = 0xa0;
+                if (b == 0xed) scan->hi = 0x9f;
+            } else if (b >= 0xf0 && b <= 0xf4) {
+                scan->need = 3;
+                if (b == 0xf0) scan->lo = 0x90;
+                if (b == 0xf4) scan->hi = 0x8f;
+            } else {
+                scan->bad_utf8 = 1;
+                scan->bad_at = scan->pos + i;
+            }
+        }
+    }
+    scan->pos += len;
+}
+
+/* 줄 끝 형식 판정 함수 ("\r\n"만 있으면 CRLF, 섞여 있으면 MIXED) */
+int scanEndings(const TextScan *scan) {
+    if (scan->crlf == 0) {
+        return EOL_LF;
+    }
+    return scan->crlf == scan->lf ? EOL_CRLF : EOL_MIXED;
+}
+
+/* "\r\n"을 '\n'으로 줄이는 함수 (제자리에서, 줄어든 길이를 반환) */
+long long stripCarriageReturns(char *p, long long len) {
+    char *out = (char*)memchr(p, '\r', len);
+    if (out == NULL) {
+        return len;
+    }
+    const char *in = out;
+    const char *end = p + len;
+    while (in < end) {
+        const char *cr = (const char*)memchr(in, '\r', end - in);
+        const char *stop = cr != NULL ? cr : end;
+        memmove(out, in, stop - in);
+        out += stop - in;
+        in = stop;
+        if (cr != NULL) {
+            if (cr + 1 < end && cr[1] == '\n') {
+                in++;       // '\r'만 버림
+            } else {
+                *out++ = *in++;
+            }
+        }
+    }
+    return out - p;
+}
+
+/* '\n' 앞마다 '\r'을 붙여 dst에 쓰는 함수 (dst는 2 * len 바이트, 쓴 길이를 반환) */
+int expandNewlines(const char *src, int len, char *dst) {
+    char *out = dst;
+    const char *end = src + len;
+    while (src < end) {
+        const char *nl = (const char*)memchr(src, '\n', end - src);
+        const char *stop = nl != NULL ? nl : end;
+        memcpy(out, src, stop - src);
+        out += stop - src;
+        src = stop;
+        if (nl != NULL) {
+            *out++ = '\r';
+            *out++ = '\n';
+            src++;
+        }
+    }
+    return (int)(out - dst);
+}
+
+/* 훑어본 결과를 버퍼에 적는 함수 */
+void noteScan(TextBuffer *tb, const TextScan *scan) {
+    tb->eol = scanEndings(scan);
+    // 끝에서 잘린 다바이트 문자도 잘못된 것으로 봄
+    tb->bad_utf8 = scan->bad_utf8 || scan->need > 0;
+    tb->bad_utf8_at = scan->bad_utf8 ? scan->bad_at : scan->pos;
+}
+
 /* 노드 생성 함수 */
-Node* createNode(char c) {
-    Node *newNode = (Node*)malloc(sizeof(Node));
-    newNode->character = c;
-    newNode->prev = NULL;
-    newNode->next = NULL;
+Node* createNode(const char *bytes, int len) {
+    Node *newNode = (Node*)calloc(1, sizeof(Node));
+    newNode->file_off = -1;
+    newNode->swap_off = -1;
+    newNode->cap = len < 64 ? 64 : len;
+    newNode->data = (char*)malloc(newNode->cap);
+    if (len > 0) {
+        memcpy(newNode->data, bytes, len);
+    }
+    newNode->len = len;
+    newNode->lines = countNewlines(bytes, len);
     return newNode;
 }
 
-/* 노드 삽입 함수 */
-void insertNode(TextBuffer *tb, Cursor *cursor, char c) {
-    Node *newNode = createNode(c);
-    tb->modified = 1; // 수정됨 표시
+/* 압축본 앞에 붙는 참조 수 (복사한 노드들이 같은 압축본을 나눠 씀) */
+#define PACKED_HEADER ((int)sizeof(long long))
 
-    if (tb->head == NULL) {
-        // 빈 리스트일 경우
-        tb->head = newNode;
-        tb->tail = newNode;
-        cursor->current = newNode;
-    } else if (cursor->current == NULL) {
-        // 텍스트 시작 부분에 삽입
-        newNode->next = tb->head;
-        tb->head->prev = newNode;
-        tb->head = newNode;
-        cursor->current = newNode;
-    } else {
-        // 현재 커서 위치 뒤에 삽입
-        newNode->prev = cursor->current;
-        newNode->next = cursor->current->next;
-        if (cursor->current->next != NULL) {
-            cursor->current->next->prev = newNode;
-        } 
-        else {  // 마지막 노드인 경우
-            tb->tail = newNode;
-        }
-        cursor->current->next = newNode;
-        cursor->current = newNode;
-    }
-}
-
-/* 노드 삭제 함수 */
-void deleteNode(TextBuffer *tb, Cursor *cursor) {
-    if (cursor->current == NULL) {
+/* 노드 압축 함수: data를 압축해 참조 수 1인 압축본을 만듦 (data는 그대로 둠) */
+void packNode(Node *node) {
+    unsigned char *block = (unsigned char*)malloc(PACKED_HEADER + lzBound(node->len));
+    node->packed_len = lzCompress(node->data, node->len, block + PACKED_HEADER);
+    block = (unsigned char*)realloc(block, PACKED_HEADER + node->packed_len);
+    *(int*)block = 1;
+    node->packed = block + PACKED_HEADER;
+}
+
+/* 압축본 참조 해제 함수 (마지막 참조면 메모리 해제) */
+void releasePacked(Node *node) {
+    if (node->packed != NULL) {
+        int *refs = (int*)(node->packed - PACKED_HEADER);
+        if (--*refs == 0) {
+            free(refs);
+        }
+        node->packed = NULL;
+        node->packed_len = 0;
+    }
+}
+
+/* 원본 참조 해제 함수 (함께 쓰는 노드가 없으면 메모리 해제, cap과 상주 크기는 호출한 쪽이 맞춤) */
+void releaseData(Node *node) {
+    if (node->data_refs != NULL) {
+        if (--*node->data_refs == 0) {
+            free(node->data_refs);
+            free(node->data);
+        }
+        node->data_refs = NULL;
+    } else {
+        free(node->data);
+    }
+    node->data = NULL;
+}
+
+/* 쓰기 전에 원본을 혼자 갖게 하는 함수 (함께 쓰던 원본이면 복사) */
+void ownData(Node *node) {
+    if (node->data_refs == NULL) {
+        return;
+    }
+    if (*node->data_refs > 1) {
+        char *copy = (char*)malloc(node->cap);
+        memcpy(copy, node->data, node->len);
+        (*node->data_refs)--;
+        node->data = copy;
+    } else {
+        free(node->data_refs);
+    }
+    node->data_refs = NULL;
+}
+
+/* 노드 해제 함수 (리스트에서 뗀 뒤 호출) */
+void freeNode(Node *node) {
+    releaseData(node);
+    releasePacked(node);
+    free(node);
+}
+
+/* LRU 목록에서 빼는 함수 */
+void lruRemove(TextBuffer *tb, Node *node) {
+    if (node->lru_prev != NULL) {
+        node->lru_prev->lru_next = node->lru_next;
+    } else {
+        tb->lru_head = node->lru_next;
+    }
+    if (node->lru_next != NULL) {
+        node->lru_next->lru_prev = node->lru_prev;
+    } else {
+        tb->lru_tail = node->lru_prev;
+    }
+    node->lru_prev = node->lru_next = NULL;
+}
+
+/* LRU 목록 맨 앞(가장 최근)에 넣는 함수 */
+void lruPushFront(TextBuffer *tb, Node *node) {
+    node->lru_prev = NULL;
+    node->lru_next = tb->lru_head;
+    if (tb->lru_head != NULL) {
+        tb->lru_head->lru_prev = node;
+    } else {
+        tb->lru_tail = node;
+    }
+    tb->lru_head = node;
+}
+
+/* 노드를 prev 뒤에 연결하는 함수 (prev가 NULL이면 맨 앞) */
+void linkNode(TextBuffer *tb, Node *prev, Node *node) {
+    node->prev = prev;
+    node->next = prev ? prev->next : tb->head;
+    if (node->next != NULL) {
+        node->next->prev = node;
+    } else {
+        tb->tail = node;
+    }
+    if (prev != NULL) {
+        prev->next = node;
+    } else {
+        tb->head = node;
+    }
+    tb->size += node->len;
+    if (node->lines >= 0) {
+        tb->lines += node->lines;
+    } else {
+        tb->unindexed++;
+    }
+    tb->node_count++;
+    tb->packed += node->packed_len;
+    if (node->data != NULL) {
+        tb->resident += node->cap;
+        lruPushFront(tb, node);
+    }
+    addStats(tb, node);
+}
+
+/* 노드를 리스트에서 떼는 함수 (해제는 하지 않음) */
+void unlinkNode(TextBuffer *tb, Node *node) {
+    dropStats(tb, node, 0);     // 이웃이 남아 있을 때 빼야 경계에 걸친 단어를 맞게 셈
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    } else {
+        tb->head = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
+    } else {
+        tb->tail = node->prev;
+    }
+    node->prev = node->next = NULL;
+    tb->size -= node->len;
+    if (node->lines >= 0) {
+        tb->lines -= node->lines;
+    } else {
+        tb->unindexed--;
+    }
+    tb->node_count--;
+    tb->packed -= node->packed_len;
+    if (node->data != NULL) {
+        tb->resident -= node->cap;
+        lruRemove(tb, node);
+    }
+}
+
+/* 파일의 지정 위치에서 끝까지 읽는 함수 */
+int readAt(int fd, char *buf, int len, long long off) {
+#ifndef _WIN32
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf += n;
+        len -= (int)n;
+        off += n;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/* 파일의 지정 위치에 끝까지 쓰는 함수 */
+int writeAllAt(int fd, const char *buf, int len, long long off) {
+#ifndef _WIN32
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf += n;
+        len -= (int)n;
+        off += n;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/* 비상주 노드의 내용을 buf에 채우는 함수 (압축본, 스크래치 파일, 원본 파일 순으로 확인) */
+int readNodeInto(TextBuffer *tb, Node *node, char *buf) {
+    if (node->packed != NULL) {
+        return lzDecompress(node->packed, node->packed_len, buf, node->len) == node->len ? 0 : -1;
+    } else if (node->swap_off >= 0) {
+        return readAt(tb->swap_fd, buf, node->len, node->swap_off);
+    } else if (node->file_off >= 0) {
+        return readAt(tb->source_fd, buf, node->len, node->file_off);
+    }
+    return -1;
+}
+
+/* 노드 데이터 접근 함수: 비상주 노드는 불러와 상주시키고 LRU 맨 앞으로 옮김 */
+char* nodeData(TextBuffer *tb, Node *node) {
+    if (node->data == NULL) {
+        node->cap = node->len < 64 ? 64 : node->len;
+        node->data = (char*)malloc(node->cap);
+        if (readNodeInto(tb, node, node->data) < 0) {
+            // 원본이 밖에서 잘렸다면 읽을 수 없는 부분은 0으로 채움
+            memset(node->data, 0, node->len);
+        }
+        if (node->lines < 0) {
+            // 색인 스레드보다 먼저 불러온 페이지는 여기서 줄 수를 셈
+            node->lines = countNewlines(node->data, node->len);
+            tb->lines += node->lines;
+            tb->unindexed--;
+            tb->rows_stale = 1;
+        }
+        tb->resident += node->cap;
+        lruPushFront(tb, node);
+    } else if (tb->lru_head != node) {
+        lruRemove(tb, node);
+        lruPushFront(tb, node);
+    }
+    return node->data;
+}
+
+/* 노드 쓰기 준비 함수: 내용이 바뀌므로 낡은 압축본, 디스크 사본을 버리고 need 바이트 공간 확보 */
+char* nodeWritable(TextBuffer *tb, Node *node, int need) {
+    nodeData(tb, node);
+    ownData(node);
+    dropStats(tb, node, 1);
+    node->brackets_known = 0;
+    node->stats.known = 0;
+    if (node->packed != NULL) {
+        tb->packed -= node->packed_len;
+        releasePacked(node);
+    }
+    node->file_off = -1;
+    node->swap_off = -1;
+    if (need > node->cap) {
+        int cap = node->cap * 2;
+        if (cap < need) cap = need;
+        if (cap > NODE_MAX_SIZE && need <= NODE_MAX_SIZE) cap = NODE_MAX_SIZE;
+        node->data = (char*)realloc(node->data, cap);
+        tb->resident += cap - node->cap;
+        node->cap = cap;
+    }
+    return node->data;
+}
+
+/* 편집된 페이지를 스크래치 파일로 내보내는 함수 (성공하면 1) */
+int spillNode(TextBuffer *tb, Node *node) {
+#ifndef _WIN32
+    if (tb->swap_fd < 0) {
+        // 이름은 바로 지워서 종료하면 자동으로 정리되게 함
+        const char *dir = getenv("TMPDIR");
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/viva-swap-XXXXXX", dir ? dir : "/tmp");
+        tb->swap_fd = mkstemp(path);
+        if (tb->swap_fd < 0) {
+            return 0;
+        }
+        unlink(path);
+    }
+    // 같은 노드가 다시 편집되어 내보내질 때는 예전 자리를 덮어씀
+    // (저장 중인 자식 프로세스가 예전 내용을 읽고 있을 수 있으므로 저장 중에는 새 자리에 씀)
+    int reuse = node->swap_room >= node->len && loop.save_job == NULL;
+    long long off = reuse ? node->swap_slot : tb->swap_size;
+    if (writeAllAt(tb->swap_fd, node->data, node->len, off) < 0) {
+        return 0;
+    }
+    if (!reuse) {
+        tb->swap_size += node->len;
+        node->swap_slot = off;
+        node->swap_room = node->len;
+    }
+    node->swap_off = off;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* 상주 한도 유지 함수: 오래 안 쓴(화면에서 먼) 노드부터 내보내고 원본을 해제
+ * 디스크에 사본이 있는 페이지는 그냥 버리고, 편집된 페이지는 압축본 예산 안이면 압축,
+ * 넘으면 스크래치 파일로 내보냄 */
+void trimResident(TextBuffer *tb, Node *keep) {
+    while (tb->resident > tb->resident_limit && tb->lru_tail != NULL && tb->lru_tail != keep) {
+        Node *node = tb->lru_tail;
+        if (node->packed == NULL && node->file_off < 0 && node->swap_off < 0
+            && (tb->packed < tb->packed_limit || !spillNode(tb, node))) {
+            packNode(node);
+            tb->packed += node->packed_len;
+        }
+        lruRemove(tb, node);
+        tb->resident -= node->cap;
+        releaseData(node);
+        node->cap = 0;
+    }
+}
+
+/* 메모리 한도 설정 함수: 전체 예산 안에서 압축 해제본과 압축본 몫을 나눔 */
+void setMemoryLimits(TextBuffer *tb) {
+    const char *env = getenv("VIVA_MEM_BUDGET_MB");
+    long long budget = env ? atoll(env) : MEM_BUDGET_MB;
+    if (budget <= 0) budget = MEM_BUDGET_MB;
+    env = getenv("VIVA_RESIDENT_MB");
+    long long resident = env ? atoll(env) : RESIDENT_LIMIT_MB;
+    if (resident <= 0) resident = RESIDENT_LIMIT_MB;
+    if (resident > budget / 2) resident = budget / 2;
+    tb->resident_limit = resident << 20;
+    tb->packed_limit = (budget << 20) - tb->resident_limit;
+}
+
+/* 커서가 노드 끝에 있으면 다음 노드 시작으로 옮기는 함수 (버퍼 끝이면 0) */
+int normalizeForward(Cursor *c) {
+    while (c->current != NULL && c->offset >= c->current->len) {
+        if (c->current->next == NULL) {
+            return 0;
+        }
+        c->current = c->current->next;
+        c->offset = 0;
+    }
+    return c->current != NULL;
+}
+
+/* 커서 바로 뒤의 바이트 (버퍼 끝이면 -1) */
+int charAt(TextBuffer *tb, Cursor *c) {
+    if (!normalizeForward(c)) {
+        return -1;
+    }
+    return (unsigned char)nodeData(tb, c->current)[c->offset];
+}
+
+/* 한 바이트 앞으로 이동: 지나간 바이트를 반환 (끝이면 -1) */
+int stepForward(TextBuffer *tb, Cursor *c) {
+    int ch = charAt(tb, c);
+    if (ch >= 0) {
+        c->offset++;
+        c->pos++;
+    }
+    return ch;
+}
+
+/* 한 바이트 뒤로 이동: 지나간 바이트를 반환 (시작이면 -1) */
+int stepBackward(TextBuffer *tb, Cursor *c) {
+    while (c->current != NULL && c->offset == 0) {
+        if (c->current->prev == NULL) {
+            return -1;
+        }
+        c->current = c->current->prev;
+        c->offset = c->current->len;
+    }
+    if (c->current == NULL) {
+        return -1;
+    }
+    c->offset--;
+    c->pos--;
+    return (unsigned char)nodeData(tb, c->current)[c->offset];
+}
+
+/* 커서를 절대 위치로 옮기는 함수 (줄 번호는 갱신하지 않음) */
+void seekPosition(TextBuffer *tb, Cursor *c, long long pos) {
+    if (pos < 0) pos = 0;
+    if (pos > tb->size) pos = tb->size;
+    if (c->current == NULL) {
+        c->current = tb->head;
+        c->offset = 0;
+        c->pos = 0;
+        if (c->current == NULL) {
+            return;
+        }
+    }
+    // 현재 노드에서 출발해 노드 길이만 더하며 이동
+    long long start = c->pos - c->offset;
+    while (pos < start && c->current->prev != NULL) {
+        c->current = c->current->prev;
+        start -= c->current->len;
+    }
+    while (pos > start + c->current->len && c->current->next != NULL) {
+        start += c->current->len;
+        c->current = c->current->next;
+    }
+    c->offset = (int)(pos - start);
+    c->pos = pos;
+}
+
+/* 커서가 있는 줄의 열 계산 함수 (줄 시작까지 거슬러 셈) */
+int computeColumn(TextBuffer *tb, Cursor *c) {
+    Cursor t = *c;
+    int col = 0;
+    int ch;
+    while ((ch = stepBackward(tb, &t)) >= 0 && ch != '\n') {
+        col++;
+    }
+    return col;
+}
+
+/* 커서의 줄 번호와 열을 처음부터 다시 계산하는 함수 */
+void locateCursor(TextBuffer *tb, Cursor *c) {
+    long long row = 0;
+    for (Node *node = tb->head; node != NULL && node != c->current; node = node->next) {
+        row += node->lines > 0 ? node->lines : 0;
+    }
+    if (c->current != NULL) {
+        row += countNewlines(nodeData(tb, c->current), c->offset);
+    }
+    c->row = row;
+    c->col = computeColumn(tb, c);
+}
+
+/* 지정한 위치로 커서를 옮기는 함수 */
+void gotoPosition(TextBuffer *tb, Cursor *cursor, long long pos) {
+    seekPosition(tb, cursor, pos);
+    locateCursor(tb, cursor);
+}
+
+/* 줄 시작으로 이동하는 함수 */
+void moveToLineStart(TextBuffer *tb, Cursor *c) {
+    int ch;
+    while ((ch = stepBackward(tb, c)) >= 0) {
+        if (ch == '\n') {
+            stepForward(tb, c);
+            break;
+        }
+    }
+    c->col = 0;
+}
+
+/* 다음 줄 시작으로 이동하는 함수 (마지막 줄이면 0 반환) */
+int moveToNextLine(TextBuffer *tb, Cursor *c) {
+    while (normalizeForward(c)) {
+        char *data = nodeData(tb, c->current);
+        char *nl = memchr(data + c->offset, '\n', c->current->len - c->offset);
+        if (nl != NULL) {
+            int skip = (int)(nl - (data + c->offset)) + 1;
+            c->offset += skip;
+            c->pos += skip;
+            c->row++;
+            c->col = 0;
+            return 1;
+        }
+        c->pos += c->current->len - c->offset;
+        c->offset = c->current->len;
+    }
+    return 0;
+}
+
+/* 빈 노드 정리 및 작은 노드 병합 함수 (커서는 같은 위치를 유지) */
+void compactAround(TextBuffer *tb, Cursor *cursor) {
+    Node *node = cursor->current;
+    if (node == NULL) {
+        return;
+    }
+    if (node->len == 0) {
+        // 빈 노드는 제거하고 커서를 이웃 노드로
+        Node *prev = node->prev;
+        Node *next = node->next;
+        unlinkNode(tb, node);
+        freeNode(node);
+        if (prev != NULL) {
+            cursor->current = prev;
+            cursor->offset = prev->len;
+        } else {
+            cursor->current = next;
+            cursor->offset = 0;
+        }
+        return;
+    }
+    // 앞 노드와 합쳐도 충분히 작으면 병합
+    Node *prev = node->prev;
+    if (node->len < NODE_MIN_SIZE && prev != NULL && prev->len + node->len <= NODE_MAX_SIZE / 2) {
+        char *src = nodeData(tb, node);
+        char *dst = nodeWritable(tb, prev, prev->len + node->len);
+        memcpy(dst + prev->len, src, node->len);
+        prev->len += node->len;
+        prev->lines += node->lines;
+        tb->size += node->len;
+        tb->lines += node->lines;
+        cursor->current = prev;
+        cursor->offset += prev->len - node->len;
+        unlinkNode(tb, node);
+        freeNode(node);
+    }
+}
+
+/* 노드를 off 위치에서 둘로 나누는 함수: 뒷부분을 담은 새 노드를 반환 */
+Node* splitNode(TextBuffer *tb, Node *node, int off) {
+    char *data = nodeWritable(tb, node, node->len);
+    Node *rest = createNode(data + off, node->len - off);
+    node->len = off;
+    node->lines -= rest->lines;
+    tb->size -= rest->len;      // linkNode가 다시 더함
+    tb->lines -= rest->lines;
+    linkNode(tb, node, rest);
+    return rest;
+}
+
+/* 추가 커서를 위치 순서대로 넣는 함수 (같은 위치가 이미 있으면 무시) */
+void addCursorAt(TextBuffer *tb, long long pos) {
+    int lo = 0, hi = tb->cursor_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (tb->cursors[mid] < pos) lo = mid + 1; else hi = mid;
+    }
+    if (lo < tb->cursor_count && tb->cursors[lo] == pos) {
+        return;
+    }
+    if (tb->cursor_count == tb->cursor_cap) {
+        tb->cursor_cap = tb->cursor_cap ? tb->cursor_cap * 2 : 16;
+        tb->cursors = (long long*)realloc(tb->cursors, sizeof(long long) * tb->cursor_cap);
+    }
+    memmove(tb->cursors + lo + 1, tb->cursors + lo, sizeof(long long) * (tb->cursor_count - lo));
+    tb->cursors[lo] = pos;
+    tb->cursor_count++;
+}
+
+/* 추가 커서 보정 함수: [start, end)가 inserted 바이트로 바뀜
+ * (순수 삽입이면 그 위치의 커서도 뒤로 밀려 입력한 글자 뒤에 놓임) */
+void adjustCursors(TextBuffer *tb, long long start, long long end, long long inserted) {
+    for (int i = tb->cursor_count - 1; i >= 0 && tb->cursors[i] >= start; i--) {
+        if (tb->cursors[i] >= end) {
+            tb->cursors[i] += inserted - (end - start);
+        } else if (tb->cursors[i] > start) {
+            tb->cursors[i] = start;
+        }
+    }
+}
+
+/* 편집에 맞춰 화면 첫 줄 위치를 보정하는 함수 */
+void adjustPositions(TextBuffer *tb, Cursor *cursor, long long at, long long inserted, long long inserted_lines) {
+    invalidateCells(tb, at);
+    if (inserted > 0) {
+        adjustSessions(tb, at, at, inserted);
+        adjustFolds(tb, at, at, inserted);
+        adjustWraps(tb, at, at, inserted);
+    } else {
+        adjustSessions(tb, at, at - inserted, 0);
+        adjustFolds(tb, at, at - inserted, 0);
+        adjustWraps(tb, at, at - inserted, 0);
+    }
+    if (tb->mark > at) {
+        tb->mark = (inserted < 0 && tb->mark < at - inserted) ? at : tb->mark + inserted;
+    }
+    if (inserted > 0) {
+        adjustCursors(tb, at, at, inserted);
+    } else {
+        adjustCursors(tb, at, at - inserted, 0);
+    }
+    if (tb->top_pos > at) {
+        if (inserted > 0) {
+            tb->top_pos += inserted;
+            tb->top_row += inserted_lines;
+        } else {
+            // 화면 위쪽이 지워졌으면 커서 줄부터 다시 보여줌
+            tb->top_pos = cursor->pos - cursor->col;
+            tb->top_row = cursor->row;
+        }
+    }
+}
+
+/* 커서 위치에 바이트 열을 넣는 함수 */
+void insertBytes(TextBuffer *tb, Cursor *cursor, const char *bytes, int n) {
+    if (n <= 0) {
+        return;
+    }
+    tb->modified = 1; // 수정됨 표시
+    tb->version++;
+    long long at = cursor->pos;
+    int newlines = countNewlines(bytes, n);
+    recordInsert(tb, at, n);
+    Node *node = cursor->current;
+
+    if (node != NULL && node->len - cursor->offset > NODE_GAP_SPLIT && node->len + n <= NODE_MAX_SIZE) {
+        // 노드 가운데서 입력을 시작하면 커서 뒤를 한 번 떼어 냄:
+        // 노드의 남은 용량이 커서 위치의 빈 자리가 되어 이어지는 입력은 밀어낼 바이트가 없음
+        if (cursor->offset == 0 && node->prev != NULL && node->prev->len + n <= NODE_MAX_SIZE) {
+            cursor->current = node->prev;
+            cursor->offset = node->prev->len;
+        } else {
+            splitNode(tb, node, cursor->offset);
+        }
+        node = cursor->current;
+    }
+
+    if (node != NULL && node->len + n <= NODE_MAX_SIZE) {
+        // 노드 안에 자리가 있으면 그 자리에서 밀어 넣음
+        char *data = nodeWritable(tb, node, node->len + n);
+        memmove(data + cursor->offset + n, data + cursor->offset, node->len - cursor->offset);
+        memcpy(data + cursor->offset, bytes, n);
+        node->len += n;
+        node->lines += newlines;
+        tb->size += n;
+        tb->lines += newlines;
+        cursor->offset += n;
+    } else {
+        // 커서 위치에서 노드를 나누고 그 사이를 앞 노드의 남은 공간, 새 노드 순으로 채움
+        Node *prev;
+        if (node == NULL) {
+            prev = NULL;
+        } else if (cursor->offset == 0) {
+            prev = node->prev;
+        } else {
+            if (cursor->offset < node->len) {
+                splitNode(tb, node, cursor->offset);
+            }
+            prev = node;
+        }
+        const char *p = bytes;
+        int left = n;
+        if (prev != NULL && prev->len < NODE_MAX_SIZE) {
+            int k = NODE_MAX_SIZE - prev->len;
+            if (k > left) k = left;
+            char *data = nodeWritable(tb, prev, prev->len + k);
+            memcpy(data + prev->len, p, k);
+            int nl = countNewlines(p, k);
+            prev->len += k;
+            prev->lines += nl;
+            tb->size += k;
+            tb->lines += nl;
+            p += k;
+            left -= k;
+        }
+        Node *last = prev;
+        while (left > 0) {
+            int k = left < NODE_MAX_SIZE ? left : NODE_MAX_SIZE;
+            Node *newNode = createNode(p, k);
+            linkNode(tb, last, newNode);
+            last = newNode;
+            p += k;
+            left -= k;
+        }
+        cursor->current = last;
+        cursor->offset = last->len;
+    }
+
+    cursor->pos += n;
+    cursor->row += newlines;
+    if (newlines > 0) {
+        const char *q = bytes + n;
+        while (q > bytes && q[-1] != '\n') q--;
+        cursor->col = (int)(bytes + n - q);
+    } else {
+        cursor->col += n;
+    }
+    adjustPositions(tb, cursor, at, n, newlines);
+}
+
+/* 커서 앞의 바이트 n개를 지우는 함수 */
+void deleteBytes(TextBuffer *tb, Cursor *cursor, long long n) {
+    if (n > cursor->pos) n = cursor->pos;
+    if (n <= 0) {
+        return;
+    }
+    tb->modified = 1; // 수정됨 표시
+    tb->version++;
+    long long removed_lines = 0;
+    long long left = n;
+    char *removed = (char*)malloc(n);   // 되돌리기 기록에 남길 지워진 내용
+
+    while (left > 0) {
+        while (cursor->offset == 0) {
+            // 노드 시작이면 이전 노드 끝으로
+            cursor->current = cursor->current->prev;
+            cursor->offset = cursor->current->len;
+        }
+        Node *node = cursor->current;
+        if (node->len - cursor->offset > NODE_GAP_SPLIT) {
+            // 커서 뒤가 길면 떼어 내 이어지는 지우기가 노드 끝에서 일어나게 함
+            splitNode(tb, node, cursor->offset);
+        }
+        int k = left < cursor->offset ? (int)left : cursor->offset;
+        char *data = nodeWritable(tb, node, node->len);
+        int nl = countNewlines(data + cursor->offset - k, k);
+        memcpy(removed + left - k, data + cursor->offset - k, k);
+        memmove(data + cursor->offset - k, data + cursor->offset, node->len - cursor->offset);
+        node->len -= k;
+        node->lines -= nl;
+        tb->size -= k;
+        tb->lines -= nl;
+        cursor->offset -= k;
+        cursor->pos -= k;
+        left -= k;
+        removed_lines += nl;
+        compactAround(tb, cursor);
+    }
+    recordDelete(tb, cursor->pos, removed, n);
+    free(removed);
+
+    cursor->row -= removed_lines;
+    if (removed_lines > 0) {
+        cursor->col = computeColumn(tb, cursor);
+    } else {
+        cursor->col -= (int)n;
+    }
+    adjustPositions(tb, cursor, cursor->pos, -n, -removed_lines);
+}
+
+/* 노드 삽입 함수 (문자 하나) */
+void insertNode(TextBuffer *tb, Cursor *cursor, char c) {
+    insertBytes(tb, cursor, &c, 1);
+}
+
+/* 노드 삭제 함수 (커서 앞 문자 하나) */
+void deleteNode(TextBuffer *tb, Cursor *cursor) {
+    deleteBytes(tb, cursor, 1);
+}
+
+/* 사슬 끝에 노드를 잇는 함수 */
+void chainLink(Chain *chain, Node *node) {
+    node->prev = chain->tail;
+    node->next = NULL;
+    if (chain->tail != NULL) {
+        chain->tail->next = node;
+    } else {
+        chain->head = node;
+    }
+    chain->tail = node;
+    chain->len += node->len;
+}
+
+/* 사슬 해제 함수 */
+void chainFree(Chain *chain) {
+    while (chain->head != NULL) {
+        Node *next = chain->head->next;
+        freeNode(chain->head);
+        chain->head = next;
+    }
+    chain->tail = NULL;
+    chain->len = 0;
+}
+
+/* 버퍼 밖에 둘 노드의 원본을 내려놓는 함수 (디스크 사본이 있으면 버리고, 없으면 압축) */
+void parkNode(Node *node) {
+    if (node->data == NULL || node->data_refs != NULL) {
+        return;     // 함께 쓰는 원본은 다른 쪽이 들고 있으므로 그대로 둠
+    }
+    if (node->packed == NULL && node->file_off < 0 && node->swap_off < 0) {
+        packNode(node);
+    }
+    releaseData(node);
+    node->cap = 0;
+}
+
+/* 사슬 끝에 바이트 열을 이어 쓰는 함수 (끝 노드를 NODE_MAX_SIZE까지 채운 뒤 새 노드)
+ * 결과가 상주 한도의 절반을 넘으면 다 찬 노드는 바로 압축해 둠 */
+void chainAppend(TextBuffer *tb, Chain *chain, const char *bytes, long long n) {
+    while (n > 0) {
+        Node *node = chain->tail;
+        if (node == NULL || node->data == NULL || node->len == NODE_MAX_SIZE) {
+            if (node != NULL && node->data != NULL && chain->len > tb->resident_limit / 2) {
+                parkNode(node);
+            }
+            node = (Node*)calloc(1, sizeof(Node));
+            node->file_off = -1;
+            node->swap_off = -1;
+            node->cap = NODE_MAX_SIZE;
+            node->data = (char*)malloc(NODE_MAX_SIZE);
+            chainLink(chain, node);
+        }
+        ownData(node);
+        int k = NODE_MAX_SIZE - node->len;
+        if (k > n) k = (int)n;
+        memcpy(node->data + node->len, bytes, k);
+        node->lines += countNewlines(bytes, k);
+        node->len += k;
+        node->brackets_known = 0;
+        node->stats.known = 0;
+        chain->len += k;
+        bytes += k;
+        n -= k;
+    }
+}
+
+/* 사슬 앞에 바이트 열을 붙이는 함수 (연속 백스페이스 기록용) */
+void chainPrepend(TextBuffer *tb, Chain *chain, const char *bytes, long long n) {
+    Node *head = chain->head;
+    if (head != NULL && head->data != NULL && head->packed == NULL && head->len + n <= head->cap) {
+        ownData(head);
+        memmove(head->data + n, head->data, head->len);
+        memcpy(head->data, bytes, n);
+        head->len += (int)n;
+        head->lines += countNewlines(bytes, (int)n);
+        head->brackets_known = 0;
+        head->stats.known = 0;
+        chain->len += n;
+        return;
+    }
+    Chain front = {NULL, NULL, 0};
+    chainAppend(tb, &front, bytes, n);
+    if (chain->head != NULL) {
+        front.tail->next = chain->head;
+        chain->head->prev = front.tail;
+        front.tail = chain->tail;
+        front.len += chain->len;
+    }
+    *chain = front;
+}
+
+/* pos에서 시작하는 노드를 찾는 함수 (필요하면 노드를 나눔, 버퍼 끝이면 NULL) */
+Node* nodeStartingAt(TextBuffer *tb, long long pos) {
+    Cursor t = {NULL, 0, 0};
+    seekPosition(tb, &t, pos);
+    if (t.current == NULL) {
+        return NULL;
+    }
+    if (t.offset == 0) {
+        return t.current;
+    }
+    if (t.offset == t.current->len) {
+        return t.current->next;
+    }
+    return splitNode(tb, t.current, t.offset);
+}
+
+/* 범위 교체 함수: [start, end)의 노드를 떼어 cut에 담고 그 자리에 with 사슬을 이음
+ * 바이트를 복사하지 않고 노드를 옮기므로 범위 크기와 상관없이 노드 수에만 비례
+ * 커서는 끼워 넣은 내용의 끝으로 옮김 */
+void spliceRange(TextBuffer *tb, Cursor *cursor, long long start, long long end, Chain *with, Chain *cut) {
+    replaceNodes(tb, cursor, start, end, with, cut, 1);
+}
+
+/* spliceRange의 본체 (park가 0이면 떼어 낸 노드의 원본을 압축하지 않고 그대로 둠) */
+void replaceNodes(TextBuffer *tb, Cursor *cursor, long long start, long long end, Chain *with, Chain *cut, int park) {
+    Node *first = nodeStartingAt(tb, start);
+    Node *stop = nodeStartingAt(tb, end);
+    Node *prev = first != NULL ? first->prev : tb->tail;
+    Chain removed = {NULL, NULL, 0};
+
+    for (Node *node = first; node != stop; ) {
+        Node *next = node->next;
+        unlinkNode(tb, node);
+        if (park) {
+            parkNode(node);
+        }
+        chainLink(&removed, node);
+        node = next;
+    }
+    Node *after = prev;
+    for (Node *node = with->head; node != NULL; ) {
+        Node *next = node->next;
+        linkNode(tb, after, node);
+        if (node->lines < 0 && tb->index_job == NULL) {
+            nodeData(tb, node);     // 색인이 끝난 뒤 되돌아온 페이지는 여기서 줄 수를 셈
+        }
+        after = node;
+        node = next;
+    }
+    long long inserted = with->len;
+    with->head = with->tail = NULL;
+    with->len = 0;
+    *cut = removed;
+
+    // 경계에 생긴 작은 조각은 앞 노드와 합침
+    Cursor t = {NULL, 0, 0};
+    if (after != NULL && after->next != NULL) {
+        t.current = after->next;
+        compactAround(tb, &t);
+    }
+    if (prev != NULL && prev->next != NULL) {
+        t.current = prev->next;
+        t.offset = 0;
+        compactAround(tb, &t);
+    }
+
+    tb->modified = 1;
+    tb->version++;
+    invalidateCells(tb, start);
+    adjustSessions(tb, start, end, inserted);
+    adjustFolds(tb, start, end, inserted);
+    adjustWraps(tb, start, end, inserted);
+    long long delta = inserted - (end - start);
+    if (tb->mark >= end) {
+        tb->mark += delta;
+    } else if (tb->mark > start) {
+        tb->mark = start;
+    }
+    adjustCursors(tb, start, end, inserted);
+    if (tb->top_pos >= end) {
+        tb->top_pos += delta;
+    } else if (tb->top_pos > start) {
+        t.current = NULL;
+        seekPosition(tb, &t, start);
+        moveToLineStart(tb, &t);
+        tb->top_pos = t.pos;
+    }
+    tb->rows_stale = 1;     // 줄 번호는 다음 그리기 전에 다시 셈
+    cursor->current = NULL;
+    gotoPosition(tb, cursor, start + inserted);
+}
+
+/* 되돌리기 기록 해제 함수 */
+void freeUndoList(UndoRecord *record) {
+    while (record != NULL) {
+        UndoRecord *prev = record->prev;
+        chainFree(&record->old);
+        free(record);
+        record = prev;
+    }
+}
+
+/* 되돌리기 기록 추가 함수: 새 편집이 생기면 다시 실행 기록은 버림 */
+UndoRecord* pushUndo(TextBuffer *tb, long long pos, long long len, Chain *old, long long cursor_pos) {
+    freeUndoList(tb->redo);
+    tb->redo = NULL;
+
+    UndoRecord *record = (UndoRecord*)calloc(1, sizeof(UndoRecord));
+    record->pos = pos;
+    record->len = len;
+    if (old != NULL) {
+        record->old = *old;
+    }
+    record->cursor_pos = cursor_pos;
+    record->group = tb->undo_group;
+    record->prev = tb->undo;
+    tb->undo = record;
+
+    if (++tb->undo_count > tb->undo_trim_at) {
+        // 오래된 기록을 버리되 묶음은 자르지 않음 (매크로 재생은 한 묶음이 아주 클 수 있음)
+        // 다음 정리는 기록이 UNDO_LIMIT / 4만큼 더 쌓인 뒤에 해서 목록을 훑는 비용을 나눔
+        UndoRecord *r = tb->undo;
+        int kept = 1;
+        while (r->prev != NULL && (kept < UNDO_LIMIT || r->prev->group == r->group)) {
+            r = r->prev;
+            kept++;
+        }
+        freeUndoList(r->prev);
+        r->prev = NULL;
+        tb->undo_count = kept;
+        tb->undo_trim_at = kept + UNDO_LIMIT / 4;
+    }
+    return record;
+}
+
+/* 연속 타이핑 기록을 닫는 함수 (커서 이동, 줄바꿈 등) */
+void closeUndo(TextBuffer *tb) {
+    if (tb->undo != NULL) {
+        tb->undo->open = 0;
+    }
+}
+
+/* 삽입 기록 함수: 바로 앞에 친 글자에 이어지면 같은 기록을 늘림 */
+void recordInsert(TextBuffer *tb, long long pos, long long n) {
+    UndoRecord *r = tb->undo;
+    if (r != NULL && r->open && r->pos + r->len == pos) {
+        r->len += n;
+        return;
+    }
+    pushUndo(tb, pos, n, NULL, pos)->open = 1;
+}
+
+/* 삭제 기록 함수: [pos, pos + n)에 있던 bytes가 지워짐 */
+void recordDelete(TextBuffer *tb, long long pos, const char *bytes, long long n) {
+    UndoRecord *r = tb->undo;
+    if (r != NULL && r->open && r->pos + r->len == pos + n && r->len >= n) {
+        // 방금 친 글자를 지우는 경우
+        r->len -= n;
+        if (r->len == 0 && r->old.len == 0) {
+            tb->undo = r->prev;
+            tb->undo_count--;
+            free(r);
+        }
+        return;
+    }
+    if (r != NULL && r->open && r->pos == pos + n) {
+        // 기록 앞쪽으로 계속 지우는 경우
+        chainPrepend(tb, &r->old, bytes, n);
+        r->pos = pos;
+        return;
+    }
+    Chain old = {NULL, NULL, 0};
+    chainAppend(tb, &old, bytes, n);
+    pushUndo(tb, pos, 0, &old, pos + n)->open = 1;
+}
+
+/* 기록 하나를 적용하는 함수: 범위를 맞바꾸고 기록을 반대 방향으로 뒤집음 */
+void applyUndoRecord(TextBuffer *tb, Cursor *cursor, UndoRecord *r) {
+    long long here = cursor->pos;
+    long long len = r->old.len;
+    Chain cut;
+    spliceRange(tb, cursor, r->pos, r->pos + r->len, &r->old, &cut);
+    r->old = cut;
+    r->len = len;
+    r->open = 0;
+    gotoPosition(tb, cursor, r->cursor_pos);
+    r->cursor_pos = here;
+}
+
+/* 되돌리기 함수 (같은 묶음의 기록을 한 번에) */
+void undoEdit(TextBuffer *tb, Cursor *cursor) {
+    UndoRecord *r = tb->undo;
+    if (r == NULL) {
+        setMessage("Nothing to undo");
+        return;
+    }
+    long group = r->group;
+    while (r != NULL && r->group == group) {
+        tb->undo = r->prev;
+        tb->undo_count--;
+        applyUndoRecord(tb, cursor, r);
+        r->prev = tb->redo;
+        tb->redo = r;
+        r = tb->undo;
+    }
+    closeUndo(tb);
+}
+
+/* 다시 실행 함수 */
+void redoEdit(TextBuffer *tb, Cursor *cursor) {
+    UndoRecord *r = tb->redo;
+    if (r == NULL) {
+        setMessage("Nothing to redo");
+        return;
+    }
+    long group = r->group;
+    while (r != NULL && r->group == group) {
+        tb->redo = r->prev;
+        applyUndoRecord(tb, cursor, r);
+        r->prev = tb->undo;
+        tb->undo = r;
+        tb->undo_count++;
+        r = tb->redo;
+    }
+}
+
+/* 라인 수 계산 함수 (노드별 줄 수를 유지하므로 O(1)) */
+long long countLines(TextBuffer *tb) {
+    return tb->lines + 1;
+}
+
+/* 크기를 사람이 읽기 쉬운 문자열로 바꾸는 함수 */
+void formatSize(char *buf, size_t size, long long bytes) {
+    if (bytes >= (1LL << 30)) {
+        snprintf(buf, size, "%.1fG", bytes / (double)(1LL << 30));
+    } else if (bytes >= (1LL << 20)) {
+        snprintf(buf, size, "%.1fM", bytes / (double)(1LL << 20));
+    } else if (bytes >= 1024) {
+        snprintf(buf, size, "%.1fK", bytes / 1024.0);
+    } else {
+        snprintf(buf, size, "%lldB", bytes);
+    }
+}
+
+/* 상태 바 표시 함수 */
+void displayStatusBar(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    int status_bar = LINES - 2;
+    char status[COLS];
+    char resident[32], logical[32];
+    long long total_lines = countLines(tb);
+    // 메모리에 실제로 있는 크기(압축 해제본 + 압축본) 대 논리 크기
+    formatSize(resident, sizeof(resident), tb->resident + tb->packed);
+    formatSize(logical, sizeof(logical), tb->size);
+    int len;
+    if (tb->hex_view) {
+        // 16진 보기에서는 줄, 열 대신 바이트 위치를 표시
+        len = snprintf(status, COLS, " [%s] - HEX | Offset: 0x%llx (%lld) | Mem: %s/%s ",
+            tb->filename ? tb->filename : "No Name", cursor->pos, cursor->pos, resident, logical);
+    } else {
+        len = snprintf(status, COLS, " [%s] - %lld lines | Cursor: (%lld:%d) | Mem: %s/%s ",
+            tb->filename ? tb->filename : "No Name", total_lines, cursor->row + 1, cursor->col + 1,
+            resident, logical);
+    }
+    if (tb->swap_size > 0 && len >= 0 && len < COLS) {
+        char swap[32];
+        formatSize(swap, sizeof(swap), tb->swap_size);
+        len += snprintf(status + len, COLS - len, "| Swap: %s ", swap);
+    }
+    if (tb->cursor_count > 0 && len >= 0 && len < COLS) {
+        len += snprintf(status + len, COLS - len, "| %d cursors ", tb->cursor_count + 1);
+    }
+    if (loop.is_recording && len >= 0 && len < COLS) {
+        len += snprintf(status + len, COLS - len, "| Rec ");
+    }
+    if (tb->eol != EOL_LF && len >= 0 && len < COLS) {
+        len += snprintf(status + len, COLS - len, "| %s ", tb->eol == EOL_CRLF ? "CRLF" : "Mixed EOL");
+    }
+    if (tb->bom && len >= 0 && len < COLS) {
+        len += snprintf(status + len, COLS - len, "| BOM ");
+    }
+    if (tb->gzip && len >= 0 && len < COLS) {
+        len += snprintf(status + len, COLS - len, "| %s ", tb->gzip_job != NULL ? "gzip, unpacking" : "gzip");
+    }
+    if (tb->bad_utf8 && len >= 0 && len < COLS) {
+        len += snprintf(status + len, COLS - len, "| Bad UTF-8 @%lld ", tb->bad_utf8_at);
+    }
+#ifndef _WIN32
+    if (tb->index_job != NULL && len >= 0 && len < COLS) {
+        // 줄 수는 색인이 끝날 때까지 아는 만큼만 표시됨
+        int done = __atomic_load_n(&tb->index_job->done, __ATOMIC_ACQUIRE);
+        snprintf(status + len, COLS - len, "| Indexing %d%% ", (int)((long long)done * 100 / tb->index_job->pages));
+    }
+#endif
+    // 반전 효과
+    wattron(win, A_REVERSE);
+    mvwprintw(win, status_bar, 0, "%-*s", COLS - 1, status);
+    wattroff(win, A_REVERSE);
+    wrefresh(win);
+}
+
+/* 메시지 바 표시 함수 */
+void displayMessageBar(WINDOW *win) {
+    int message_bar = LINES - 1;
+    char message[COLS];
+    if (loop.prompt.active && loop.prompt.search == NULL) {
+        // 입력 중인 프롬프트 (길면 앞부분만)
+        snprintf(message, COLS, "%s%s", loop.prompt.label, loop.prompt.text);
+    } else if (loop.message[0] != '\0') {
+        // 백그라운드 작업 등에서 남긴 알림이 있으면 도움말 대신 표시
+        snprintf(message, COLS, "%s", loop.message);
+    } else {
+        snprintf(message, COLS, "HELP: %s = save | %s = quit | %s = find | %s = undo | ESC+X = command",
+            SAVE_KEY, QUIT_KEY, FIND_KEY, UNDO_KEY);
+    }
+    mvwprintw(win, message_bar, 0, "%-*s", COLS - 1, message);
+    wrefresh(win);
+}
+
+/* 줄 바꿈 지도의 자리 번호 */
+int wrapSlot(long long pos) {
+    return (int)(((unsigned long long)pos * 0x9E3779B97F4A7C15ULL) >> 40) & (WRAP_CACHE - 1);
+}
+
+/* 잰 줄 범위를 지도에 기록하는 함수 ([start, end), end는 '\n' 위치 또는 버퍼 끝) */
+void rememberLine(TextBuffer *tb, long long start, long long end) {
+    WrapLine line = {start, end + 1};
+    tb->wraps.by_start[wrapSlot(start)] = line;
+    tb->wraps.by_end[wrapSlot(end)] = line;
+}
+
+/* 줄 시작에 놓인 커서의 줄 길이 (지도에 없을 때만 '\n'까지 읽음) */
+long long lineLength(TextBuffer *tb, const Cursor *line) {
+    WrapLine *w = &tb->wraps.by_start[wrapSlot(line->pos)];
+    if (w->next > 0 && w->start == line->pos) {
+        return w->next - 1 - w->start;
+    }
+    Cursor t = *line;
+    long long end = moveToNextLine(tb, &t) ? t.pos - 1 : t.pos;
+    rememberLine(tb, line->pos, end);
+    return end - line->pos;
+}
+
+/* 줄 끝에 놓인 커서의 줄 길이 (지도에 없을 때만 줄 시작까지 거슬러 셈) */
+long long lineLengthBefore(TextBuffer *tb, Cursor *end) {
+    WrapLine *w = &tb->wraps.by_end[wrapSlot(end->pos)];
+    if (w->next > 0 && w->next - 1 == end->pos) {
+        return end->pos - w->start;
+    }
+    long long len = computeColumn(tb, end);
+    rememberLine(tb, end->pos - len, end->pos);
+    return len;
+}
+
+/* 편집에 맞춰 줄 바꿈 지도를 고치는 함수 ([start, end)가 inserted 바이트로 바뀜)
+ * 편집에 닿은 줄만 버리고 뒤쪽 줄은 위치만 옮겨 다시 넣음 */
+void adjustWraps(TextBuffer *tb, long long start, long long end, long long inserted) {
+    long long delta = inserted - (end - start);
+    WrapLine *tables[2] = {tb->wraps.by_start, tb->wraps.by_end};
+    WrapLine kept[WRAP_CACHE];
+    for (int k = 0; k < 2; k++) {
+        WrapLine *table = tables[k];
+        int count = 0;
+        for (int i = 0; i < WRAP_CACHE; i++) {
+            WrapLine w = table[i];
+            if (w.next == 0) {
+                continue;
+            }
+            if (w.start <= end && w.next > start) {
+                table[i].next = 0;
+            } else if (w.start > end && delta != 0) {
+                w.start += delta;
+                w.next += delta;
+                kept[count++] = w;
+                table[i].next = 0;
+            }
+        }
+        // 옮긴 줄은 새 위치의 자리로 (자리가 겹치면 나중 것이 남음)
+        for (int i = 0; i < count; i++) {
+            table[wrapSlot(k == 0 ? kept[i].start : kept[i].next - 1)] = kept[i];
+        }
+    }
+}
+
+/* 커서의 화면 위치를 줄 바꿈 지도로 구하는 함수
+ * 첫 줄부터 커서 줄까지 줄마다 차지하는 화면 줄 수를 더하고, 커서가 화면 아래로 밀려나면 그만큼 첫 줄을 내림 */
+void placeCursor(TextBuffer *tb, Cursor *cursor, int rows) {
+    int width = COLS;
+    long long line = cursor->pos - cursor->col;
+    Cursor t = *cursor;
+    seekPosition(tb, &t, tb->top_pos);
+    t.row = tb->top_row;
+    long long y = 0;
+    while (t.pos < line) {
+        long long len = lineLength(tb, &t);
+        y += len / width + 1;
+        seekPosition(tb, &t, t.pos + len);
+        if (!nextVisibleLine(tb, &t)) {
+            break;
+        }
+    }
+    y += cursor->col / width;
+
+    seekPosition(tb, &t, tb->top_pos);
+    t.row = tb->top_row;
+    while (y >= rows && t.pos < line) {
+        long long len = lineLength(tb, &t);
+        y -= len / width + 1;
+        seekPosition(tb, &t, t.pos + len);
+        if (!nextVisibleLine(tb, &t)) {
+            break;
+        }
+    }
+    tb->top_pos = t.pos;
+    tb->top_row = t.row;
+    // 커서 줄 하나가 화면보다 길면 마지막 줄에 둠 (첫 줄은 줄 시작이어야 함)
+    cursor->y = (int)(y < rows ? y : rows - 1);
+    cursor->x = cursor->col % width;
+}
+
+/* 접은 구간이 있을 때의 스크롤 함수: 화면 줄은 보이는 줄만 셈 */
+void scrollFolded(TextBuffer *tb, Cursor *cursor) {
+    long long rows = TEXT_ROWS;
+    long long line = cursor->pos - cursor->col;
+    Cursor t = *cursor;
+    Fold *f = foldAt(tb, tb->top_pos);
+    if (f != NULL) {
+        // 첫 줄이 접혀 들어갔으면 구간 머리줄부터
+        seekPosition(tb, &t, f->start - 1);
+        moveToLineStart(tb, &t);
+        tb->top_row -= countLinesBetween(tb, t.pos, tb->top_pos);
+        tb->top_pos = t.pos;
+    }
+    if (line >= tb->top_pos) {
+        seekPosition(tb, &t, tb->top_pos);
+        for (long long n = 0; n < rows && t.pos <= line; n++) {
+            if (t.pos == line) {
+                return;
+            }
+            if (!nextVisibleLine(tb, &t)) {
+                break;
+            }
+        }
+        // 아래로 벗어났으면 커서 줄이 마지막 줄에 오도록
+        t = *cursor;
+        seekPosition(tb, &t, line);
+        t.col = 0;
+        for (long long n = 1; n < rows && prevVisibleLine(tb, &t); n++) {
+        }
+    } else {
+        t = *cursor;
+        seekPosition(tb, &t, line);
+    }
+    tb->top_pos = t.pos;
+    tb->top_row = t.row;
+}
+
+/* 화면 스크롤 함수: 커서 줄이 본문 영역 안에 오도록 첫 줄 위치를 조정 */
+void scrollToCursor(TextBuffer *tb, Cursor *cursor) {
+    if (tb->fold_count > 0) {
+        scrollFolded(tb, cursor);
+        return;
+    }
+    long long rows = TEXT_ROWS;
+    long long below = cursor->row - (tb->top_row + rows - 1);
+
+    if (cursor->row >= tb->top_row && below <= 0) {
+        return;
+    }
+    Cursor t = *cursor;
+    if (cursor->row < tb->top_row && tb->top_row - cursor->row < rows) {
+        // 조금 위로: 커서 줄을 첫 줄로
+        moveToLineStart(tb, &t);
+    } else if (below > 0 && below < rows) {
+        // 조금 아래로: 그만큼 첫 줄을 내림
+        seekPosition(tb, &t, tb->top_pos);
+        t.row = tb->top_row;
+        for (long long i = 0; i < below; i++) {
+            moveToNextLine(tb, &t);
+        }
+    } else {
+        // 멀리 이동했으면 커서 줄이 화면 위쪽 1/3에 오도록 새로 잡음
+        moveToLineStart(tb, &t);
+        for (long long i = 0; i < rows / 3 && t.row > 0; i++) {
+            stepBackward(tb, &t);
+            moveToLineStart(tb, &t);
+            t.row--;
+        }
+    }
+    tb->top_pos = t.pos;
+    tb->top_row = t.row;
+}
+
+/* 텍스트 버퍼를 화면에 표시하는 함수 */
+void displayList(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    int rows = TEXT_ROWS;
+    if (cursor != NULL) {
+        revealCursor(tb, cursor);
+        scrollToCursor(tb, cursor);
+        placeCursor(tb, cursor, rows);
+    }
+
+    wclear(win);
+    Cursor temp = {tb->head, 0, 0, 0, 0, 0, 0};
+    if (cursor != NULL) {
+        temp = *cursor;
+    }
+    seekPosition(tb, &temp, tb->top_pos);
+    int x = 0, y = 0;
+    // 영역 표시 범위와 화면 안에 들어오는 첫 추가 커서
+    long long region_start = 0, region_end = 0;
+    if (cursor != NULL && tb->mark >= 0) {
+        region_start = tb->mark < cursor->pos ? tb->mark : cursor->pos;
+        region_end = tb->mark < cursor->pos ? cursor->pos : tb->mark;
+    }
+    int next = 0;
+    while (next < tb->cursor_count && tb->cursors[next] < tb->top_pos) next++;
+
+    while (y < rows) {
+        // 영역과 추가 커서는 그 자리 글자를 반전해 표시 (추가 커서가 줄 끝이면 빈칸)
+        chtype attr = (temp.pos >= region_start && temp.pos < region_end) ? A_REVERSE : 0;
+        if (next < tb->cursor_count && tb->cursors[next] == temp.pos) {
+            attr = A_REVERSE;
+            next++;
+            if (charAt(tb, &temp) < 0 || charAt(tb, &temp) == '\n') {
+                mvwaddch(win, y, x, ' ' | attr);
+            }
+        }
+        int ch = stepForward(tb, &temp);
+        if (ch < 0) {
+            break;
+        }
+        if (ch == '\n') {
+            Fold *f = tb->fold_count > 0 ? foldStartingAt(tb, temp.pos) : NULL;
+            if (f != NULL) {
+                // 접은 구간은 머리줄 끝에 숨긴 줄 수만 표시하고 건너뜀
+                char note[48];
+                snprintf(note, sizeof(note), " ... %lld lines", f->lines);
+                wattron(win, A_BOLD);
+                mvwaddnstr(win, y, x, note, COLS - x);
+                wattroff(win, A_BOLD);
+                seekPosition(tb, &temp, f->end);
+                while (next < tb->cursor_count && tb->cursors[next] < temp.pos) next++;
+            }
+            x = 0;
+            y++;
+        } else {
+            mvwaddch(win, y, x, (unsigned char)ch | attr);
+            x++;
+            if (x >= COLS) {
+                x = 0;
+                y++;
+            }
+        }
+    }
+    wrefresh(win);
+    if (cursor != NULL) {
+        displayStatusBar(win, tb, cursor);
+    }
+    displayMessageBar(win);
+}
+
+/* 16진 보기 한 줄의 바이트 수 */
+int hexRowBytes(void) {
+    return COLS >= HEX_OFFSET_WIDTH + 16 * 4 + 2 ? 16 : 8;
+}
+
+/* 16진 보기 표시 함수: 화면에 보이는 줄의 바이트만 읽어 위치, 16진, 문자 칸으로 그림 */
+void displayHex(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    int rows = TEXT_ROWS;
+    int per_row = hexRowBytes();
+    long long at = cursor->pos - cursor->pos % per_row;
+    // 커서 줄이 화면 밖이면 첫 줄을 옮김 (한 줄 바이트 수 단위라 위치 계산만으로 충분)
+    if (at < tb->hex_top) {
+        tb->hex_top = at;
+    } else if (at >= tb->hex_top + (long long)rows * per_row) {
+        tb->hex_top = at - (long long)(rows - 1) * per_row;
+    }
+    tb->hex_top -= tb->hex_top % per_row;
+
+    wclear(win);
+    Cursor t = *cursor;     // 커서 노드에서 출발하면 가까운 노드만 지나감
+    seekPosition(tb, &t, tb->hex_top);
+    unsigned char bytes[16];
+    for (int y = 0; y < rows; y++) {
+        long long off = tb->hex_top + (long long)y * per_row;
+        if (off > tb->size || (off == tb->size && cursor->pos != off)) {
+            break;
+        }
+        int n = 0;
+        int ch;
+        while (n < per_row && (ch = stepForward(tb, &t)) >= 0) {
+            bytes[n++] = (unsigned char)ch;
+        }
+        mvwprintw(win, y, 0, "%010llx", off);
+        for (int i = 0; i < per_row; i++) {
+            int hx = HEX_OFFSET_WIDTH + i * 3 + (i >= per_row / 2);
+            int ax = HEX_OFFSET_WIDTH + per_row * 3 + 2 + i;
+            int here = off + i == cursor->pos;
+            if (here) {
+                // 커서는 편집 중인 칸에 두고 다른 칸의 같은 바이트는 반전해 표시
+                cursor->y = y;
+                cursor->x = tb->hex_ascii ? ax : hx + tb->hex_nibble;
+            }
+            if (i >= n) {
+                continue;
+            }
+            chtype hex_attr = here && tb->hex_ascii ? A_REVERSE : 0;
+            chtype ascii_attr = here && !tb->hex_ascii ? A_REVERSE : 0;
+            mvwaddch(win, y, hx, "0123456789abcdef"[bytes[i] >> 4] | hex_attr);
+            mvwaddch(win, y, hx + 1, "0123456789abcdef"[bytes[i] & 15] | hex_attr);
+            mvwaddch(win, y, ax, (bytes[i] >= 32 && bytes[i] <= 126 ? bytes[i] : '.') | ascii_attr);
+        }
+    }
+    // 화면에 그린 페이지 말고는 상주 한도에 맞춰 내보냄
+    trimResident(tb, t.current);
+    wrefresh(win);
+    displayStatusBar(win, tb, cursor);
+    displayMessageBar(win);
+}
+
+/* 커서 자리의 바이트를 바꾸는 함수 (16진 보기의 덮어쓰기, 길이는 그대로) */
+void overwriteByte(TextBuffer *tb, Cursor *cursor, unsigned char byte) {
+    if (cursor->pos == tb->size) {
+        // 끝에서는 덧붙임
+        insertBytes(tb, cursor, (char*)&byte, 1);
+        seekPosition(tb, cursor, cursor->pos - 1);
+        return;
+    }
+    Cursor t = *cursor;
+    normalizeForward(&t);
+    Node *node = t.current;
+    unsigned char old = (unsigned char)nodeData(tb, node)[t.offset];
+    if (old == byte) {
+        return;
+    }
+    // 이어서 덮어쓴 바이트는 한 기록으로 모음 (같은 바이트를 다시 고치면 기록은 그대로)
+    UndoRecord *r = tb->undo;
+    long long pos = cursor->pos;
+    int overwriting = r != NULL && r->open && r->len == r->old.len;
+    if (overwriting && pos >= r->pos && pos < r->pos + r->len) {
+        // 이미 기록된 바이트 (16진 두 번째 자리)
+    } else if (overwriting && r->pos + r->len == pos) {
+        chainAppend(tb, &r->old, (char*)&old, 1);
+        r->len++;
+    } else {
+        Chain saved = {NULL, NULL, 0};
+        chainAppend(tb, &saved, (char*)&old, 1);
+        pushUndo(tb, pos, 1, &saved, pos)->open = 1;
+    }
+    char *data = nodeWritable(tb, node, node->len);
+    data[t.offset] = (char)byte;
+    invalidateCells(tb, pos);
+    adjustFolds(tb, pos, pos + 1, 1);
+    adjustWraps(tb, pos, pos + 1, 1);
+    int delta = (byte == '\n') - (old == '\n');
+    if (delta != 0 && node->lines >= 0) {
+        node->lines += delta;
+        tb->lines += delta;
+        tb->rows_stale = 1;
+    }
+    tb->modified = 1;
+    tb->version++;
+    cursor->current = t.current;
+    cursor->offset = t.offset;
+}
+
+/* 16진 보기 커서 이동 함수 (줄, 열 계산 없이 위치만 옮김) */
+void moveHexCursor(TextBuffer *tb, Cursor *cursor, long long pos) {
+    if (pos < 0) pos = 0;
+    if (pos > tb->size) pos = tb->size;
+    seekPosition(tb, cursor, pos);
+    tb->hex_nibble = 0;
+    tb->rows_stale = 1;
+}
+
+/* 16진 보기 키 처리 함수 */
+void handleHexKey(TextBuffer *tb, Cursor *cursor, int ch) {
+    long long per_row = hexRowBytes();
+    long long page = per_row * (TEXT_ROWS > 1 ? TEXT_ROWS - 1 : 1);
+    switch (ch) {
+        case KEY_LEFT:
+        case KEY_BACKSPACE:
+        case 127:
+        case 8:
+            // 덮어쓰기 모드라 백스페이스는 지우지 않고 앞으로 감
+            closeUndo(tb);
+            moveHexCursor(tb, cursor, cursor->pos - 1);
+            return;
+        case KEY_RIGHT:
+            closeUndo(tb);
+            moveHexCursor(tb, cursor, cursor->pos + 1);
+            return;
+        case KEY_UP:
+            closeUndo(tb);
+            moveHexCursor(tb, cursor, cursor->pos >= per_row ? cursor->pos - per_row : cursor->pos);
+            return;
+        case KEY_DOWN:
+            closeUndo(tb);
+            moveHexCursor(tb, cursor, cursor->pos + per_row <= tb->size ? cursor->pos + per_row : cursor->pos);
+            return;
+        case KEY_PPAGE:
+            closeUndo(tb);
+            tb->hex_top = tb->hex_top > page ? tb->hex_top - page : 0;
+            moveHexCursor(tb, cursor, cursor->pos > page ? cursor->pos - page : cursor->pos % per_row);
+            return;
+        case KEY_NPAGE:
+            closeUndo(tb);
+            if (cursor->pos + page <= tb->size) {
+                tb->hex_top += page;
+                moveHexCursor(tb, cursor, cursor->pos + page);
+            } else {
+                moveHexCursor(tb, cursor, tb->size);
+            }
+            return;
+        case KEY_HOME:
+            moveHexCursor(tb, cursor, cursor->pos - cursor->pos % per_row);
+            return;
+        case KEY_END:
+            moveHexCursor(tb, cursor, cursor->pos - cursor->pos % per_row + per_row - 1);
+            return;
+        case '\t':
+            // Tab: 16진 칸과 문자 칸 사이를 오감
+            tb->hex_ascii = !tb->hex_ascii;
+            tb->hex_nibble = 0;
+            return;
+        default:
+            break;
+    }
+    if (tb->hex_ascii) {
+        if (isTextKey(ch)) {
+            overwriteByte(tb, cursor, (unsigned char)ch);
+            seekPosition(tb, cursor, cursor->pos + 1);
+        }
+        return;
+    }
+    int digit = -1;
+    if (ch >= '0' && ch <= '9') digit = ch - '0';
+    else if (ch >= 'a' && ch <= 'f') digit = ch - 'a' + 10;
+    else if (ch >= 'A' && ch <= 'F') digit = ch - 'A' + 10;
+    if (digit < 0) {
+        return;
+    }
+    Cursor t = *cursor;
+    int old = charAt(tb, &t);
+    if (old < 0) old = 0;
+    if (tb->hex_nibble == 0) {
+        overwriteByte(tb, cursor, (unsigned char)((digit << 4) | (old & 15)));
+        tb->hex_nibble = 1;
+    } else {
+        overwriteByte(tb, cursor, (unsigned char)((old & 0xf0) | digit));
+        seekPosition(tb, cursor, cursor->pos + 1);
+        tb->hex_nibble = 0;
+    }
+}
+
+/* 16진 보기 전환 함수 */
+void toggleHexView(TextBuffer *tb, Cursor *cursor) {
+    closeUndo(tb);
+    tb->hex_view = !tb->hex_view;
+    tb->hex_nibble = 0;
+    if (tb->hex_view) {
+        clearCursors(tb);
+        tb->mark = -1;
+        tb->hex_top = cursor->pos - cursor->pos % hexRowBytes();
+    } else {
+        // 16진 보기에서 옮기거나 고친 만큼 줄 번호를 다시 셈
+        relocateRows(tb, cursor);
+    }
+    loop.dirty = 1;
+}
+
+/* 입력받은 바이트 위치로 이동하는 함수 (0x로 시작하면 16진수) */
+void gotoOffsetAnswer(TextBuffer *tb, Cursor *cursor, const char *answer) {
+    if (answer == NULL || answer[0] == '\0') {
+        return;
+    }
+    char *end;
+    long long pos = strtoll(answer, &end, 0);
+    if (*end != '\0' || pos < 0) {
+        setMessage("Invalid offset: %s", answer);
+        return;
+    }
+    closeUndo(tb);
+    if (pos > tb->size) pos = tb->size;
+    if (tb->hex_view) {
+        // 노드 길이만 더해 가며 찾으므로 페이지를 읽지 않음
+        moveHexCursor(tb, cursor, pos);
+    } else {
+        gotoPosition(tb, cursor, pos);
+    }
+}
+
+/* 바이트 위치로 이동하는 함수 */
+void gotoOffset(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    openPrompt("Go to offset: ", 32, NULL, 0, gotoOffsetAnswer);
+}
+
+/* 표 보기 해제 함수 */
+void freeTable(TextBuffer *tb) {
+    if (tb->table == NULL) {
+        return;
+    }
+    for (int i = 0; i < TABLE_CACHE; i++) {
+        free(tb->table->cache[i].starts);
+    }
+    free(tb->table->widths);
+    free(tb->table);
+    tb->table = NULL;
+}
+
+/* 편집된 위치 뒤의 칸 경계 캐시를 버리는 함수 (앞쪽 줄은 위치가 그대로라 유지) */
+void invalidateCells(TextBuffer *tb, long long pos) {
+    if (tb->table == NULL) {
+        return;
+    }
+    for (int i = 0; i < TABLE_CACHE; i++) {
+        if (tb->table->cache[i].pos >= 0 && tb->table->cache[i].end >= pos) {
+            tb->table->cache[i].pos = -1;
+        }
+    }
+}
+
+/* 칸 너비 갱신 함수 (너비는 줄어들지 않아 스크롤해도 표가 흔들리지 않음) */
+void growWidths(TableView *view, const CellLine *line) {
+    if (line->count > view->width_count) {
+        view->widths = (int*)realloc(view->widths, sizeof(int) * line->count);
+        for (int i = view->width_count; i < line->count; i++) {
+            view->widths[i] = 1;
+        }
+        view->width_count = line->count;
+    }
+    for (int i = 0; i < line->count; i++) {
+        int w = line->starts[i + 1] - 1 - line->starts[i];
+        if (w > TABLE_MAX_WIDTH) w = TABLE_MAX_WIDTH;
+        if (w > view->widths[i]) view->widths[i] = w;
+    }
+}
+
+/* 칸 시작 위치 추가 함수 (끝 표시 자리를 하나 남겨 둠) */
+void addCellStart(CellLine *line, int start) {
+    if (line->count + 2 > line->cap) {
+        line->cap = line->cap ? line->cap * 2 : 16;
+        line->starts = (int*)realloc(line->starts, sizeof(int) * line->cap);
+    }
+    line->starts[line->count++] = start;
+}
+
+/* 줄 하나의 칸 경계를 구하는 함수 (캐시에 없을 때만 줄을 읽음)
+ * 따옴표 안의 구분자는 칸을 나누지 않음 */
+CellLine* lineCells(TextBuffer *tb, long long pos) {
+    TableView *view = tb->table;
+    for (int i = 0; i < TABLE_CACHE; i++) {
+        if (view->cache[i].pos == pos) {
+            return &view->cache[i];
+        }
+    }
+    CellLine *line = &view->cache[view->cache_next];
+    view->cache_next = (view->cache_next + 1) % TABLE_CACHE;
+    line->pos = pos;
+    line->count = 0;
+
+    Cursor t = {NULL, 0, 0};
+    seekPosition(tb, &t, pos);
+    int quoted = 0;
+    int len = 0;
+    int start = 0;
+    int ch;
+    while (len < TABLE_LINE_MAX && (ch = charAt(tb, &t)) >= 0 && ch != '\n') {
+        stepForward(tb, &t);
+        len++;
+        if (ch == '"') {
+            quoted = !quoted;
+        } else if (ch == view->delim && !quoted) {
+            addCellStart(line, start);
+            start = len;
+        }
+    }
+    addCellStart(line, start);
+    line->starts[line->count] = len + 1;
+    line->end = t.pos;
+    if (len == TABLE_LINE_MAX && charAt(tb, &t) != '\n') {
+        // 너무 긴 줄은 앞부분만 칸으로 나누고 끝 위치만 찾아 둠
+        line->end = moveToNextLine(tb, &t) ? t.pos - 1 : t.pos;
+    }
+    growWidths(view, line);
+    return line;
+}
+
+/* 커서가 놓인 칸 번호 */
+int cellIndex(const CellLine *line, long long pos) {
+    int k = 0;
+    while (k + 1 < line->count && line->pos + line->starts[k + 1] <= pos) {
+        k++;
+    }
+    return k;
+}
+
+/* 표 보기 전환 함수: 머리줄과 파일 여기저기서 고른 줄만 읽어 칸 너비를 어림함 */
+void toggleTableView(TextBuffer *tb, Cursor *cursor) {
+    if (tb->table != NULL) {
+        freeTable(tb);
+        loop.dirty = 1;
+        return;
+    }
+    TableView *view = (TableView*)calloc(1, sizeof(TableView));
+    for (int i = 0; i < TABLE_CACHE; i++) {
+        view->cache[i].pos = -1;
+    }
+    // 첫 줄에 탭이 쉼표보다 많으면 TSV로 봄
+    view->delim = ',';
+    Cursor t = {NULL, 0, 0};
+    seekPosition(tb, &t, 0);
+    int commas = 0, tabs = 0, ch;
+    for (int i = 0; i < TABLE_LINE_MAX && (ch = stepForward(tb, &t)) >= 0 && ch != '\n'; i++) {
+        commas += ch == ',';
+        tabs += ch == '\t';
+    }
+    if (tabs > commas) {
+        view->delim = '\t';
+    }
+    tb->table = view;
+    clearCursors(tb);
+    tb->mark = -1;
+    for (int i = 0; i < TABLE_SAMPLE; i++) {
+        Cursor s = {NULL, 0, 0};
+        seekPosition(tb, &s, tb->size / TABLE_SAMPLE * i);
+        if (s.pos > 0 && !moveToNextLine(tb, &s)) {
+            break;
+        }
+        lineCells(tb, s.pos);
+        trimResident(tb, cursor->current);
+    }
+    loop.dirty = 1;
+}
+
+/* 같은 줄 안에서 커서를 옮기는 함수 (줄 번호는 그대로) */
+void moveInLine(TextBuffer *tb, Cursor *cursor, long long pos) {
+    cursor->col += (int)(pos - cursor->pos);
+    seekPosition(tb, cursor, pos);
+}
+
+/* 표 보기 키 처리 함수: 좌우는 칸 단위, 위아래는 같은 칸을 유지하며 줄 단위로 이동 */
+void handleTableKey(TextBuffer *tb, Cursor *cursor, int ch) {
+    closeUndo(tb);
+    long long line_start = cursor->pos - cursor->col;
+    CellLine *line = lineCells(tb, line_start);
+    int k = cellIndex(line, cursor->pos);
+    if (ch == KEY_LEFT) {
+        if (cursor->pos > line_start + line->starts[k]) {
+            moveInLine(tb, cursor, line_start + line->starts[k]);
+        } else if (k > 0) {
+            moveInLine(tb, cursor, line_start + line->starts[k - 1]);
+        }
+        return;
+    }
+    if (ch == KEY_RIGHT) {
+        if (k + 1 < line->count) {
+            moveInLine(tb, cursor, line_start + line->starts[k + 1]);
+        }
+        return;
+    }
+    int steps = (ch == KEY_PPAGE || ch == KEY_NPAGE) ? TEXT_ROWS - 2 : 1;
+    for (int i = 0; i < steps; i++) {
+        if (ch == KEY_UP || ch == KEY_PPAGE) {
+            moveLineUp(tb, cursor);
+        } else {
+            moveLineDown(tb, cursor);
+        }
+    }
+    // 새 줄에서 같은 번호의 칸 시작으로 (칸이 모자라면 마지막 칸)
+    moveInLine(tb, cursor, cursor->pos - cursor->col);
+    line = lineCells(tb, cursor->pos);
+    if (k >= line->count) {
+        k = line->count - 1;
+    }
+    moveInLine(tb, cursor, cursor->pos + line->starts[k]);
+}
+
+/* 표 한 줄 그리는 함수: 화면에 들어오는 칸의 바이트만 읽음 */
+void drawTableRow(WINDOW *win, TextBuffer *tb, Cursor *cursor, int y, long long pos, chtype base) {
+    TableView *view = tb->table;
+    CellLine *line = lineCells(tb, pos);
+    int cursor_cell = cursor->pos >= pos && cursor->pos <= line->end ? cellIndex(line, cursor->pos) : -1;
+    int x = 0;
+    Cursor t = {NULL, 0, 0};
+    for (int c = view->first_col; c < line->count && x < COLS; c++) {
+        int w = c < view->width_count ? view->widths[c] : 1;
+        int len = line->starts[c + 1] - 1 - line->starts[c];
+        chtype attr = base | (c == cursor_cell ? A_REVERSE : 0);
+        seekPosition(tb, &t, pos + line->starts[c]);
+        for (int i = 0; i < w && x + i < COLS; i++) {
+            int ch = i < len ? stepForward(tb, &t) : ' ';
+            mvwaddch(win, y, x + i, (ch >= 32 && ch <= 126 ? ch : '.') | attr);
+        }
+        if (c == cursor_cell) {
+            long long in_cell = cursor->pos - (pos + line->starts[c]);
+            cursor->y = y;
+            cursor->x = x + (int)(in_cell < w ? in_cell : w);
+            if (cursor->x >= COLS) cursor->x = COLS - 1;
+        }
+        x += w;
+        if (x + 3 <= COLS) {
+            mvwaddstr(win, y, x, " | ");
+        }
+        x += 3;
+    }
+}
+
+/* 표 보기 표시 함수: 첫 줄은 머리줄로 고정하고 그 아래에 화면에 보이는 줄만 그림 */
+void displayTable(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    TableView *view = tb->table;
+    long long body = TEXT_ROWS - 1;
+    Cursor top = *cursor;
+    // 본문은 둘째 줄부터 (머리줄은 맨 위에 따로 그림)
+    if (tb->top_row < 1) {
+        seekPosition(tb, &top, 0);
+        top.row = 0;
+        if (moveToNextLine(tb, &top)) {
+            tb->top_pos = top.pos;
+            tb->top_row = 1;
+        }
+    }
+    if (cursor->row >= 1 && (cursor->row < tb->top_row || cursor->row >= tb->top_row + body)) {
+        if (cursor->row >= tb->top_row + body && cursor->row < tb->top_row + 2 * body) {
+            // 조금 아래로: 그만큼 첫 줄을 내림
+            seekPosition(tb, &top, tb->top_pos);
+            top.row = tb->top_row;
+            while (top.row <= cursor->row - body && moveToNextLine(tb, &top)) {
+            }
+        } else {
+            seekPosition(tb, &top, cursor->pos - cursor->col);
+            top.row = cursor->row;
+        }
+        tb->top_pos = top.pos;
+        tb->top_row = top.row;
+    }
+    // 커서 칸이 화면 안에 들어오도록 칸 단위로 가로 스크롤
+    CellLine *line = lineCells(tb, cursor->pos - cursor->col);
+    int k = cellIndex(line, cursor->pos);
+    if (k < view->first_col) {
+        view->first_col = k;
+    }
+    while (view->first_col < k) {
+        int x = 0;
+        for (int c = view->first_col; c <= k && c < view->width_count; c++) {
+            x += view->widths[c] + 3;
+        }
+        if (x <= COLS) {
+            break;
+        }
+        view->first_col++;
+    }
+
+    wclear(win);
+    drawTableRow(win, tb, cursor, 0, 0, A_BOLD);
+    Cursor t = top;
+    seekPosition(tb, &t, tb->top_pos);
+    for (int y = 1; y <= body; y++) {
+        drawTableRow(win, tb, cursor, y, t.pos, 0);
+        if (!moveToNextLine(tb, &t)) {
+            break;
+        }
+    }
+    trimResident(tb, cursor->current);
+    wrefresh(win);
+    displayStatusBar(win, tb, cursor);
+    displayMessageBar(win);
+}
+
+#ifndef _WIN32
+/* 줄 색인 진행 알림 (메인 스레드에서 실행) */
+void indexProgress(void *arg) {
+    IndexJob *job = (IndexJob*)arg;
+    if (job->tb->index_job == job) {
+        loop.dirty = 1;
+    }
+}
+
+/* 줄 색인 완료 처리 함수 (메인 스레드에서 실행): 아직 불러오지 않은 페이지에 줄 수를 채움 */
+void finishIndex(void *arg) {
+    IndexJob *job = (IndexJob*)arg;
+    TextBuffer *tb = job->tb;
+    pthread_join(job->thread, NULL);
+    close(job->fd);
+    for (Node *node = tb->head; node != NULL; node = node->next) {
+        if (node->file_off < 0) {
+            continue;
+        }
+        int page = (int)(node->file_off / NODE_MAX_SIZE);
+        if (node->lines < 0) {
+            int n = job->page_lines[page];
+            if (n >= 0) {
+                node->lines = n;
+                tb->lines += n;
+                tb->unindexed--;
+            }
+        }
+        if (!node->stats.known && job->page_stats[page].known) {
+            node->stats = job->page_stats[page];
+        }
+    }
+    free(job->page_stats);
+    // 페이지 단위로 연 파일은 바이트를 그대로 두므로 형식만 알려 줌
+    noteScan(tb, &job->scan);
+    tb->index_job = NULL;
+    tb->text_stats.valid = 0;
+    tb->rows_stale = 1;
+    loop.dirty = 1;
+    free(job);     // 페이지별 줄 수는 세션 캐시에 쓰도록 버퍼가 계속 가짐
+}
+
+/* 줄 색인 스레드: 원본을 큰 단위로 읽으며 페이지별 '\n' 개수를 셈
+ * 세션 캐시로 이미 아는 페이지는 읽지 않음 (덧붙인 로그는 새로 붙은 끝부분만 읽음) */
+void *indexWorker(void *arg) {
+    IndexJob *job = (IndexJob*)arg;
+    char *buf = (char*)malloc(INDEX_READ_SIZE);
+    int per_read = INDEX_READ_SIZE / NODE_MAX_SIZE;
+    for (int page = 0; page < job->pages; page += per_read) {
+        if (__atomic_load_n(&job->cancel, __ATOMIC_RELAXED)) {
+            break;
+        }
+        int known = 1;
+        for (int p = page; p < page + per_read && p < job->pages && known; p++) {
+            known = job->page_lines[p] >= 0;
+        }
+        if (known) {
+            int done = page + per_read < job->pages ? page + per_read : job->pages;
+            __atomic_store_n(&job->done, done, __ATOMIC_RELEASE);
+            continue;
+        }
+        long long off = (long long)page * NODE_MAX_SIZE;
+        int want = job->size - off < INDEX_READ_SIZE ? (int)(job->size - off) : INDEX_READ_SIZE;
+        if (readAt(job->fd, buf, want, off) < 0) {
+            break;  // 밖에서 잘린 파일: 남은 페이지는 불러올 때 셈
+        }
+        if (job->scan.pos != off) {
+            // 세션 캐시로 건너뛴 페이지 뒤: 이어지던 상태는 버림
+            job->scan.pos = off;
+            job->scan.need = 0;
+            job->scan.after_cr = 0;
+        }
+        scanText(&job->scan, buf, want);
+        int done = page;
+        for (int start = 0; start < want; start += NODE_MAX_SIZE) {
+            int len = want - start < NODE_MAX_SIZE ? want - start : NODE_MAX_SIZE;
+            // 통계 패널용 요약도 같은 읽기에서 만듦
+            summarizeBytes(&job->page_stats[done], buf + start, len);
+            job->page_lines[done] = job->page_stats[done].newlines;
+            done++;
+        }
+        __atomic_store_n(&job->done, done, __ATOMIC_RELEASE);
+        int percent = (int)((long long)done * 100 / job->pages);
+        if (percent != job->reported) {
+            job->reported = percent;
+            postEvent(indexProgress, job);
+        }
+    }
+    free(buf);
+    postEvent(finishIndex, job);
+    return NULL;
+}
+
+/* 페이지 단위 열기 함수: 상주 한도보다 큰 파일은 내용을 읽지 않고 64KB 페이지 노드만 만들어 둠
+ * 페이지는 화면에 필요할 때 원본에서 읽어 오고, 줄 수는 백그라운드 스레드가 셈
+ * (원본을 밖에서 제자리 수정하면 아직 불러오지 않은 페이지가 바뀐 내용을 읽게 됨) */
+int openPaged(TextBuffer *tb, const char *filename, long long size) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    tb->source_fd = fd;
+    int pages = (int)((size + NODE_MAX_SIZE - 1) / NODE_MAX_SIZE);
+    if (tb->page_lines == NULL) {
+        tb->page_lines = (int*)malloc(sizeof(int) * pages);
+        memset(tb->page_lines, 0xff, sizeof(int) * pages);  // -1: 아직 모름
+    }
+    tb->page_count = pages;
+    int unknown = 0;
+    for (long long off = 0; off < size; off += NODE_MAX_SIZE) {
+        Node *node = (Node*)calloc(1, sizeof(Node));
+        node->len = size - off < NODE_MAX_SIZE ? (int)(size - off) : NODE_MAX_SIZE;
+        node->lines = tb->page_lines[off / NODE_MAX_SIZE];   // 세션 캐시에서 온 줄 수는 바로 씀
+        node->file_off = off;
+        node->swap_off = -1;
+        unknown += node->lines < 0;
+        linkNode(tb, tb->tail, node);
+    }
+    if (unknown == 0) {
+        return 1;
+    }
+
+    IndexJob *job = (IndexJob*)calloc(1, sizeof(IndexJob));
+    job->tb = tb;
+    job->fd = dup(fd);
+    job->size = size;
+    job->pages = pages;
+    job->page_lines = tb->page_lines;
+    job->page_stats = (NodeStats*)calloc(pages, sizeof(NodeStats));
+    job->reported = -1;
+    tb->index_job = job;
+    pthread_create(&job->thread, NULL, indexWorker, job);
+    return 1;
+}
+#endif
+
+/* 줄 색인 중단 함수 (종료 직전): 스레드가 멈추고 완료 처리가 끝날 때까지 기다림 */
+void stopIndexer(TextBuffer *tb) {
+#ifndef _WIN32
+    if (tb->index_job != NULL) {
+        __atomic_store_n(&tb->index_job->cancel, 1, __ATOMIC_RELAXED);
+    }
+    while (tb->index_job != NULL) {
+        dispatchBackground(tb, pollEvents());
+    }
+#endif
+}
+
+/* gzip 파일이면 읽기용으로 여는 함수 (매직 바이트 1f 8b로 판단, 아니면 NULL) */
+gzFile openGzip(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    unsigned char magic[2];
+    int is_gzip = fread(magic, 1, 2, file) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+    fclose(file);
+    if (!is_gzip) {
+        return NULL;
+    }
+    gzFile gz = gzopen(filename, "rb");
+    if (gz != NULL) {
+        gzbuffer(gz, GZIP_BUFFER_SIZE);
+    }
+    return gz;
+}
+
+/* 푼 조각을 그대로 노드로 만들어 버퍼 끝에 붙이는 함수 (조각 메모리는 노드가 가짐) */
+void appendChunk(TextBuffer *tb, char *data, int len) {
+    Node *node = (Node*)calloc(1, sizeof(Node));
+    node->file_off = -1;
+    node->swap_off = -1;
+    node->data = data;
+    node->cap = NODE_MAX_SIZE;
+    node->len = len;
+    node->lines = countNewlines(data, len);
+    adjustWraps(tb, tb->size, tb->size, len);  // 마지막 줄이 길어졌을 수 있음
+    linkNode(tb, tb->tail, node);
+    trimResident(tb, NULL);
+}
+
+#ifndef _WIN32
+/* 푼 조각 받기 함수 (메인 스레드에서 실행): 버퍼 끝에만 붙이므로 커서, 화면 위치는 그대로 */
+void gunzipDeliver(void *arg) {
+    GzipChunk *chunk = (GzipChunk*)arg;
+    GzipJob *job = chunk->job;
+    if (job->cancel) {
+        free(chunk->data);
+    } else {
+        appendChunk(job->tb, chunk->data, chunk->len);
+        loop.dirty = 1;
+    }
+    pthread_mutex_lock(&job->lock);
+    job->in_flight--;
+    pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+    free(chunk);
+}
+
+/* gzip 풀기 완료 처리 함수 (메인 스레드에서 실행) */
+void finishGunzip(void *arg) {
+    GzipJob *job = (GzipJob*)arg;
+    TextBuffer *tb = job->tb;
+    pthread_join(job->thread, NULL);
+    gzclose(job->gz);
+    noteScan(tb, &job->scan);
+    if (job->failed && !job->cancel) {
+        setMessage("%s: compressed data is truncated or corrupt", tb->filename);
+    }
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->cond);
+    tb->gzip_job = NULL;
+    loop.dirty = 1;
+    free(job);
+}
+
+/* gzip 풀기 스레드: 64KB씩 풀어 메인 루프로 넘김 (붙이지 못한 조각이 쌓이면 기다림) */
+void *gunzipWorker(void *arg) {
+    GzipJob *job = (GzipJob*)arg;
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        while (job->in_flight >= GZIP_IN_FLIGHT && !job->cancel) {
+            pthread_cond_wait(&job->cond, &job->lock);
+        }
+        int stop = job->cancel;
+        if (!stop) {
+            job->in_flight++;
+        }
+        pthread_mutex_unlock(&job->lock);
+        if (stop) {
+            break;
+        }
+        GzipChunk *chunk = (GzipChunk*)malloc(sizeof(GzipChunk));
+        chunk->job = job;
+        chunk->data = (char*)malloc(NODE_MAX_SIZE);
+        int n = gzread(job->gz, chunk->data, NODE_MAX_SIZE);
+        if (n <= 0) {
+            free(chunk->data);
+            free(chunk);
+            pthread_mutex_lock(&job->lock);
+            job->in_flight--;
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        scanText(&job->scan, chunk->data, n);
+        chunk->len = n;
+        postEvent(gunzipDeliver, chunk);
+        if (n < NODE_MAX_SIZE) {
+            break;
+        }
+    }
+    int err = Z_OK;
+    gzerror(job->gz, &err);
+    job->failed = err != Z_OK;
+    postEvent(finishGunzip, job);
+    return NULL;
+}
+#endif
+
+/* gzip 불러오기 함수: 첫 화면 몫(노드 하나)만 먼저 풀어 바로 그리고 나머지는 백그라운드에서 이어 풂 */
+void loadGzip(TextBuffer *tb, gzFile gz) {
+    TextScan scan;
+    memset(&scan, 0, sizeof(scan));
+    tb->gzip = 1;
+    char *chunk = (char*)malloc(NODE_MAX_SIZE);
+    int n = gzread(gz, chunk, NODE_MAX_SIZE);
+    if (n > 0) {
+        scanText(&scan, chunk, n);
+        appendChunk(tb, chunk, n);
+    } else {
+        free(chunk);
+    }
+#ifndef _WIN32
+    if (n == NODE_MAX_SIZE) {
+        GzipJob *job = (GzipJob*)calloc(1, sizeof(GzipJob));
+        job->gz = gz;
+        job->tb = tb;
+        job->scan = scan;
+        pthread_mutex_init(&job->lock, NULL);
+        pthread_cond_init(&job->cond, NULL);
+        tb->gzip_job = job;
+        pthread_create(&job->thread, NULL, gunzipWorker, job);
+        return;
+    }
+#else
+    // 스레드 없이 끝까지 풂
+    while (n == NODE_MAX_SIZE) {
+        chunk = (char*)malloc(NODE_MAX_SIZE);
+        n = gzread(gz, chunk, NODE_MAX_SIZE);
+        if (n <= 0) {
+            free(chunk);
+            break;
+        }
+        scanText(&scan, chunk, n);
+        appendChunk(tb, chunk, n);
+    }
+#endif
+    noteScan(tb, &scan);
+    gzclose(gz);
+}
+
+/* gzip 풀기가 끝날 때까지 기다리는 함수 (저장 전: 덜 풀린 버퍼를 쓰면 내용이 잘림) */
+void waitForGunzip(TextBuffer *tb) {
+#ifndef _WIN32
+    while (tb->gzip_job != NULL) {
+        dispatchBackground(tb, pollEvents());
+    }
+#else
+    (void)tb;
+#endif
+}
+
+/* gzip 풀기 중단 함수 (종료, 파일 전환 직전): 고친 버퍼는 저장해야 하므로 끝까지 풂 */
+void stopGunzip(TextBuffer *tb) {
+#ifndef _WIN32
+    GzipJob *job = tb->gzip_job;
+    if (job != NULL && !tb->modified) {
+        pthread_mutex_lock(&job->lock);
+        job->cancel = 1;
+        pthread_cond_signal(&job->cond);
+        pthread_mutex_unlock(&job->lock);
+    }
+#endif
+    waitForGunzip(tb);
+}
+
+/* 새로 밝혀진 페이지 줄 수를 반영해 커서와 화면 첫 줄의 줄 번호를 다시 세는 함수 */
+void relocateRows(TextBuffer *tb, Cursor *cursor) {
+    Cursor top = *cursor;
+    seekPosition(tb, &top, tb->top_pos);
+    locateCursor(tb, &top);
+    tb->top_row = top.row;
+    locateCursor(tb, cursor);
+    tb->rows_stale = 0;
+}
+
+/* 파일 로드 함수 */
+void loadFile(TextBuffer *tb, Cursor *cursor, const char *filename) {
+    int paged = 0;
+    long long restore = -1;
+    gzFile gz = openGzip(filename);
+#ifndef _WIN32
+    struct stat st;
+    if (stat(filename, &st) == 0 && S_ISREG(st.st_mode)) {
+        // 지난 세션의 위치, 검색어, (큰 파일이면) 줄 색인을 먼저 불러옴
+        // gzip 파일은 풀린 크기를 모르므로 페이지 단위로 열지 않고 위치도 되살리지 않음
+        restore = loadSession(tb, filename, &st, gz == NULL && st.st_size > tb->resident_limit);
+        if (gz != NULL) {
+            restore = -1;
+        } else if (st.st_size > tb->resident_limit) {
+            paged = openPaged(tb, filename, st.st_size);
+        }
+    }
+#endif
+    FILE *file = paged || gz != NULL ? NULL : fopen(filename, "rb");
+    if (paged) {
+        tb->modified = 0;
+    } else if (gz != NULL) {
+        loadGzip(tb, gz);
+        tb->modified = 0;
+    } else if (file) {
+        // 먼저 훑어 줄 끝 형식, BOM, UTF-8 오류를 알아 둠 (상주 한도 안의 파일이라 다시 읽어도 캐시에서 읽음)
+        char *chunk = (char*)malloc(NODE_MAX_SIZE);
+        TextScan scan;
+        memset(&scan, 0, sizeof(scan));
+        size_t n;
+        while ((n = fread(chunk, 1, NODE_MAX_SIZE, file)) > 0) {
+            if (scan.pos == 0) {
+                tb->bom = n >= 3 && memcmp(chunk, "\xef\xbb\xbf", 3) == 0;
+            }
+            scanText(&scan, chunk, (int)n);
+        }
+        noteScan(tb, &scan);
+        tb->crlf = tb->eol == EOL_CRLF;
+        fseek(file, tb->bom ? 3 : 0, SEEK_SET);
+        int held = 0;   // 조각 끝의 '\r' (다음 조각 첫 바이트를 봐야 버릴지 앎)
+        while ((n = fread(chunk + held, 1, NODE_MAX_SIZE - held, file)) > 0) {
+            int len = held + (int)n;
+            held = 0;
+            if (tb->crlf) {
+                if (chunk[len - 1] == '\r') {
+                    held = 1;
+                    len--;
+                }
+                len = (int)stripCarriageReturns(chunk, len);
+            }
+            if (len > 0) {
+                // 방금 읽은 조각이 캐시에 있을 때 통계 요약도 만들어 둠
+                Node *node = createNode(chunk, len);
+                summarizeBytes(&node->stats, chunk, len);
+                linkNode(tb, tb->tail, node);
+            }
+            if (held) {
+                chunk[0] = '\r';
+            }
+            // 상주 한도를 넘으면 먼저 읽은 노드부터 압축
+            trimResident(tb, NULL);
+        }
+        if (held) {
+            linkNode(tb, tb->tail, createNode("\r", 1));
+        }
+        free(chunk);
+        fclose(file);
+        tb->modified = 0;
+    }
+    tb->filename = strdup(filename);
+    rememberBase(tb);
+    cursor->current = tb->head;
+    cursor->offset = 0;
+    cursor->pos = 0;
+    cursor->row = 0;
+    cursor->col = 0;
+    if (restore >= 0) {
+        // 지난번 커서와 화면 위치로 (화면 첫 줄 번호는 그리기 전에 셈)
+        gotoPosition(tb, cursor, restore);
+        tb->rows_stale = 1;
+    }
+}
+
+#ifndef _WIN32
+/* 원본 파일의 확장 속성(ACL, 보안 레이블 포함)을 임시 파일로 옮기는 함수 (옮기지 못하면 -1) */
+int copyXattrs(int from, int to) {
+#ifdef __linux__
+    char names[4096];
+    char value[4096];
+    ssize_t n = flistxattr(from, names, sizeof(names));
+    if (n < 0) {
+        return errno == ENOTSUP ? 0 : -1;
+    }
+    for (char *name = names; name < names + n; name += strlen(name) + 1) {
+        ssize_t len = fgetxattr(from, name, value, sizeof(value));
+        if (len < 0 || fsetxattr(to, name, value, len, 0) < 0) {
+            return -1;
+        }
+    }
+#else
+    (void)from;
+    (void)to;
+#endif
+    return 0;
+}
+
+/* 제자리에서 덮어쓸 파일이 원본(source_fd)과 같은지 확인하고, 그렇다면 원본을 옮길 이름 없는 파일을 만드는 함수
+ * fstat과 빈 파일 하나만 만들므로 빠름 (복사는 copySource가 따로 함)
+ * 옮길 파일의 fd를 반환 (같은 파일이 아니면 -2, 실패하면 -1) */
+int sourceCopyFile(TextBuffer *tb, const char *target, const struct stat *st) {
+    struct stat source;
+    if (tb->source_fd < 0 || fstat(tb->source_fd, &source) != 0
+        || source.st_dev != st->st_dev || source.st_ino != st->st_ino) {
+        return -2;
+    }
+    char name[4096];
+    snprintf(name, sizeof(name), "%s%s.XXXXXX", target, SAVE_TEMP_SUFFIX);
+    int fd = mkstemp(name);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(name);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+/* 원본을 이름 없는 파일로 복사해 같은 fd 번호에 끼우는 함수 (워커 스레드에서도 부름)
+ * 페이지 위치와 색인 스레드는 그대로 두고, 이후 읽기는 덮어쓰기와 상관없는 사본에서 함 */
+int copySource(int source_fd, int copy_fd) {
+    struct stat source;
+    if (fstat(source_fd, &source) != 0) {
+        return -1;
+    }
+    char *chunk = (char*)malloc(NODE_MAX_SIZE);
+    int ok = 1;
+    for (long long off = 0; ok && off < source.st_size; off += NODE_MAX_SIZE) {
+        int len = source.st_size - off < NODE_MAX_SIZE ? (int)(source.st_size - off) : NODE_MAX_SIZE;
+        ok = readAt(source_fd, chunk, len, off) == 0 && writeAllAt(copy_fd, chunk, len, off) == 0;
+    }
+    free(chunk);
+    ok = ok && dup2(copy_fd, source_fd) >= 0;
+    return ok ? 0 : -1;
+}
+
+/* 저장할 파일을 여는 함수
+ * 심볼릭 링크는 따라가 실제 파일(target) 옆에 임시 파일을 새로 만들고(O_EXCL) 소유자, 권한, 확장 속성을 옮김
+ * 하드 링크가 있거나 그것들을 지킬 수 없으면 실제 파일을 제자리에서 다시 씀 (temp는 빈 문자열)
+ * 제자리 쓰기는 자르지 않고 열어 두므로, 원본을 옮겨야 하면 (*copy_fd >= 0) 옮긴 뒤에 잘라서 씀
+ * 쓸 파일의 fd를 반환 (실패하면 -1) */
+int openSaveTarget(TextBuffer *tb, const char *path, char *target, char *temp, int *copy_fd) {
+    struct stat st;
+    temp[0] = '\0';
+    *copy_fd = -1;
+    if (realpath(path, target) == NULL) {
+        struct stat link;
+        if (lstat(path, &link) == 0) {
+            // 가리키는 파일이 없는 링크 등: 예전처럼 경로 그대로 씀
+            snprintf(target, 4096, "%s", path);
+            return open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        }
+        snprintf(target, 4096, "%s", path);     // 새 파일
+    }
+    int exists = stat(target, &st) == 0;
+    if (!exists || st.st_nlink <= 1) {
+        snprintf(temp, 4096, "%s%s.XXXXXX", target, SAVE_TEMP_SUFFIX);
+        int fd = mkstemp(temp);
+        if (fd >= 0) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            int kept = 1;
+            if (exists) {
+                // chown이 setuid 비트를 지우므로 소유자를 먼저 맞춤
+                int original = open(target, O_RDONLY | O_CLOEXEC);
+                kept = original >= 0 && fchown(fd, st.st_uid, st.st_gid) == 0
+                    && fchmod(fd, st.st_mode & 07777) == 0 && copyXattrs(original, fd) == 0;
+                if (original >= 0) close(original);
+            } else {
+                // mkstemp는 0600으로 만드므로 새 파일은 fopen처럼 umask를 따름
+                mode_t mask = umask(0);
+                umask(mask);
+                fchmod(fd, 0666 & ~mask);
+            }
+            if (kept) {
+                return fd;
+            }
+            close(fd);
+            unlink(temp);
+        }
+        temp[0] = '\0';
+        if (!exists) {
+            return -1;
+        }
+    }
+    // 제자리 쓰기: 잘라내기 전에 아직 원본에서 읽을 페이지를 옮겨 둘 자리를 만듦
+    int copy = sourceCopyFile(tb, target, &st);
+    if (copy == -1) {
+        return -1;
+    }
+    int fd = open(target, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (copy >= 0) close(copy);
+        return -1;
+    }
+    *copy_fd = copy;
+    return fd;
+}
+
+/* 저장을 마무리하는 함수: 임시 파일이면 실제 파일 자리로 rename, 실패하면 임시 파일을 지움 */
+int commitSaveTarget(const char *target, const char *temp, int ok) {
+    if (temp[0] == '\0') {
+        return ok ? 0 : -1;
+    }
+    if (ok && rename(temp, target) == 0) {
+        return 0;
+    }
+    unlink(temp);
+    return -1;
+}
+#endif
+
+/* 버퍼 내용을 지정한 경로로 쓰는 함수
+ * 페이지를 순서대로 흘려 쓰되, 아직 원본에서 읽어 올 페이지가 있으므로 보통은 임시 파일에 쓰고 rename */
+int writeBuffer(TextBuffer *tb, const char *path) {
+    waitForGunzip(tb);
+    // gzip 파일은 다시 압축해서 씀
+    FILE *file = NULL;
+    gzFile gz = NULL;
+#ifndef _WIN32
+    char target[4096];
+    char temp[4096];
+    int copy_fd;
+    int fd = openSaveTarget(tb, path, target, temp, &copy_fd);
+    if (fd < 0) {
+        return -1;
+    }
+    if (copy_fd >= 0) {
+        // 동기 저장이므로 여기서 원본을 옮김
+        int copied = copySource(tb->source_fd, copy_fd);
+        close(copy_fd);
+        if (copied < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (temp[0] == '\0' && ftruncate(fd, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (tb->gzip) {
+        gz = gzdopen(fd, "wb");
+    } else {
+        file = fdopen(fd, "wb");
+    }
+    if (file == NULL && gz == NULL) {
+        close(fd);
+        commitSaveTarget(target, temp, 0);
+        return -1;
+    }
+#else
+    char temp[4096];
+    snprintf(temp, sizeof(temp), "%s%s", path, SAVE_TEMP_SUFFIX);
+    if (tb->gzip) {
+        gz = gzopen(temp, "wb");
+    } else {
+        file = fopen(temp, "wb");
+    }
+    if (file == NULL && gz == NULL) {
+        return -1;
+    }
+#endif
+    // 불러올 때 뗀 BOM과 '\r'을 되돌려 씀
+    char *expanded = tb->crlf ? (char*)malloc(2 * NODE_MAX_SIZE) : NULL;
+    int ok = !tb->bom || (gz != NULL ? gzwrite(gz, "\xef\xbb\xbf", 3) == 3 : fwrite("\xef\xbb\xbf", 1, 3, file) == 3);
+    for (Node *node = tb->head; node != NULL && ok; node = node->next) {
+        const char *data = nodeData(tb, node);
+        int len = node->len;
+        if (expanded != NULL) {
+            len = expandNewlines(data, len, expanded);
+            data = expanded;
+        }
+        ok = gz != NULL ? gzwrite(gz, data, len) == len : fwrite(data, 1, len, file) == (size_t)len;
+        trimResident(tb, NULL);
+    }
+    free(expanded);
+    ok = (gz != NULL ? gzclose(gz) == Z_OK : fclose(file) == 0) && ok;
+#ifndef _WIN32
+    return commitSaveTarget(target, temp, ok);
+#else
+    if (ok) {
+        remove(path);   // Windows의 rename은 대상을 덮어쓰지 않음
+    }
+    if (!ok || rename(temp, path) != 0) {
+        remove(temp);
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+/* 파일 저장 함수 */
+void saveFile(TextBuffer *tb) {
+    if (tb->filename) {
+        if (writeBuffer(tb, tb->filename) == 0) {
+            tb->modified = 0; // 저장 후 수정되지 않음으로 표시
+            rememberFileState(tb->filename);
+            tb->page_count = 0;     // 페이지별 줄 수는 예전 내용의 것
+            rememberBase(tb);
+            clearAutosave(tb);
+        }
+    }
+}
+
+/* 접은 구간의 마지막 줄바꿈에 선 커서를 머리줄 끝의 줄바꿈으로 옮기는 함수 */
+void skipFoldBackward(TextBuffer *tb, Cursor *cursor) {
+    Fold *f = tb->fold_count > 0 ? foldAt(tb, cursor->pos) : NULL;
+    if (f != NULL) {
+        seekPosition(tb, cursor, f->start - 1);
+        cursor->row -= f->lines;
+    }
+}
+
+/* 왼쪽 커서 이동 */
+void moveCursorLeft(TextBuffer *tb, Cursor *cursor) {
+    int ch = stepBackward(tb, cursor);
+    if (ch == '\n') {
+        // 이전 줄의 끝으로 이동 (접은 구간이면 머리줄 끝으로)
+        skipFoldBackward(tb, cursor);
+        cursor->row--;
+        cursor->col = computeColumn(tb, cursor);
+    } else if (ch >= 0) {
+        cursor->col--;
+    }
+}
+
+/* 오른쪽 커서 이동 */
+void moveCursorRight(TextBuffer *tb, Cursor *cursor) {
+    int ch = stepForward(tb, cursor);
+    if (ch == '\n') {
+        cursor->row++;
+        cursor->col = 0;
+        Fold *f = tb->fold_count > 0 ? foldStartingAt(tb, cursor->pos) : NULL;
+        if (f != NULL) {
+            seekPosition(tb, cursor, f->end);
+            cursor->row += f->lines;
+        }
+    } else if (ch >= 0) {
+        cursor->col++;
+    }
+}
+
+/* 위쪽 커서 이동 (논리 줄 단위, 줄을 꺾지 않는 표 보기용) */
+void moveLineUp(TextBuffer *tb, Cursor *cursor) {
+    if (cursor->row > 0) {
+        int selected_col = cursor->col;
+        // 현재 줄의 시작으로 이동
+        moveToLineStart(tb, cursor);
+        // 이전 줄의 끝의 '\n' 앞으로 이동
+        stepBackward(tb, cursor);
+        skipFoldBackward(tb, cursor);
+        cursor->row--;
+        cursor->col = computeColumn(tb, cursor);
+        // 원하는 열로 이동
+        while (cursor->col > selected_col) {
+            stepBackward(tb, cursor);
+            cursor->col--;
+        }
+    }
+}
+
+/* 아래쪽 커서 이동 (논리 줄 단위, 줄을 꺾지 않는 표 보기용) */
+void moveLineDown(TextBuffer *tb, Cursor *cursor) {
+    Cursor temp = *cursor;
+    int selected_col = cursor->col;
+    // 다음 줄의 시작으로 이동
+    if (!nextVisibleLine(tb, &temp)) {
+        return;
+    }
+    // 원하는 열로 이동
+    int ch;
+    while (temp.col < selected_col && (ch = charAt(tb, &temp)) >= 0 && ch != '\n') {
+        stepForward(tb, &temp);
+        temp.col++;
+    }
+    *cursor = temp;
+}
+
+/* 위쪽 커서 이동 (화면 줄 단위: 꺾인 줄 안에서는 COLS만큼, 줄 첫 화면 줄이면 이전 줄의 마지막 화면 줄로) */
+void moveCursorUp(TextBuffer *tb, Cursor *cursor) {
+    int width = COLS;
+    if (cursor->col >= width) {
+        seekPosition(tb, cursor, cursor->pos - width);
+        cursor->col -= width;
+        return;
+    }
+    if (cursor->row > 0) {
+        int x = cursor->col;
+        // 이전 줄 끝의 '\n'으로 (접은 구간이면 머리줄 끝으로)
+        seekPosition(tb, cursor, cursor->pos - cursor->col - 1);
+        skipFoldBackward(tb, cursor);
+        cursor->row--;
+        long long len = lineLengthBefore(tb, cursor);
+        long long col = len / width * width + x;
+        if (col > len) {
+            col = len;
+        }
+        seekPosition(tb, cursor, cursor->pos - (len - col));
+        cursor->col = (int)col;
+    }
+}
+
+/* 아래쪽 커서 이동 (화면 줄 단위: 꺾인 줄의 다음 화면 줄, 마지막 화면 줄이면 다음 줄의 첫 화면 줄로) */
+void moveCursorDown(TextBuffer *tb, Cursor *cursor) {
+    int width = COLS;
+    Cursor temp = *cursor;
+    seekPosition(tb, &temp, cursor->pos - cursor->col);
+    long long len = lineLength(tb, &temp);
+    if (cursor->col / width < len / width) {
+        // 아래 화면 줄이 짧으면 줄 끝으로
+        long long col = cursor->col + width < len ? cursor->col + width : len;
+        seekPosition(tb, cursor, temp.pos + col);
+        cursor->col = (int)col;
+        return;
+    }
+    int x = cursor->col % width;
+    seekPosition(tb, &temp, temp.pos + len);
+    if (!nextVisibleLine(tb, &temp)) {
+        return;
+    }
+    len = lineLength(tb, &temp);
+    long long col = x < len ? x : len;
+    seekPosition(tb, &temp, temp.pos + col);
+    temp.col = (int)col;
+    *cursor = temp;
+}
+
+/* 검색어를 받은 뒤 결과 사이를 오가는 단계로 넘어가는 함수 */
+void startSearch(TextBuffer *tb, Cursor *cursor, const char *query) {
+    if (query == NULL || query[0] == '\0') {
+        // 검색어가 비어있으면 검색 취소
+        return;
+    }
+    rememberSearch(tb, query);
+
+    // 검색 결과 찾기
+    SearchContext *sc = (SearchContext*)calloc(1, sizeof(SearchContext));
+    snprintf(sc->query, sizeof(sc->query), "%s", query);
+    findMatches(tb, sc);
+
+    if (sc->result_count == 0) {
+        // 검색 결과가 없을 경우 메시지 표시
+        free(sc->results);
+        free(sc);
+        setMessage("No matches found.");
+        return;
+    }
+    sc->original_pos = cursor->pos; // 검색 이전의 커서 위치 저장
+    sc->original_top_pos = tb->top_pos;
+    sc->original_top_row = tb->top_row;
+
+    // 커서 다음의 첫 결과부터 보여줌 (없으면 처음으로 돌아감)
+    sc->current_index = firstMatchAfter(sc, cursor->pos);
+    if (sc->current_index == sc->result_count) {
+        sc->current_index = 0;
+    }
+    // 결과 사이를 오가는 동안에도 키는 프롬프트로 감 (화면은 refreshScreen이 하이라이트와 함께 그림)
+    loop.prompt.active = 1;
+    loop.prompt.search = sc;
+    gotoPosition(tb, cursor, sc->results[sc->current_index]);
+}
+
+/* 검색 결과 사이를 오가는 키 처리 함수 */
+void searchKey(TextBuffer *tb, Cursor *cursor, int ch) {
+    SearchContext *sc = loop.prompt.search;
+    if (ch == KEY_LEFT) {
+        // 이전 검색 결과로 이동
+        sc->current_index = (sc->current_index - 1 + sc->result_count) % sc->result_count;
+        gotoPosition(tb, cursor, sc->results[sc->current_index]);
+    } else if (ch == KEY_RIGHT) {
+        // 다음 검색 결과로 이동
+        sc->current_index = (sc->current_index + 1) % sc->result_count;
+        gotoPosition(tb, cursor, sc->results[sc->current_index]);
+    } else if (ch == '\n' || ch == '\r') {
+        // Enter 키 눌렀을 때 검색 종료 및 편집 시작 (커서는 이미 결과 위에 있음)
+        closePrompt();
+    } else if (ch == 27) {
+        // ESC 키 눌렀을 때 검색 취소 및 커서 복원
+        gotoPosition(tb, cursor, sc->original_pos);
+        tb->top_pos = sc->original_top_pos;
+        tb->top_row = sc->original_top_row;
+        closePrompt();
+    }
+}
+
+/* 검색 기능 흐름 처리: 사용자로부터 검색어 입력 받기 (위/아래로 이전 검색어) */
+void searchFunction(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    openPrompt("Search: ", sizeof(tb->history[0]), tb->history, tb->history_count, startSearch);
+}
+
+/* 노드 경계를 넘어 검색어가 일치하는지 확인하는 함수 */
+int matchAt(TextBuffer *tb, Node *node, int off, const char *query, int query_len) {
+    int i = 0;
+    while (node != NULL && i < query_len) {
+        char *data = nodeData(tb, node);
+        while (off < node->len && i < query_len) {
+            if (data[off++] != query[i++]) {
+                return 0;
+            }
+        }
+        node = node->next;
+        off = 0;
+    }
+    return i == query_len;
+}
+
+/* 범위 [start, end) 안의 검색 위치 저장 함수 (검색어가 범위 안에 다 들어가는 것만) */
+void findMatchesIn(TextBuffer *tb, SearchContext *sc, long long start, long long end) {
+    int query_len = strlen(sc->query);
+    int capacity = 0;
+    sc->result_count = 0;
+    sc->results = NULL;
+
+    Cursor t = {NULL, 0, 0};
+    seekPosition(tb, &t, start);
+    if (!normalizeForward(&t)) {
+        return;
+    }
+    long long base = t.pos - t.offset;
+    // 노드 단위로 훑으며 첫 글자를 memchr로 찾은 뒤 나머지를 비교
+    for (Node *node = t.current; node != NULL && base < end; base += node->len, node = node->next) {
+        char *data = nodeData(tb, node);
+        char *p = node == t.current ? data + t.offset : data;
+        char *stop = data + node->len;
+        if (end - base < node->len) {
+            stop = data + (end - base);
+        }
+        while (p < stop && (p = memchr(p, sc->query[0], stop - p)) != NULL) {
+            int off = (int)(p - data);
+            if (base + off + query_len > end) {
+                break;
+            }
+            if (matchAt(tb, node, off, sc->query, query_len)) {
+                if (sc->result_count == capacity) {
+                    capacity = capacity ? capacity * 2 : 64;
+                    sc->results = (long long*)realloc(sc->results, sizeof(long long) * capacity);
+                }
+                sc->results[sc->result_count++] = base + off;
+            }
+            p++;
+        }
+        // 큰 버퍼를 훑는 동안에도 상주 한도를 지킴
+        trimResident(tb, node);
+    }
+}
+
+/* 검색 위치 저장 함수 */
+void findMatches(TextBuffer *tb, SearchContext *sc) {
+    findMatchesIn(tb, sc, 0, tb->size);
+}
+
+/* 커서 다음에 오는 첫 검색 결과의 번호를 찾는 함수 (맨 앞에서는 그 위치도 포함) */
+int firstMatchAfter(SearchContext *sc, long long pos) {
+    int lo = 0, hi = sc->result_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (sc->results[mid] > pos || (pos == 0 && sc->results[mid] == 0)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/* 검색 결과 하이라이트 함수 (커서가 놓인 결과 위에 검색어를 반전해 덧그림) */
+void highlightMatch(WINDOW *win, Cursor *cursor, SearchContext *sc) {
+    int query_len = strlen(sc->query);
+
+    // 현재 속성 저장
+    attr_t attrs;
+    short pair;
+    wattr_get(win, &attrs, &pair, NULL);
+
+    // 하이라이트 속성 적용
+    wattron(win, A_REVERSE);
+
+    int row = cursor->y, col = cursor->x;
+    for (int i = 0; i < query_len && row < TEXT_ROWS; i++) {
+        mvwaddch(win, row, col, sc->query[i]);
+        col++;
+        if (col >= COLS) {
+            row++;
+            col = 0;
+        }
+    }
+
+    // 이전 속성 복원
+    wattroff(win, A_REVERSE);
+    wattr_set(win, attrs, pair, NULL);
+}
+
+/* 검색어 기록 함수: 맨 앞에 넣고 같은 검색어는 뒤에서 지움 */
+void rememberSearch(TextBuffer *tb, const char *query) {
+    int i = 0;
+    while (i < tb->history_count && strcmp(tb->history[i], query) != 0) {
+        i++;
+    }
+    if (i == tb->history_count && i < SEARCH_HISTORY) {
+        tb->history_count++;
+    }
+    if (i == SEARCH_HISTORY) {
+        i--;    // 가장 오래된 것을 밀어냄
+    }
+    memmove(tb->history[1], tb->history[0], sizeof(tb->history[0]) * i);
+    snprintf(tb->history[0], sizeof(tb->history[0]), "%s", query);
+}
+
+/* 프롬프트를 여는 함수: 키는 handleKey가 promptKey로 넘기고, 끝나면 done을 부름
+ * history가 있으면 위/아래 키로 이전 입력을 불러옴 */
+void openPrompt(const char *label, int size, char (*history)[256], int history_count, PromptCallback done) {
+    Prompt *p = &loop.prompt;
+    p->active = 1;
+    snprintf(p->label, sizeof(p->label), "%s", label);
+    p->text[0] = '\0';
+    p->len = 0;
+    p->size = size < (int)sizeof(p->text) ? size : (int)sizeof(p->text);
+    p->pick = -1;
+    p->history = history;
+    p->history_count = history_count;
+    p->done = done;
+    loop.dirty = 1;
+}
+
+/* 프롬프트 닫기 함수 (검색 결과도 버림) */
+void closePrompt(void) {
+    if (loop.prompt.search != NULL) {
+        free(loop.prompt.search->results);
+        free(loop.prompt.search);
+        loop.prompt.search = NULL;
+    }
+    loop.prompt.active = 0;
+    loop.dirty = 1;
+}
+
+/* 프롬프트 키 처리 함수: 입력을 마치면 닫은 뒤 done을 부름 (done이 다음 프롬프트를 열 수 있음) */
+void promptKey(TextBuffer *tb, Cursor *cursor, int ch) {
+    Prompt *p = &loop.prompt;
+    if (p->search != NULL) {
+        searchKey(tb, cursor, ch);
+        return;
+    }
+    if (ch == '\n' || ch == '\r' || ch == KEY_ENTER || ch == 27) {
+        // ESC: 입력 취소
+        char answer[sizeof(p->text)];
+        memcpy(answer, p->text, sizeof(answer));
+        closePrompt();
+        p->done(tb, cursor, ch == 27 ? NULL : answer);
+    } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+        if (p->len > 0) {
+            p->text[--p->len] = '\0';
+        }
+    } else if ((ch == KEY_UP || ch == KEY_DOWN) && p->history_count > 0) {
+        if (ch == KEY_UP && p->pick + 1 < p->history_count) {
+            p->pick++;
+        } else if (ch == KEY_DOWN && p->pick >= 0) {
+            p->pick--;
+        }
+        snprintf(p->text, p->size, "%s", p->pick >= 0 ? p->history[p->pick] : "");
+        p->len = (int)strlen(p->text);
+    } else if (isTextKey(ch) && p->len < p->size - 1) {
+        p->text[p->len++] = (char)ch;
+        p->text[p->len] = '\0';
+    }
+}
+
+/* 사용할 스레드 수 */
+int cpuCount(void) {
+#ifndef _WIN32
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > MAX_THREADS) n = MAX_THREADS;
+    return (int)n;
+#else
+    return 1;
+#endif
+}
+
+/* 작업 배열을 스레드로 나눠 실행하는 함수 (하나면 현재 스레드에서 실행) */
+void runParallel(void *(*fn)(void*), void *jobs, size_t job_size, int count) {
+    pthread_t threads[MAX_THREADS];
+    if (count == 1) {
+        fn(jobs);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        pthread_create(&threads[i], NULL, fn, (char*)jobs + i * job_size);
+    }
+    for (int i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/* 범위 [start, end)를 연속된 메모리로 읽는 함수 (실패하면 NULL) */
+char* readRange(TextBuffer *tb, long long start, long long end) {
+    char *buf = (char*)malloc(end - start + 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+    Cursor t = {NULL, 0, 0};
+    seekPosition(tb, &t, start);
+    long long done = 0;
+    while (done < end - start && normalizeForward(&t)) {
+        long long k = t.current->len - t.offset;
+        if (k > end - start - done) k = end - start - done;
+        memcpy(buf + done, nodeData(tb, t.current) + t.offset, k);
+        done += k;
+        t.offset += (int)k;
+        // 큰 범위를 읽는 동안에도 상주 한도를 지킴
+        trimResident(tb, t.current);
+    }
+    return buf;
+}
+
+/* 줄 앞부분의 숫자를 읽는 함수 (sort -n처럼 숫자가 없으면 0) */
+double lineNumber(const char *p, long long len) {
+    const char *end = p + len;
+    double value = 0, scale = 1;
+    int negative = 0;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p++ - '0');
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            scale /= 10;
+            value += (*p - '0') * scale;
+        }
+    }
+    return negative ? -value : value;
+}
+
+/* 두 줄 비교 함수 (숫자 정렬이면 숫자를 먼저, 같으면 바이트 순) */
+int compareLines(const LineOp *op, const LineSpan *a, const LineSpan *b) {
+    if (op->numeric && a->key != b->key) {
+        return a->key < b->key ? -1 : 1;
+    }
+    long long n = a->len < b->len ? a->len : b->len;
+    int c = memcmp(op->text + a->off, op->text + b->off, n);
+    if (c != 0) {
+        return c;
+    }
+    return a->len < b->len ? -1 : (a->len > b->len);
+}
+
+/* 정렬된 두 구간 [lo, mid), [mid, hi)를 tmp를 거쳐 합치는 함수 (안정) */
+void mergeSpans(const LineOp *op, LineSpan *spans, LineSpan *tmp, long long lo, long long mid, long long hi) {
+    long long i = lo, j = mid, k = lo;
+    while (i < mid && j < hi) {
+        tmp[k++] = compareLines(op, &spans[j], &spans[i]) < 0 ? spans[j++] : spans[i++];
+    }
+    while (i < mid) tmp[k++] = spans[i++];
+    while (j < hi) tmp[k++] = spans[j++];
+    memcpy(spans + lo, tmp + lo, sizeof(LineSpan) * (hi - lo));
+}
+
+/* 구간 [lo, hi)의 병합 정렬 함수 */
+void sortSpans(const LineOp *op, LineSpan *spans, LineSpan *tmp, long long lo, long long hi) {
+    if (hi - lo <= SORT_CUTOFF) {
+        for (long long i = lo + 1; i < hi; i++) {
+            LineSpan v = spans[i];
+            long long j = i;
+            while (j > lo && compareLines(op, &v, &spans[j - 1]) < 0) {
+                spans[j] = spans[j - 1];
+                j--;
+            }
+            spans[j] = v;
+        }
+        return;
+    }
+    long long mid = lo + (hi - lo) / 2;
+    sortSpans(op, spans, tmp, lo, mid);
+    sortSpans(op, spans, tmp, mid, hi);
+    if (compareLines(op, &spans[mid], &spans[mid - 1]) < 0) {
+        mergeSpans(op, spans, tmp, lo, mid, hi);
+    }
+}
+
+void *sortWorker(void *arg) {
+    LineJob *job = (LineJob*)arg;
+    sortSpans(job->op, job->op->spans, job->op->tmp, job->lo, job->hi);
+    return NULL;
+}
+
+void *mergeWorker(void *arg) {
+    LineJob *job = (LineJob*)arg;
+    mergeSpans(job->op, job->op->spans, job->op->tmp, job->lo, job->mid, job->hi);
+    return NULL;
+}
+
+/* 패턴 포함 여부로 줄을 표시하는 스레드 작업 */
+void *filterWorker(void *arg) {
+    LineJob *job = (LineJob*)arg;
+    LineOp *op = job->op;
+    int plen = (int)strlen(op->pattern);
+    for (long long i = job->lo; i < job->hi; i++) {
+        const char *p = op->text + op->spans[i].off;
+        const char *end = p + op->spans[i].len;
+        int found = plen == 0;
+        while (!found && end - p >= plen && (p = memchr(p, op->pattern[0], end - p - plen + 1)) != NULL) {
+            found = memcmp(p, op->pattern, plen) == 0;
+            p++;
+        }
+        op->keep[i] = found == op->keep_matching;
+    }
+    return NULL;
+}
+
+/* 병렬 병합 정렬: 코어 수만큼 나눠 각자 정렬한 뒤 짝지어 합치기를 반복 */
+void parallelSort(LineOp *op) {
+    long long n = op->count;
+    int parts = cpuCount();
+    while (parts > 1 && n / parts < 4096) parts /= 2;   // 작은 입력은 스레드 비용이 더 큼
+    LineJob jobs[MAX_THREADS];
+    long long bounds[MAX_THREADS + 1];
+    for (int i = 0; i <= parts; i++) {
+        bounds[i] = n * i / parts;
+    }
+    for (int i = 0; i < parts; i++) {
+        jobs[i].op = op;
+        jobs[i].lo = bounds[i];
+        jobs[i].hi = bounds[i + 1];
+    }
+    runParallel(sortWorker, jobs, sizeof(LineJob), parts);
+
+    for (int width = 1; width < parts; width *= 2) {
+        int count = 0;
+        for (int i = 0; i + width < parts; i += 2 * width) {
+            jobs[count].op = op;
+            jobs[count].lo = bounds[i];
+            jobs[count].mid = bounds[i + width];
+            jobs[count].hi = bounds[i + 2 * width < parts ? i + 2 * width : parts];
+            count++;
+        }
+        runParallel(mergeWorker, jobs, sizeof(LineJob), count);
+    }
+}
+
+/* 패턴을 포함하는(또는 포함하지 않는) 줄만 남기는 함수 */
+long long filterLines(LineOp *op) {
+    int parts = cpuCount();
+    while (parts > 1 && op->count / parts < 4096) parts /= 2;
+    LineJob jobs[MAX_THREADS];
+    op->keep = (unsigned char*)malloc(op->count);
+    for (int i = 0; i < parts; i++) {
+        jobs[i].op = op;
+        jobs[i].lo = op->count * i / parts;
+        jobs[i].hi = op->count * (i + 1) / parts;
+    }
+    runParallel(filterWorker, jobs, sizeof(LineJob), parts);
+    long long kept = 0;
+    for (long long i = 0; i < op->count; i++) {
+        if (op->keep[i]) {
+            op->spans[kept++] = op->spans[i];
+        }
+    }
+    free(op->keep);
+    op->keep = NULL;
+    return kept;
+}
+
+/* 줄 해시 (FNV-1a) */
+unsigned long long hashLine(const char *p, long long len) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (long long i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+/* 중복 줄 제거 함수 (처음 나온 줄을 남기고 순서는 유지) */
+long long uniqueLines(LineOp *op) {
+    long long size = 16;
+    while (size < op->count * 2) size *= 2;
+    long long *table = (long long*)malloc(sizeof(long long) * size);   // 남긴 줄 번호 + 1 (0은 빈 칸)
+    memset(table, 0, sizeof(long long) * size);
+    long long kept = 0;
+    for (long long i = 0; i < op->count; i++) {
+        LineSpan *span = &op->spans[i];
+        long long slot = (long long)(hashLine(op->text + span->off, span->len) & (size - 1));
+        int duplicate = 0;
+        while (table[slot] != 0) {
+            LineSpan *other = &op->spans[table[slot] - 1];
+            if (other->len == span->len && memcmp(op->text + other->off, op->text + span->off, span->len) == 0) {
+                duplicate = 1;
+                break;
+            }
+            slot = (slot + 1) & (size - 1);
+        }
+        if (!duplicate) {
+            op->spans[kept] = *span;
+            table[slot] = ++kept;
+        }
+    }
+    free(table);
+    return kept;
+}
+
+/* 줄 단위 명령의 대상 범위 계산 함수: 영역이 있으면 그 줄들, 없으면 버퍼 전체 */
+void lineRange(TextBuffer *tb, Cursor *cursor, long long *start, long long *end) {
+    if (tb->mark < 0) {
+        *start = 0;
+        *end = tb->size;
+        return;
+    }
+    long long a = tb->mark < cursor->pos ? tb->mark : cursor->pos;
+    long long b = tb->mark < cursor->pos ? cursor->pos : tb->mark;
+    Cursor t = *cursor;
+    seekPosition(tb, &t, a);
+    moveToLineStart(tb, &t);
+    *start = t.pos;
+    seekPosition(tb, &t, b);
+    if (b > *start && computeColumn(tb, &t) == 0) {
+        *end = b;   // 영역이 줄 시작에서 끝나면 그 줄은 포함하지 않음
+    } else {
+        moveToNextLine(tb, &t);
+        *end = t.pos;
+    }
+}
+
+/* 줄 단위 명령 실행 함수: 범위를 읽어 줄로 나누고, 처리한 결과로 새 노드 사슬을 만들어 한 번에 교체 */
+void runLineCommand(TextBuffer *tb, Cursor *cursor, int kind, int numeric, const char *pattern) {
+    long long start, end;
+    long long started = monotonicMs();
+    lineRange(tb, cursor, &start, &end);
+    if (start >= end) {
+        setMessage("Nothing to do");
+        return;
+    }
+    // 범위와 줄 표를 한꺼번에 메모리에 올리므로 메모리 예산을 넘는 범위는 할당을 시도하지 않고 거절
+    // (줄 표는 정렬 임시 표, 중복 검사 해시 표까지 줄마다 LineSpan 두 개로 어림)
+    long long budget = tb->resident_limit + tb->packed_limit;
+    long long need = end - start;
+    if (need <= budget) {
+        need += (countLinesBetween(tb, start, end) + 1) * 2 * (long long)sizeof(LineSpan);
+    }
+    if (need > budget) {
+        char need_text[32], budget_text[32];
+        formatSize(need_text, sizeof(need_text), need);
+        formatSize(budget_text, sizeof(budget_text), budget);
+        setMessage("Range too large: needs %s, memory budget is %s (VIVA_MEM_BUDGET_MB)", need_text, budget_text);
+        return;
+    }
+
+    LineOp op;
+    memset(&op, 0, sizeof(op));
+    op.numeric = numeric;
+    op.pattern = pattern;
+    op.keep_matching = kind == LINE_KEEP;
+    op.text = readRange(tb, start, end);
+    long long len = end - start;
+    long long capacity = 0;
+    if (op.text != NULL) {
+        // 줄 수만큼 한 번에 할당 (마지막 줄에 '\n'이 없을 수 있으므로 +1)
+        for (long long off = 0; off < len; off += NODE_MAX_SIZE) {
+            capacity += countNewlines(op.text + off, len - off < NODE_MAX_SIZE ? (int)(len - off) : NODE_MAX_SIZE);
+        }
+        op.spans = (LineSpan*)malloc(sizeof(LineSpan) * (capacity + 1));
+    }
+    if (op.text == NULL || op.spans == NULL) {
+        free(op.text);
+        setMessage("Not enough memory for %lld bytes", len);
+        return;
+    }
+    int trailing = op.text[len - 1] == '\n';
+    for (long long off = 0; off < len; ) {
+        const char *nl = memchr(op.text + off, '\n', len - off);
+        long long line_end = nl ? nl - op.text : len;
+        LineSpan *span = &op.spans[op.count++];
+        span->off = off;
+        span->len = line_end - off;
+        span->key = numeric ? lineNumber(op.text + off, span->len) : 0;
+        off = line_end + 1;
+    }
+
+    long long before = op.count;
+    if (kind == LINE_SORT) {
+        op.tmp = (LineSpan*)malloc(sizeof(LineSpan) * op.count);
+        parallelSort(&op);
+        free(op.tmp);
+    } else if (kind == LINE_UNIQUE) {
+        op.count = uniqueLines(&op);
+    } else if (kind == LINE_REVERSE) {
+        for (long long i = 0, j = op.count - 1; i < j; i++, j--) {
+            LineSpan t = op.spans[i];
+            op.spans[i] = op.spans[j];
+            op.spans[j] = t;
+        }
+    } else {
+        op.count = filterLines(&op);
+    }
+
+    // 결과를 새 사슬로 쓰고 범위를 통째로 교체 (되돌리기 기록은 떼어 낸 원래 노드를 보관)
+    Chain result = {NULL, NULL, 0}, old;
+    for (long long i = 0; i < op.count; i++) {
+        chainAppend(tb, &result, op.text + op.spans[i].off, op.spans[i].len);
+        if (trailing || i + 1 < op.count) {
+            chainAppend(tb, &result, "\n", 1);
+        }
+    }
+    free(op.spans);
+    free(op.text);
+
+    long long cursor_before = cursor->pos;
+    long long result_len = result.len;
+    spliceRange(tb, cursor, start, end, &result, &old);
+    pushUndo(tb, start, result_len, &old, cursor_before);
+    closeUndo(tb);
+    gotoPosition(tb, cursor, start);
+    tb->mark = -1;  // 영역은 명령 하나에 한 번만 씀
+    trimResident(tb, cursor->current);
+
+    long long ms = monotonicMs() - started;
+    if (kind == LINE_SORT) {
+        setMessage("Sorted %lld lines (%lld ms)", before, ms);
+    } else if (kind == LINE_REVERSE) {
+        setMessage("Reversed %lld lines (%lld ms)", before, ms);
+    } else if (kind == LINE_UNIQUE) {
+        setMessage("Removed %lld duplicate lines, %lld left (%lld ms)", before - op.count, op.count, ms);
+    } else {
+        setMessage("Removed %lld of %lld lines (%lld ms)", before - op.count, before, ms);
+    }
+}
+
+/* 커서 위치부터 n바이트를 사슬 끝에 복사하는 함수 (커서는 그만큼 앞으로) */
+void chainCopyFrom(TextBuffer *tb, Chain *chain, Cursor *from, long long n) {
+    while (n > 0 && normalizeForward(from)) {
+        long long k = from->current->len - from->offset;
+        if (k > n) k = n;
+        chainAppend(tb, chain, nodeData(tb, from->current) + from->offset, k);
+        from->offset += (int)k;
+        from->pos += k;
+        n -= k;
+        trimResident(tb, from->current);
+    }
+}
+
+/* 모두 바꾸기 함수: 영역(없으면 버퍼 전체)의 검색어를 모두 찾은 뒤
+ * 첫 일치부터 마지막 일치까지를 새 사슬로 한 번에 다시 써서 교체 (되돌리기 기록 하나) */
+void replaceAll(TextBuffer *tb, Cursor *cursor, const char *query, const char *with) {
+    long long started = monotonicMs();
+    long long start = 0, end = tb->size;
+    if (tb->mark >= 0) {
+        start = tb->mark < cursor->pos ? tb->mark : cursor->pos;
+        end = tb->mark < cursor->pos ? cursor->pos : tb->mark;
+    }
+
+    SearchContext sc;
+    snprintf(sc.query, sizeof(sc.query), "%s", query);
+    findMatchesIn(tb, &sc, start, end);
+    if (sc.result_count == 0) {
+        free(sc.results);
+        setMessage("No matches found.");
+        return;
+    }
+
+    long long query_len = strlen(query);
+    long long with_len = strlen(with);
+    long long first = sc.results[0];
+    long long last = first;
+    long long count = 0;
+    Chain result = {NULL, NULL, 0}, old;
+    Cursor from = {NULL, 0, 0};
+    seekPosition(tb, &from, first);
+    for (int i = 0; i < sc.result_count; i++) {
+        long long at = sc.results[i];
+        if (at < from.pos) {
+            continue;   // 앞의 일치와 겹치는 위치 ("aa"에서 "aaa")
+        }
+        chainCopyFrom(tb, &result, &from, at - from.pos);
+        chainAppend(tb, &result, with, with_len);
+        seekPosition(tb, &from, at + query_len);
+        last = at + query_len;
+        count++;
+    }
+    free(sc.results);
+
+    long long cursor_before = cursor->pos;
+    long long target = cursor_before;
+    if (target >= last) {
+        target += result.len - (last - first);
+    } else if (target > first) {
+        target = first;
+    }
+    long long result_len = result.len;
+    spliceRange(tb, cursor, first, last, &result, &old);
+    pushUndo(tb, first, result_len, &old, cursor_before);
+    closeUndo(tb);
+    gotoPosition(tb, cursor, target);
+    tb->mark = -1;
+    trimResident(tb, cursor->current);
+    setMessage("Replaced %lld occurrences (%lld ms)", count, monotonicMs() - started);
+}
+
+/* 바꿀 말을 받은 뒤 바꾸는 함수 (찾을 말은 앞 프롬프트가 saved에 남김) */
+void replaceWithAnswer(TextBuffer *tb, Cursor *cursor, const char *with) {
+    if (with == NULL) {
+        return;
+    }
+    replaceAll(tb, cursor, loop.prompt.saved, with);
+}
+
+/* 찾을 말을 받은 뒤 바꿀 말을 묻는 함수 */
+void replaceQueryAnswer(TextBuffer *tb, Cursor *cursor, const char *query) {
+    if (query == NULL || query[0] == '\0') {
+        return;
+    }
+    char prompt[300];
+    snprintf(prompt, sizeof(prompt), "Replace %s with: ", query);
+    snprintf(loop.prompt.saved, sizeof(loop.prompt.saved), "%s", query);
+    openPrompt(prompt, sizeof(loop.prompt.saved), NULL, 0, replaceWithAnswer);
+}
+
+/* 바꾸기 명령: 찾을 말과 바꿀 말을 차례로 입력받음 */
+void commandReplace(TextBuffer *tb, Cursor *cursor, const char *arg) {
+    openPrompt(tb->mark >= 0 ? "Replace in region: " : "Replace all: ", sizeof(loop.prompt.saved), NULL, 0,
+        replaceQueryAnswer);
+}
+
+/* 추가 커서 해제 함수 */
+void clearCursors(TextBuffer *tb) {
+    tb->cursor_count = 0;
+}
+
+/* 같은 위치에 겹친 커서를 하나로 합치는 함수 (주 커서와 겹친 추가 커서도 제거) */
+void mergeCursors(TextBuffer *tb, Cursor *cursor) {
+    int n = 0;
+    for (int i = 0; i < tb->cursor_count; i++) {
+        long long pos = tb->cursors[i];
+        if (pos != cursor->pos && (n == 0 || tb->cursors[n - 1] != pos)) {
+            tb->cursors[n++] = pos;
+        }
+    }
+    tb->cursor_count = n;
+}
+
+/* 모든 커서에 같은 키를 적용하는 함수
+ * 주 커서도 잠시 목록에 넣고 뒤쪽 커서부터 편집하므로, 앞쪽 커서 위치는 다시 계산할 필요가 없고
+ * 뒤쪽 커서는 adjustCursors가 밀어 줌. 키 하나의 편집은 모두 같은 되돌리기 묶음 */
+void applyToCursors(TextBuffer *tb, Cursor *cursor, int ch) {
+    addCursorAt(tb, cursor->pos);
+    int primary = 0;
+    while (tb->cursors[primary] != cursor->pos) primary++;
+    closeUndo(tb);
+
+    Cursor t = *cursor;
+    for (int i = tb->cursor_count - 1; i >= 0; i--) {
+        seekPosition(tb, &t, tb->cursors[i]);
+        t.col = computeColumn(tb, &t);
+        t.row = t.pos > t.col ? 1 : 0;     // 첫 줄인지만 알면 됨
+        switch (ch) {
+            case KEY_LEFT:
+                moveCursorLeft(tb, &t);
+                break;
+            case KEY_RIGHT:
+                moveCursorRight(tb, &t);
+                break;
+            case KEY_UP:
+                moveCursorUp(tb, &t);
+                break;
+            case KEY_DOWN:
+                moveCursorDown(tb, &t);
+                break;
+            case KEY_BACKSPACE:
+            case 127:
+            case 8:
+                deleteBytes(tb, &t, 1);
+                break;
+            default: {
+                char c = (ch == '\r') ? '\n' : (char)ch;
+                insertBytes(tb, &t, &c, 1);
+                break;
+            }
+        }
+        if (ch == KEY_LEFT || ch == KEY_RIGHT || ch == KEY_UP || ch == KEY_DOWN) {
+            tb->cursors[i] = t.pos;     // 이동은 다른 커서 위치에 영향을 주지 않음
+        }
+        closeUndo(tb);
+    }
+
+    long long pos = tb->cursors[primary];
+    memmove(tb->cursors + primary, tb->cursors + primary + 1, sizeof(long long) * (tb->cursor_count - primary - 1));
+    tb->cursor_count--;
+    cursor->current = t.current;
+    cursor->offset = t.offset;
+    cursor->pos = t.pos;
+    gotoPosition(tb, cursor, pos);
+    // 이동 뒤 위치가 뒤섞였을 수 있으므로 다시 정렬된 상태로 합침
+    for (int i = 1; i < tb->cursor_count; i++) {
+        long long v = tb->cursors[i];
+        int j = i;
+        while (j > 0 && tb->cursors[j - 1] > v) {
+            tb->cursors[j] = tb->cursors[j - 1];
+            j--;
+        }
+        tb->cursors[j] = v;
+    }
+    mergeCursors(tb, cursor);
+}
+
+/* 입력받은 말의 모든 일치 위치에 커서를 두는 함수 (영역이 있으면 그 안에서만) */
+void cursorsAtAnswer(TextBuffer *tb, Cursor *cursor, const char *query) {
+    if (query == NULL || query[0] == '\0') {
+        return;
+    }
+    SearchContext sc;
+    snprintf(sc.query, sizeof(sc.query), "%s", query);
+    long long start = 0, end = tb->size;
+    if (tb->mark >= 0) {
+        start = tb->mark < cursor->pos ? tb->mark : cursor->pos;
+        end = tb->mark < cursor->pos ? cursor->pos : tb->mark;
+        tb->mark = -1;
+    }
+    findMatchesIn(tb, &sc, start, end);
+    if (sc.result_count == 0) {
+        free(sc.results);
+        setMessage("No matches found.");
+        return;
+    }
+    // 커서는 일치한 글자 바로 뒤에 둠 (백스페이스로 지우고 새로 입력)
+    int len = strlen(query);
+    clearCursors(tb);
+    for (int i = 1; i < sc.result_count; i++) {
+        addCursorAt(tb, sc.results[i] + len);
+    }
+    gotoPosition(tb, cursor, sc.results[0] + len);
+    mergeCursors(tb, cursor);
+    snprintf(tb->cursor_query, sizeof(tb->cursor_query), "%s", query);
+    setMessage("%d cursors", tb->cursor_count + 1);
+    free(sc.results);
+}
+
+/* 모든 일치 위치에 커서를 두는 함수 */
+void cursorsAtMatches(TextBuffer *tb, Cursor *cursor) {
+    openPrompt("Cursors at: ", 256, NULL, 0, cursorsAtAnswer);
+}
+
+/* 마지막 커서 다음 일치에 커서를 하나 더하는 함수 (tb->cursor_query로 찾음) */
+void addNextCursor(TextBuffer *tb, Cursor *cursor) {
+    long long last = cursor->pos;
+    if (tb->cursor_count > 0 && tb->cursors[tb->cursor_count - 1] > last) {
+        last = tb->cursors[tb->cursor_count - 1];
+    }
+    SearchContext sc;
+    snprintf(sc.query, sizeof(sc.query), "%s", tb->cursor_query);
+    int len = strlen(sc.query);
+    findMatchesIn(tb, &sc, last, tb->size);
+    if (sc.result_count == 0) {
+        free(sc.results);
+        setMessage("No more matches for %s", tb->cursor_query);
+        return;
+    }
+    long long pos = sc.results[0] + len;
+    addCursorAt(tb, pos);
+    mergeCursors(tb, cursor);
+    setMessage("%d cursors", tb->cursor_count + 1);
+    free(sc.results);
+}
+
+/* 처음 찾을 말을 받은 뒤 커서를 더하는 함수 */
+void nextCursorAnswer(TextBuffer *tb, Cursor *cursor, const char *query) {
+    if (query == NULL || query[0] == '\0') {
+        return;
+    }
+    snprintf(tb->cursor_query, sizeof(tb->cursor_query), "%s", query);
+    addNextCursor(tb, cursor);
+}
+
+/* 마지막 커서 다음 일치에 커서를 하나 더하는 함수 (찾을 말이 없으면 먼저 물음) */
+void cursorAtNextMatch(TextBuffer *tb, Cursor *cursor) {
+    if (tb->cursor_query[0] == '\0') {
+        openPrompt("Next cursor at: ", sizeof(tb->cursor_query), NULL, 0, nextCursorAnswer);
+        return;
+    }
+    addNextCursor(tb, cursor);
+}
+
+/* 노드 복사 함수: 바이트는 복사하지 않고 원본, 압축본, 디스크 위치를 함께 가리키는 노드를 만듦
+ * 압축 해제된 원본은 참조 수로 나눠 쓰고 먼저 고치는 쪽이 복사함 (압축하지 않으므로 크기와 상관없음) */
+Node* shareNode(Node *node) {
+    Node *copy = (Node*)calloc(1, sizeof(Node));
+    if (node->data != NULL) {
+        if (node->data_refs == NULL) {
+            node->data_refs = (int*)malloc(sizeof(int));
+            *node->data_refs = 1;
+        }
+        (*node->data_refs)++;
+        copy->data = node->data;
+        copy->data_refs = node->data_refs;
+        copy->cap = node->cap;
+    }
+    copy->len = node->len;
+    copy->lines = node->lines;
+    copy->stats = node->stats;
+    copy->file_off = node->file_off;
+    copy->swap_off = node->swap_off;
+    if (node->packed != NULL) {
+        (*(int*)(node->packed - PACKED_HEADER))++;
+        copy->packed = node->packed;
+        copy->packed_len = node->packed_len;
+    }
+    node->swap_room = 0;    // 함께 가리키는 스크래치 자리는 다시 쓰지 않음
+    return copy;
+}
+
+/* first부터 stop 앞까지의 노드를 공유 복사해 사슬로 만드는 함수 */
+void copyChain(Node *first, Node *stop, Chain *out) {
+    out->head = out->tail = NULL;
+    out->len = 0;
+    for (Node *node = first; node != stop; node = node->next) {
+        chainLink(out, shareNode(node));
+    }
+}
+
+/* 잘라내기/복사한 사슬을 링에 넣는 함수 (가장 오래된 항목은 해제) */
+void killPush(Chain *chain) {
+    loop.kill_newest = (loop.kill_newest + 1) % KILL_RING_SIZE;
+    chainFree(&loop.kill_ring[loop.kill_newest]);
+    loop.kill_ring[loop.kill_newest] = *chain;
+    if (loop.kill_count < KILL_RING_SIZE) {
+        loop.kill_count++;
+    }
+}
+
+/* 영역 범위 계산 함수 (표시가 없으면 0) */
+int regionBounds(TextBuffer *tb, Cursor *cursor, long long *start, long long *end) {
+    if (tb->mark < 0) {
+        setMessage("No region (Ctrl-Space sets the mark)");
+        return 0;
+    }
+    *start = tb->mark < cursor->pos ? tb->mark : cursor->pos;
+    *end = tb->mark < cursor->pos ? cursor->pos : tb->mark;
+    tb->mark = -1;
+    return 1;
+}
+
+/* 잘라내기 함수: 범위의 노드를 떼어 그대로 링에 넣음 (되돌리기 기록은 같은 노드를 공유) */
+void cutRegion(TextBuffer *tb, Cursor *cursor) {
+    long long start, end;
+    if (!regionBounds(tb, cursor, &start, &end)) {
+        return;
+    }
+    long long cursor_before = cursor->pos;
+    Chain empty = {NULL, NULL, 0}, cut, copy;
+    replaceNodes(tb, cursor, start, end, &empty, &cut, 0);     // 링과 되돌리기 기록이 원본을 나눠 가짐
+    copyChain(cut.head, NULL, &copy);
+    pushUndo(tb, start, 0, &copy, cursor_before);
+    closeUndo(tb);
+    killPush(&cut);
+    trimResident(tb, cursor->current);
+    setMessage("Cut %lld bytes", end - start);
+}
+
+/* 복사 함수: 범위 경계에서 노드를 나눈 뒤 노드 단위로 공유 복사 */
+void copyRegion(TextBuffer *tb, Cursor *cursor) {
+    long long start, end;
+    if (!regionBounds(tb, cursor, &start, &end)) {
+        return;
+    }
+    Node *first = nodeStartingAt(tb, start);
+    Node *stop = nodeStartingAt(tb, end);
+    Chain copy;
+    copyChain(first, stop, &copy);
+    killPush(&copy);
+    cursor->current = NULL;     // 나눈 노드가 생겼을 수 있으므로 위치를 다시 찾음
+    gotoPosition(tb, cursor, cursor->pos);
+    setMessage("Copied %lld bytes", end - start);
+}
+
+/* 링 항목을 커서 위치에 붙여 넣는 함수 */
+void pasteRing(TextBuffer *tb, Cursor *cursor, int index) {
+    Chain copy, old;
+    long long pos = cursor->pos;
+    copyChain(loop.kill_ring[index].head, NULL, &copy);
+    long long len = copy.len;
+    spliceRange(tb, cursor, pos, pos, &copy, &old);
+    pushUndo(tb, pos, len, &old, pos);
+    closeUndo(tb);
+    trimResident(tb, cursor->current);
+    loop.yank_pos = pos;
+    loop.yank_len = len;
+    loop.yank_index = index;
+    loop.yank_version = tb->version;
+}
+
+/* 붙여넣기 함수 (Ctrl-V) */
+void pasteKill(TextBuffer *tb, Cursor *cursor) {
+    if (loop.kill_count == 0) {
+        setMessage("Kill ring is empty");
+        return;
+    }
+    pasteRing(tb, cursor, loop.kill_newest);
+}
+
+/* 방금 붙여 넣은 내용을 링의 이전 항목으로 바꾸는 함수 (ESC+V) */
+void pastePrevious(TextBuffer *tb, Cursor *cursor) {
+    if (loop.kill_count == 0 || loop.yank_version != tb->version) {
+        setMessage("Previous command was not a paste");
+        return;
+    }
+    int index = (loop.yank_index - 1 + KILL_RING_SIZE) % KILL_RING_SIZE;
+    if ((loop.kill_newest - index + KILL_RING_SIZE) % KILL_RING_SIZE >= loop.kill_count) {
+        index = loop.kill_newest;   // 가장 오래된 항목 다음은 다시 가장 최근 항목
+    }
+    Chain copy, old;
+    long long cursor_before = cursor->pos;
+    copyChain(loop.kill_ring[index].head, NULL, &copy);
+    long long len = copy.len;
+    spliceRange(tb, cursor, loop.yank_pos, loop.yank_pos + loop.yank_len, &copy, &old);
+    pushUndo(tb, loop.yank_pos, len, &old, cursor_before);
+    closeUndo(tb);
+    loop.yank_len = len;
+    loop.yank_index = index;
+    loop.yank_version = tb->version;
+    setMessage("Pasted kill ring entry %d", (loop.kill_newest - index + KILL_RING_SIZE) % KILL_RING_SIZE + 1);
+}
+
+/* 괄호 종류 (0: (), 1: [], 2: {}, 괄호가 아니면 -1) */
+int bracketKind(int ch, int *open) {
+    switch (ch) {
+        case '(': *open = 1; return 0;
+        case ')': *open = 0; return 0;
+        case '[': *open = 1; return 1;
+        case ']': *open = 0; return 1;
+        case '{': *open = 1; return 2;
+        case '}': *open = 0; return 2;
+        default: return -1;
+    }
+}
+
+/* 노드의 괄호 요약 함수: 안에서 짝이 맞는 괄호는 지우고 남는 닫는/여는 괄호 수만 셈 */
+void summarizeBrackets(TextBuffer *tb, Node *node) {
+    if (node->brackets_known) {
+        return;
+    }
+    int depth[4] = {0, 0, 0, 0};
+    int close[4] = {0, 0, 0, 0};
+    const char *data = nodeData(tb, node);
+    for (int i = 0; i < node->len; i++) {
+        int open;
+        int k = bracketKind(data[i], &open);
+        if (k < 0) {
+            continue;
+        }
+        // 종류별 요약과 종류를 가리지 않는 요약(3)을 함께 셈
+        int kinds[2] = {k, 3};
+        for (int n = 0; n < 2; n++) {
+            int j = kinds[n];
+            if (open) {
+                depth[j]++;
+            } else if (depth[j] > 0) {
+                depth[j]--;
+            } else {
+                close[j]++;
+            }
+        }
+    }
+    memcpy(node->bracket_open, depth, sizeof(depth));
+    memcpy(node->bracket_close, close, sizeof(close));
+    node->brackets_known = 1;
+}
+
+/* 짝 괄호 위치 찾기 함수 (없으면 -1)
+ * 커서가 있는 노드만 바이트 단위로 훑고 나머지 노드는 괄호 요약으로 건너뜀 */
+long long matchBracket(TextBuffer *tb, long long pos) {
+    Cursor t = {NULL, 0, 0};
+    seekPosition(tb, &t, pos);
+    int open;
+    int k = bracketKind(charAt(tb, &t), &open);
+    if (k < 0) {
+        return -1;
+    }
+    Node *node = t.current;
+    long long start = t.pos - t.offset;     // 노드 시작 위치
+    int i = t.offset;
+    int depth = 1;
+    while (node != NULL) {
+        const char *data = nodeData(tb, node);
+        if (open) {
+            for (i = i + 1; i < node->len; i++) {
+                int o;
+                if (bracketKind(data[i], &o) == k && (depth += o ? 1 : -1) == 0) {
+                    return start + i;
+                }
+            }
+            // 다음 노드부터는 짝이 그 안에 없으면 통째로 건너뜀
+            start += node->len;
+            node = node->next;
+            while (node != NULL) {
+                summarizeBrackets(tb, node);
+                if (node->bracket_close[k] >= depth) {
+                    break;
+                }
+                depth += node->bracket_open[k] - node->bracket_close[k];
+                start += node->len;
+                node = node->next;
+                trimResident(tb, node);
+            }
+            i = -1;
+        } else {
+            for (i = i - 1; i >= 0; i--) {
+                int o;
+                if (bracketKind(data[i], &o) == k && (depth += o ? -1 : 1) == 0) {
+                    return start + i;
+                }
+            }
+            node = node->prev;
+            while (node != NULL) {
+                start -= node->len;
+                summarizeBrackets(tb, node);
+                if (node->bracket_open[k] >= depth) {
+                    break;
+                }
+                depth += node->bracket_close[k] - node->bracket_open[k];
+                node = node->prev;
+                trimResident(tb, node);
+            }
+            i = node != NULL ? node->len : 0;
+        }
+    }
+    return -1;
+}
+
+/* 짝 괄호로 이동 (ESC+]): 커서 자리나 바로 앞 글자가 괄호일 때 */
+void jumpToBracket(TextBuffer *tb, Cursor *cursor) {
+    long long from = cursor->pos;
+    long long to = matchBracket(tb, from);
+    if (to < 0 && from > 0) {
+        from--;
+        to = matchBracket(tb, from);
+    }
+    if (to < 0) {
+        setMessage("No matching bracket");
+        return;
+    }
+    gotoPosition(tb, cursor, to);
+    trimResident(tb, cursor->current);
+}
+
+/* 끝이 위치보다 뒤인 첫 접은 구간의 번호 (이분 탐색) */
+int foldIndex(TextBuffer *tb, long long pos) {
+    int lo = 0, hi = tb->fold_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (tb->folds[mid].end <= pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* 위치를 숨기는 접은 구간 찾기 함수 */
+Fold* foldAt(TextBuffer *tb, long long pos) {
+    int lo = foldIndex(tb, pos);
+    if (lo < tb->fold_count && tb->folds[lo].start <= pos) {
+        return &tb->folds[lo];
+    }
+    return NULL;
+}
+
+/* 지정한 줄 시작에서 시작하는 접은 구간 */
+Fold* foldStartingAt(TextBuffer *tb, long long pos) {
+    Fold *f = foldAt(tb, pos);
+    return f != NULL && f->start == pos ? f : NULL;
+}
+
+/* 접은 구간 제거 함수 */
+void removeFold(TextBuffer *tb, Fold *f) {
+    int i = (int)(f - tb->folds);
+    memmove(f, f + 1, sizeof(Fold) * (tb->fold_count - i - 1));
+    tb->fold_count--;
+    loop.dirty = 1;
+}
+
+/* 접은 구간 추가 함수 (새 구간 안에 든 구간은 흡수) */
+void addFold(TextBuffer *tb, long long start, long long end, long long lines) {
+    int i = foldIndex(tb, start);
+    int j = i;
+    while (j < tb->fold_count && tb->folds[j].start < end) j++;
+    if (j > i) {
+        memmove(&tb->folds[i], &tb->folds[j], sizeof(Fold) * (tb->fold_count - j));
+        tb->fold_count -= j - i;
+    }
+    if (tb->fold_count == tb->fold_cap) {
+        tb->fold_cap = tb->fold_cap ? tb->fold_cap * 2 : 64;
+        tb->folds = (Fold*)realloc(tb->folds, sizeof(Fold) * tb->fold_cap);
+    }
+    memmove(&tb->folds[i + 1], &tb->folds[i], sizeof(Fold) * (tb->fold_count - i));
+    tb->folds[i].start = start;
+    tb->folds[i].end = end;
+    tb->folds[i].lines = lines;
+    tb->fold_count++;
+    loop.dirty = 1;
+}
+
+/* 편집에 맞춰 접은 구간을 옮기는 함수 ([start, end)가 inserted 바이트로 바뀜)
+ * 숨긴 내용이나 경계에 닿은 구간은 펼침 */
+void adjustFolds(TextBuffer *tb, long long start, long long end, long long inserted) {
+    long long delta = inserted - (end - start);
+    int kept = 0;
+    for (int i = 0; i < tb->fold_count; i++) {
+        Fold f = tb->folds[i];
+        if (start < f.end && end >= f.start) {
+            continue;
+        }
+        if (f.start >= end) {
+            f.start += delta;
+            f.end += delta;
+        }
+        tb->folds[kept++] = f;
+    }
+    tb->fold_count = kept;
+}
+
+/* 구간 안의 줄바꿈 수 (색인된 노드는 줄 수를 그대로 씀) */
+long long countLinesBetween(TextBuffer *tb, long long start, long long end) {
+    Cursor t = {NULL, 0, 0};
+    seekPosition(tb, &t, start);
+    long long lines = 0;
+    while (t.pos < end && normalizeForward(&t)) {
+        int n = t.current->len - t.offset;
+        if (n > end - t.pos) {
+            n = (int)(end - t.pos);
+        }
+        if (n == t.current->len && t.current->lines >= 0) {
+            lines += t.current->lines;
+        } else {
+            lines += countNewlines(nodeData(tb, t.current) + t.offset, n);
+        }
+        t.offset += n;
+        t.pos += n;
+        trimResident(tb, t.current);
+    }
+    return lines;
+}
+
+/* 보이는 다음 줄 시작으로 이동 (접은 구간은 건너뛰고 줄 번호는 숨긴 줄까지 셈) */
+int nextVisibleLine(TextBuffer *tb, Cursor *c) {
+    if (!moveToNextLine(tb, c)) {
+        return 0;
+    }
+    Fold *f = tb->fold_count > 0 ? foldStartingAt(tb, c->pos) : NULL;
+    if (f != NULL) {
+        seekPosition(tb, c, f->end);
+        c->row += f->lines;
+    }
+    return 1;
+}
+
+/* 보이는 이전 줄 시작으로 이동 (줄 시작에서 호출, 첫 줄이면 0 반환) */
+int prevVisibleLine(TextBuffer *tb, Cursor *c) {
+    if (c->pos == 0) {
+        return 0;
+    }
+    Fold *f = tb->fold_count > 0 ? foldAt(tb, c->pos - 1) : NULL;
+    if (f != NULL && f->end == c->pos) {
+        seekPosition(tb, c, f->start);
+        c->row -= f->lines;
+    }
+    stepBackward(tb, c);
+    moveToLineStart(tb, c);
+    c->row--;
+    return 1;
+}
+
+/* 줄의 들여쓰기 폭 (빈 줄이면 -1) */
+int lineIndent(TextBuffer *tb, Cursor *c) {
+    Cursor t = *c;
+    int indent = 0;
+    int ch;
+    while ((ch = charAt(tb, &t)) == ' ' || ch == '\t') {
+        indent += ch == '\t' ? 8 - indent % 8 : 1;
+        stepForward(tb, &t);
+    }
+    return (ch < 0 || ch == '\n' || ch == '\r') ? -1 : indent;
+}
+
+/* 커서 줄을 머리로 하는 접을 구간 찾기 함수 (없으면 0)
+ * 줄에서 닫히지 않은 바깥 괄호가 있으면 짝 괄호 줄 앞까지, 없으면 더 깊이 들여 쓴 줄들 */
+int foldRange(TextBuffer *tb, Cursor *cursor, long long *start, long long *end) {
+    Cursor t = *cursor;
+    moveToLineStart(tb, &t);
+    Cursor head = t;
+    long long open_pos = -1;
+    int depth = 0;
+    int ch;
+    while ((ch = charAt(tb, &t)) >= 0 && ch != '\n') {
+        int open;
+        if (bracketKind(ch, &open) >= 0) {
+            if (open && depth++ == 0) {
+                open_pos = t.pos;
+            } else if (!open && depth > 0) {
+                depth--;
+            }
+        }
+        stepForward(tb, &t);
+    }
+    if (ch < 0) {
+        return 0;
+    }
+    *start = t.pos + 1;
+    if (depth > 0) {
+        long long close = matchBracket(tb, open_pos);
+        if (close < 0) {
+            return 0;
+        }
+        seekPosition(tb, &t, close);
+        moveToLineStart(tb, &t);
+        *end = t.pos;
+        return *end > *start;
+    }
+    int indent = lineIndent(tb, &head);
+    if (indent < 0) {
+        return 0;
+    }
+    // 빈 줄은 뒤에 더 깊은 줄이 이어질 때만 포함
+    stepForward(tb, &t);
+    *end = *start;
+    while (1) {
+        int in = lineIndent(tb, &t);
+        if (in >= 0 && in <= indent) {
+            break;
+        }
+        if (in > indent) {
+            if (!moveToNextLine(tb, &t)) {
+                return 0;
+            }
+            *end = t.pos;
+        } else if (!moveToNextLine(tb, &t)) {
+            break;
+        }
+    }
+    return *end > *start;
+}
+
+/* 커서 줄 접기/펼치기 전환 (ESC+-) */
+void toggleFold(TextBuffer *tb, Cursor *cursor) {
+    Cursor t = *cursor;
+    Fold *f = NULL;
+    if (moveToNextLine(tb, &t)) {
+        f = foldStartingAt(tb, t.pos);
+    }
+    if (f != NULL) {
+        removeFold(tb, f);
+        return;
+    }
+    long long start, end;
+    if (!foldRange(tb, cursor, &start, &end)) {
+        setMessage("Nothing to fold here");
+        return;
+    }
+    addFold(tb, start, end, countLinesBetween(tb, start, end));
+}
+
+/* 커서가 접은 구간 안에 있으면 펼치는 함수 (검색, 줄 이동 등으로 들어갔을 때) */
+void revealCursor(TextBuffer *tb, Cursor *cursor) {
+    Fold *f;
+    while (tb->fold_count > 0 && (f = foldAt(tb, cursor->pos)) != NULL) {
+        removeFold(tb, f);
+    }
+}
+
+/* 깊이별 접기 명령: fold [깊이]
+ * 파일을 한 번 훑으며 깊이(기본 1, 바깥 괄호의 항목들)에서 열린 여러 줄 구간을 모두 접음
+ * 그 깊이에 닿지 않는 노드는 괄호 요약만 보고 건너뜀 */
+void commandFold(TextBuffer *tb, Cursor *cursor, const char *arg) {
+    int target = arg[0] != '\0' ? atoi(arg) : 1;
+    long long started = monotonicMs();
+    tb->fold_count = 0;
+    long long pos = 0, row = 0;
+    long long line_start = 0;
+    long long fold_start = -1, fold_row = 0;
+    int pending = 0;        // 구간을 연 줄의 끝을 기다리는 중
+    int depth = 0;
+    for (Node *node = tb->head; node != NULL; node = node->next) {
+        if (!pending && node->brackets_known && node->lines >= 0 && depth - node->bracket_close[3] > target) {
+            depth += node->bracket_open[3] - node->bracket_close[3];
+            pos += node->len;
+            row += node->lines;
+            if (node->lines > 0) {
+                line_start = -1;    // 필요해지면 거슬러 올라가 찾음
+            }
+            continue;
+        }
+        const char *data = nodeData(tb, node);
+        for (int i = 0; i < node->len; i++, pos++) {
+            int open;
+            char ch = data[i];
+            if (ch == '\n') {
+                row++;
+                line_start = pos + 1;
+                if (pending) {
+                    fold_start = pos + 1;
+                    fold_row = row;
+                    pending = 0;
+                }
+                continue;
+            }
+            if (bracketKind(ch, &open) < 0) {
+                continue;
+            }
+            if (open) {
+                if (depth++ == target) {
+                    pending = 1;
+                    fold_start = -1;
+                }
+            } else if (depth > 0 && --depth == target) {
+                pending = 0;
+                if (line_start < 0) {
+                    Cursor t = {NULL, 0, 0};
+                    seekPosition(tb, &t, pos);
+                    moveToLineStart(tb, &t);
+                    line_start = t.pos;
+                }
+                if (fold_start >= 0 && line_start > fold_start) {
+                    addFold(tb, fold_start, line_start, row - fold_row);
+                }
+                fold_start = -1;
+            }
+        }
+        trimResident(tb, cursor->current);
+    }
+    gotoPosition(tb, cursor, cursor->pos);
+    revealCursor(tb, cursor);
+    setMessage("Folded %d regions at depth %d (%lld ms)", tb->fold_count, target, monotonicMs() - started);
+}
+
+/* 모두 펼치기 명령 */
+void commandUnfold(TextBuffer *tb, Cursor *cursor, const char *arg) {
+    tb->fold_count = 0;
+    loop.dirty = 1;
+}
+
+/* 명령 함수 */
+void commandSort(TextBuffer *tb, Cursor *cursor, const char *arg) {
+    runLineCommand(tb, cursor, LINE_SORT, 0, NULL);
+}
+
+void commandSortNumeric(TextBuffer *tb, Cursor *cursor, const char *arg) {
+    runLineCommand(tb, cursor, LINE_SORT, 1, NULL);
+}
+
+void commandUnique(TextBuffer *tb, Cursor *cursor, const char *arg) {
+    runLineCommand(tb, cursor, LINE_UNIQUE, 0, NULL);
+}
+
+void commandReverse(TextBuffer *tb, Cursor *cursor, const char *arg) {
+    runLineCommand(tb, cursor, LINE_REVERSE, 0, NULL);
+}
+
+void commandKeep(TextBuffer *tb, Cursor *cursor, const char *arg) {
+    runLineCommand(tb, cursor, LINE_KEEP, 0, arg);
+}
+
+void commandDrop(TextBuffer *tb, Cursor *cursor, const char *arg) {
+    runLineCommand(tb, cursor, LINE_DROP, 0, arg);
+}
+
+/* 명령 목록 (ESC+X로 이름을 입력해 실행) */
+static const Command commands[] = {
+    {"sort", commandSort, 0},
+    {"sort-numeric", commandSortNumeric, 0},
+    {"unique", commandUnique, 0},
+    {"reverse", commandReverse, 0},
+    {"keep", commandKeep, 1},
+    {"drop", commandDrop, 1},
+    {"replace", commandReplace, 0},
+    {"pipe", commandPipe, 0},
+    {"fold", commandFold, 0},
+    {"unfold", commandUnfold, 0},
+    {"grep", commandGrep, 1},
+};
+
+/* 입력받은 명령 실행 함수 */
+void runCommandAnswer(TextBuffer *tb, Cursor *cursor, const char *answer) {
+    char line[256];
+    if (answer == NULL || answer[0] == '\0') {
+        return;
+    }
+    snprintf(line, sizeof(line), "%s", answer);
+    // 첫 단어는 명령 이름, 나머지는 인자
+    char *arg = strchr(line, ' ');
+    if (arg != NULL) {
+        *arg++ = '\0';
+    } else {
+        arg = line + strlen(line);
+    }
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(commands[i].name, line) == 0) {
+            if (commands[i].needs_arg && arg[0] == '\0') {
+                setMessage("Usage: %s <text>", line);
+            } else {
+                commands[i].run(tb, cursor, arg);
+            }
+            return;
+        }
+    }
+    setMessage("Unknown command: %s", line);
+}
+
+/* 명령 입력 함수 */
+void runCommand(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    openPrompt("Command: ", 256, NULL, 0, runCommandAnswer);
+}
+
+/* 단조 시계 함수 (ms) */
+long long monotonicMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* 메시지 설정 함수 */
+void setMessage(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(loop.message, sizeof(loop.message), fmt, ap);
+    va_end(ap);
+    loop.dirty = 1;
+}
+
+/* 타이머 재설정 함수 (리눅스는 timerfd를 가장 이른 만료 시각에 맞춤) */
+void armTimers(void) {
+#ifdef __linux__
+    long long deadline = 0;
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        if (loop.timers[i].deadline != 0 && (deadline == 0 || loop.timers[i].deadline < deadline)) {
+            deadline = loop.timers[i].deadline;
+        }
+    }
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));   // 0이면 timerfd 해제
+    its.it_value.tv_sec = deadline / 1000;
+    its.it_value.tv_nsec = (deadline % 1000) * 1000000;
+    if (loop.timer_fd >= 0) {
+        timerfd_settime(loop.timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    }
+#endif
+}
+
+/* 타이머 등록 함수: 타이머 번호를 반환 (-1이면 빈 자리 없음) */
+int addTimer(int delay_ms, EventCallback callback, void *arg) {
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        if (loop.timers[i].deadline == 0) {
+            loop.timers[i].deadline = monotonicMs() + delay_ms;
+            loop.timers[i].callback = callback;
+            loop.timers[i].arg = arg;
+            armTimers();
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* 타이머 취소 함수 */
+void cancelTimer(int id) {
+    if (id >= 0 && id < MAX_TIMERS) {
+        loop.timers[id].deadline = 0;
+        armTimers();
+    }
+}
+
+/* 만료된 타이머 실행 함수 */
+void runExpiredTimers(void) {
+    long long now = monotonicMs();
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        if (loop.timers[i].deadline != 0 && loop.timers[i].deadline <= now) {
+            Timer t = loop.timers[i];
+            loop.timers[i].deadline = 0;    // 콜백 안에서 다시 등록할 수 있도록 먼저 비움
+            t.callback(t.arg);
+        }
+    }
+    armTimers();
+}
+
+/* 워커 스레드에서 메인 루프로 작업을 넘기는 함수 (스레드 안전) */
+void postEvent(EventCallback callback, void *arg) {
+    PostedEvent *ev = (PostedEvent*)malloc(sizeof(PostedEvent));
+    ev->callback = callback;
+    ev->arg = arg;
+    ev->next = NULL;
+
+    pthread_mutex_lock(&loop.lock);
+    if (loop.posted_tail != NULL) {
+        loop.posted_tail->next = ev;
+    } else {
+        loop.posted_head = ev;
+    }
+    loop.posted_tail = ev;
+    pthread_mutex_unlock(&loop.lock);
+
+    // 메인 루프가 poll에서 깨어나도록 알림
+#ifdef __linux__
+    unsigned long long one = 1;
+    if (write(loop.wake_fd[1], &one, sizeof(one)) < 0) {
+        // 카운터가 이미 차 있으면 메인 루프가 어차피 깨어남
+    }
+#elif !defined(_WIN32)
+    char one = 1;
+    if (write(loop.wake_fd[1], &one, 1) < 0) {
+        // pipe가 가득 차 있으면 메인 루프가 어차피 깨어남
+    }
+#else
+    SetEvent(loop.wake_event);
+#endif
+}
+
+/* 넘겨받은 작업 실행 함수 */
+void runPostedEvents(void) {
+#ifdef __linux__
+    unsigned long long count;
+    while (read(loop.wake_fd[0], &count, sizeof(count)) > 0) {
+    }
+#elif !defined(_WIN32)
+    char drain[64];
+    while (read(loop.wake_fd[0], drain, sizeof(drain)) > 0) {
+    }
+#endif
+    pthread_mutex_lock(&loop.lock);
+    PostedEvent *ev = loop.posted_head;
+    loop.posted_head = NULL;
+    loop.posted_tail = NULL;
+    pthread_mutex_unlock(&loop.lock);
+
+    while (ev != NULL) {
+        PostedEvent *next = ev->next;
+        ev->callback(ev->arg);
+        free(ev);
+        ev = next;
+    }
+}
+
+#ifndef _WIN32
+/* 수정 시각 (나노초) */
+long long statMtime(const struct stat *st) {
+#ifdef __APPLE__
+    return (long long)st->st_mtimespec.tv_sec * 1000000000LL + st->st_mtimespec.tv_nsec;
+#else
+    return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+#endif
+}
+#endif
+
+/* 파일의 현재 상태(수정 시각, 크기)를 기억하는 함수 */
+void rememberFileState(const char *filename) {
+#ifndef _WIN32
+    struct stat st;
+    if (stat(filename, &st) == 0) {
+        loop.known_mtime = statMtime(&st);
+        loop.known_size = st.st_size;
+    } else {
+        loop.known_mtime = -1;
+        loop.known_size = -1;
+    }
+#endif
+}
+
+/* 다른 프로세스가 파일을 바꿨는지 확인하는 함수 */
+int checkFileChanged(TextBuffer *tb) {
+    if (tb->filename == NULL) {
+        return 0;
+    }
+    long long mtime = loop.known_mtime;
+    long long size = loop.known_size;
+    rememberFileState(tb->filename);
+    if (mtime == loop.known_mtime && size == loop.known_size) {
+        return 0;
+    }
+    if (loop.known_size < 0) {
+        setMessage("%s was removed on disk", tb->filename);
+    } else {
+        setMessage("%s changed on disk", tb->filename);
+    }
+    return 1;
+}
+
+/* 파일 감시 시작 함수 (리눅스 inotify) */
+void watchFile(const char *filename) {
+    rememberFileState(filename);
+#ifdef __linux__
+    // 저장 시 rename으로 교체되어도 놓치지 않도록 파일이 있는 디렉터리를 감시
+    char dir[4096];
+    const char *slash = strrchr(filename, '/');
+    if (slash != NULL) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - filename), filename);
+        if (dir[0] == '\0') {
+            strcpy(dir, "/");
+        }
+        loop.watch_name = slash + 1;
+    } else {
+        strcpy(dir, ".");
+        loop.watch_name = filename;
+    }
+    loop.watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (loop.watch_fd >= 0) {
+        loop.watch_wd = inotify_add_watch(loop.watch_fd, dir,
+            IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+    }
+#endif
+}
+
+/* inotify 이벤트 처리 함수 */
+void handleWatchEvents(TextBuffer *tb) {
+#ifdef __linux__
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t len;
+    while ((len = read(loop.watch_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event*)p;
+            if (ev->len > 0 && strcmp(ev->name, loop.watch_name) == 0) {
+                changed = 1;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    if (changed && loop.save_job == NULL && checkFileChanged(tb) && loop.cursor != NULL) {
+        // 자체 저장 중에 생긴 이벤트는 완료 시 상태를 다시 기억하므로 무시
+        mergeDiskChanges(tb, loop.cursor);
+    }
+#endif
+}
+
+/* 끝까지 쓰는 함수 (EINTR, 부분 쓰기 처리) */
+int writeAll(int fd, const char *buf, size_t len) {
+#ifndef _WIN32
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+#endif
+    return 0;
+}
+
+#ifndef _WIN32
+/* 세션 캐시 파일 경로 함수 ($XDG_CACHE_HOME/viva 또는 ~/.cache/viva 아래, 실제 경로의 해시로 이름을 지음) */
+int sessionPath(const char *filename, char *real, char *path, size_t size, int create) {
+    if (realpath(filename, real) == NULL) {
+        return 0;
+    }
+    char dir[4096];
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (cache != NULL && cache[0] == '/') {
+        snprintf(dir, sizeof(dir), "%.4000s/viva", cache);
+    } else if (home != NULL && home[0] == '/') {
+        snprintf(dir, sizeof(dir), "%.4000s/.cache", home);
+        if (create) mkdir(dir, 0700);
+        snprintf(dir, sizeof(dir), "%.4000s/.cache/viva", home);
+    } else {
+        return 0;
+    }
+    if (create) mkdir(dir, 0700);
+    snprintf(path, size, "%s/%016llx.session", dir, hashLine(real, (long long)strlen(real)));
+    return 1;
+}
+
+/* 파일 끝 [size - SESSION_TAIL, size) 구간의 해시 */
+unsigned long long tailHash(int fd, long long size) {
+    char buf[SESSION_TAIL];
+    int len = size < SESSION_TAIL ? (int)size : SESSION_TAIL;
+    if (readAt(fd, buf, len, size - len) < 0) {
+        return 0;
+    }
+    return hashLine(buf, len);
+}
+
+/* 세션 캐시 불러오기 함수: 검색어는 늘 되살리고, 파일이 그대로이거나 뒤에 덧붙기만 했으면
+ * 커서와 화면 위치, 줄 색인도 되살림 (덧붙은 부분의 색인은 색인 스레드가 이어서 셈)
+ * 되살린 커서 위치를 반환 (없으면 -1) */
+long long loadSession(TextBuffer *tb, const char *filename, const struct stat *st, int want_index) {
+    char real[4096];
+    char path[4096];
+    if (!sessionPath(filename, real, path, sizeof(path), 0)) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    SessionHeader h;
+    long long off = sizeof(h);
+    char stored[4096];
+    if (readAt(fd, (char*)&h, sizeof(h), 0) < 0 || memcmp(h.magic, SESSION_MAGIC, sizeof(h.magic)) != 0
+        || h.path_len != (int)strlen(real) || readAt(fd, stored, h.path_len, off) < 0
+        || memcmp(stored, real, h.path_len) != 0 || h.history_count < 0 || h.history_count > SEARCH_HISTORY) {
+        close(fd);      // 다른 파일의 캐시(해시 충돌)이거나 깨진 캐시
+        return -1;
+    }
+    off += h.path_len;
+    if (readAt(fd, (char*)tb->history, sizeof(tb->history[0]) * h.history_count, off) == 0) {
+        tb->history_count = h.history_count;
+        for (int i = 0; i < h.history_count; i++) {
+            tb->history[i][sizeof(tb->history[i]) - 1] = '\0';
+        }
+    }
+    off += (long long)sizeof(tb->history[0]) * h.history_count;
+
+    int same = h.inode == (long long)st->st_ino && h.size == st->st_size && h.mtime == statMtime(st);
+    int appended = 0;
+    if (!same && h.inode == (long long)st->st_ino && st->st_size > h.size) {
+        // 같은 파일이 커졌으면 예전 끝부분이 그대로인지 확인 (로그처럼 덧붙이기만 한 경우)
+        int source = open(filename, O_RDONLY | O_CLOEXEC);
+        if (source >= 0) {
+            appended = tailHash(source, h.size) == h.tail_hash;
+            close(source);
+        }
+    }
+    if (!same && !appended) {
+        close(fd);
+        return -1;
+    }
+    int cached = (int)((h.size + NODE_MAX_SIZE - 1) / NODE_MAX_SIZE);
+    if (want_index && h.pages == cached && cached > 0) {
+        int pages = (int)((st->st_size + NODE_MAX_SIZE - 1) / NODE_MAX_SIZE);
+        int *lines = (int*)malloc(sizeof(int) * pages);
+        memset(lines, 0xff, sizeof(int) * pages);
+        if (readAt(fd, (char*)lines, sizeof(int) * cached, off) == 0) {
+            if (appended && h.size % NODE_MAX_SIZE != 0) {
+                lines[cached - 1] = -1;     // 마지막 페이지는 뒤에 덧붙은 만큼 길어짐
+            }
+            tb->page_lines = lines;
+            tb->page_count = pages;
+        } else {
+            free(lines);
+        }
+    }
+    close(fd);
+    tb->top_pos = h.top_pos >= 0 && h.top_pos <= h.size ? h.top_pos : 0;
+    return h.cursor_pos >= 0 && h.cursor_pos <= h.size ? h.cursor_pos : -1;
+}
+#endif
+
+/* 세션 캐시 저장 함수 (종료할 때): 커서, 화면 위치, 검색어와
+ * 디스크 내용이 연 뒤로 그대로라면 페이지별 줄 수까지 기록 */
+void storeSession(TextBuffer *tb, Cursor *cursor) {
+#ifndef _WIN32
+    char real[4096];
+    char path[4096];
+    char temp[4096 + 16];
+    struct stat st;
+    if (tb->filename == NULL || !sessionPath(tb->filename, real, path, sizeof(path), 1) || stat(real, &st) != 0) {
+        return;
+    }
+    SessionHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SESSION_MAGIC, sizeof(h.magic));
+    h.size = st.st_size;
+    h.mtime = statMtime(&st);
+    h.inode = (long long)st.st_ino;
+    h.cursor_pos = cursor->pos;
+    h.top_pos = tb->top_pos;
+    h.path_len = (int)strlen(real);
+    h.history_count = tb->history_count;
+    // 저장했거나 밖에서 바뀌었다면 색인은 예전 내용의 것
+    if (tb->page_lines != NULL && h.size == tb->disk_size && h.mtime == tb->disk_mtime && h.inode == tb->disk_inode) {
+        h.pages = tb->page_count;
+    }
+    int source = open(real, O_RDONLY | O_CLOEXEC);
+    if (source < 0) {
+        return;
+    }
+    h.tail_hash = tailHash(source, h.size);
+    close(source);
+
+    snprintf(temp, sizeof(temp), "%s%s", path, SAVE_TEMP_SUFFIX);
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    int ok = writeAll(fd, (const char*)&h, sizeof(h)) == 0
+        && writeAll(fd, real, h.path_len) == 0
+        && writeAll(fd, (const char*)tb->history, sizeof(tb->history[0]) * h.history_count) == 0
+        && writeAll(fd, (const char*)tb->page_lines, sizeof(int) * h.pages) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(temp, path) != 0) {
+        unlink(temp);
+    }
+#else
+    (void)tb;
+    (void)cursor;
+#endif
+}
+
+/* 기준본 기억 함수 (열 때, 저장한 뒤, 디스크 변경을 합친 뒤): 지금 디스크의 파일을 열어 두고 상태를 기록 */
+void rememberBase(TextBuffer *tb) {
+#ifndef _WIN32
+    struct stat st;
+    if (tb->base_fd >= 0) {
+        close(tb->base_fd);
+    }
+    tb->base_fd = tb->filename ? open(tb->filename, O_RDONLY | O_CLOEXEC) : -1;
+    if (tb->base_fd >= 0 && fstat(tb->base_fd, &st) == 0) {
+        tb->disk_size = st.st_size;
+        tb->disk_mtime = statMtime(&st);
+        tb->disk_inode = (long long)st.st_ino;
+        tb->disk_tail = tailHash(tb->base_fd, st.st_size);
+    }
+#else
+    (void)tb;
+#endif
+}
+
+#ifndef _WIN32
+/* 디스크 내용을 버퍼와 같은 형식으로 읽는 함수 (BOM과 "\r\n"의 '\r'을 뗌, 실패하면 NULL) */
+char* readNormalized(TextBuffer *tb, int fd, long long *size) {
+    char *text = (char*)malloc(*size + 1);
+    for (long long off = 0; off < *size; off += INDEX_READ_SIZE) {
+        int n = *size - off < INDEX_READ_SIZE ? (int)(*size - off) : INDEX_READ_SIZE;
+        if (readAt(fd, text + off, n, off) < 0) {
+            free(text);
+            return NULL;
+        }
+    }
+    long long len = *size;
+    if (tb->bom && len >= 3 && memcmp(text, "\xef\xbb\xbf", 3) == 0) {
+        memmove(text, text + 3, len - 3);
+        len -= 3;
+    }
+    *size = tb->crlf ? stripCarriageReturns(text, len) : len;
+    return text;
+}
+
+/* 비교할 내용의 한 구간을 읽는 함수 */
+int readSide(const DiffSide *side, char *buf, long long off, int len) {
+    if (side->tb == NULL && side->text != NULL) {
+        memcpy(buf, side->text + off, len);
+        return 0;
+    }
+    if (side->tb == NULL) {
+        return readAt(side->fd, buf, len, off);
+    }
+    char *p = readRange(side->tb, off, off + len);
+    if (p == NULL) {
+        return -1;
+    }
+    memcpy(buf, p, len);
+    free(p);
+    return 0;
+}
+
+/* 두 내용의 공통 앞부분 길이 (줄 경계로 맞춤) */
+long long commonPrefix(const DiffSide *a, const DiffSide *b) {
+    char *x = (char*)malloc(NODE_MAX_SIZE);
+    char *y = (char*)malloc(NODE_MAX_SIZE);
+    long long limit = a->size < b->size ? a->size : b->size;
+    long long off = 0;
+    long long line_start = 0;
+    while (off < limit) {
+        int len = limit - off < NODE_MAX_SIZE ? (int)(limit - off) : NODE_MAX_SIZE;
+        if (readSide(a, x, off, len) < 0 || readSide(b, y, off, len) < 0) {
+            break;
+        }
+        int i = 0;
+        if (memcmp(x, y, len) == 0) {
+            i = len;    // 같은 조각은 마지막 '\n'만 찾음
+            for (int j = len - 1; j >= 0; j--) {
+                if (x[j] == '\n') {
+                    line_start = off + j + 1;
+                    break;
+                }
+            }
+        }
+        while (i < len && x[i] == y[i]) {
+            if (x[i] == '\n') {
+                line_start = off + i + 1;
+            }
+            i++;
+        }
+        if (i < len) {
+            break;
+        }
+        off += len;
+    }
+    if (off == limit && a->size == b->size) {
+        line_start = limit;     // 내용이 같음
+    }
+    free(x);
+    free(y);
+    return line_start;
+}
+
+/* 두 내용의 공통 뒷부분 길이 (앞부분 prefix와 겹치지 않고, '\n' 바로 뒤에서 시작하도록 맞춤) */
+long long commonSuffix(const DiffSide *a, const DiffSide *b, long long prefix) {
+    char *x = (char*)malloc(NODE_MAX_SIZE);
+    char *y = (char*)malloc(NODE_MAX_SIZE);
+    long long limit = (a->size < b->size ? a->size : b->size) - prefix;
+    long long matched = 0;
+    long long first_nl = -1;    // 일치한 뒷부분에서 맨 앞 '\n'까지 (끝에서 센 거리)
+    while (matched < limit) {
+        int len = limit - matched < NODE_MAX_SIZE ? (int)(limit - matched) : NODE_MAX_SIZE;
+        if (readSide(a, x, a->size - matched - len, len) < 0 || readSide(b, y, b->size - matched - len, len) < 0) {
+            break;
+        }
+        int i = len - 1;
+        if (memcmp(x, y, len) == 0) {
+            const char *nl = memchr(x, '\n', len);     // 같은 조각은 맨 앞 '\n'만 찾음
+            if (nl != NULL) {
+                first_nl = matched + (len - (nl - x));
+            }
+            i = -1;
+        }
+        while (i >= 0 && x[i] == y[i]) {
+            if (x[i] == '\n') {
+                first_nl = matched + (len - i);
+            }
+            i--;
+        }
+        if (i >= 0) {
+            break;
+        }
+        matched += len;
+    }
+    free(x);
+    free(y);
+    return first_nl < 0 ? 0 : first_nl - 1;
+}
+
+/* 줄 나누기 함수: 각 줄의 위치와 해시 */
+int splitDiffLines(const char *text, long long len, DiffLine **out) {
+    int count = 0;
+    int cap = 64;
+    DiffLine *lines = (DiffLine*)malloc(sizeof(DiffLine) * cap);
+    for (long long off = 0; off < len; ) {
+        const char *nl = memchr(text + off, '\n', len - off);
+        long long end = nl != NULL ? nl - text + 1 : len;
+        if (count == cap) {
+            cap *= 2;
+            lines = (DiffLine*)realloc(lines, sizeof(DiffLine) * cap);
+        }
+        lines[count].text = text + off;
+        lines[count].len = (int)(end - off);
+        lines[count].hash = hashLine(text + off, end - off);
+        count++;
+        off = end;
+    }
+    *out = lines;
+    return count;
+}
+
+int sameLine(const DiffLine *a, const DiffLine *b) {
+    return a->hash == b->hash && a->len == b->len && memcmp(a->text, b->text, a->len) == 0;
+}
+
+/* 줄 단위 차이 계산 함수 (Myers O(ND)): a를 b로 바꾸는 덩어리들을 순서대로 채우고 개수를 반환
+ * 편집 수가 DIFF_MAX_EDITS를 넘으면 전체를 한 덩어리로 봄 */
+int diffLines(const DiffLine *a, int n, const DiffLine *b, int m, Hunk **out) {
+    int max = DIFF_MAX_EDITS;
+    int offset = max + 1;
+    int *v = (int*)calloc(2 * max + 3, sizeof(int));
+    int *trace = NULL;          // d마다 그 단계 전의 v[-d-1 .. d+1]
+    long long trace_len = 0;
+    int found = -1;
+    for (int d = 0; d <= max && found < 0; d++) {
+        trace = (int*)realloc(trace, sizeof(int) * (trace_len + 2 * d + 3));
+        memcpy(trace + trace_len, v + offset - d - 1, sizeof(int) * (2 * d + 3));
+        trace_len += 2 * d + 3;
+        for (int k = -d; k <= d; k += 2) {
+            int x = (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1])) ? v[offset + k + 1] : v[offset + k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && sameLine(&a[x], &b[y])) {
+                x++;
+                y++;
+            }
+            v[offset + k] = x;
+            if (x >= n && y >= m) {
+                found = d;
+                break;
+            }
+        }
+    }
+    free(v);
+
+    Hunk *hunks = NULL;
+    int count = 0;
+    if (found < 0) {
+        hunks = (Hunk*)malloc(sizeof(Hunk));
+        hunks[0].a0 = 0; hunks[0].a1 = n;
+        hunks[0].b0 = 0; hunks[0].b1 = m;
+        count = 1;
+    } else {
+        // 끝에서부터 되짚으며 편집 하나씩 덩어리로 묶음
+        int x = n, y = m;
+        long long base = trace_len;
+        for (int d = found; d > 0; d--) {
+            base -= 2 * d + 3;
+            const int *vd = trace + base + d + 1;   // vd[k]가 v[k]
+            int k = x - y;
+            int prev_k = (k == -d || (k != d && vd[k - 1] < vd[k + 1])) ? k + 1 : k - 1;
+            int prev_x = vd[prev_k];
+            int prev_y = prev_x - prev_k;
+            while (x > prev_x && y > prev_y) {
+                x--;
+                y--;
+            }
+            // (prev_x, prev_y)에서 (x, y)로: 줄 하나 지움 또는 넣음
+            if (count > 0 && hunks[count - 1].a0 == x && hunks[count - 1].b0 == y) {
+                hunks[count - 1].a0 = prev_x;
+                hunks[count - 1].b0 = prev_y;
+            } else {
+                hunks = (Hunk*)realloc(hunks, sizeof(Hunk) * (count + 1));
+                hunks[count].a0 = prev_x; hunks[count].a1 = x;
+                hunks[count].b0 = prev_y; hunks[count].b1 = y;
+                count++;
+            }
+            x = prev_x;
+            y = prev_y;
+        }
+        for (int i = 0; i < count / 2; i++) {
+            Hunk t = hunks[i];
+            hunks[i] = hunks[count - 1 - i];
+            hunks[count - 1 - i] = t;
+        }
+    }
+    free(trace);
+    *out = hunks;
+    return count;
+}
+
+/* 줄 번호의 가운데 구간 안 바이트 위치 */
+long long lineOffset(const DiffLine *lines, int count, int index, const char *text, long long len) {
+    return index < count ? lines[index].text - text : len;
+}
+
+/* 덧붙은 부분만 읽어 버퍼 끝에 붙이는 함수 */
+void mergeAppend(TextBuffer *tb, Cursor *cursor, int fd, long long from, long long to) {
+    Chain with = {NULL, NULL, 0};
+    char *chunk = (char*)malloc(NODE_MAX_SIZE);
+    for (long long off = from; off < to; off += NODE_MAX_SIZE) {
+        int len = to - off < NODE_MAX_SIZE ? (int)(to - off) : NODE_MAX_SIZE;
+        if (readAt(fd, chunk, len, off) < 0) {
+            break;
+        }
+        chainAppend(tb, &with, chunk, len);
+    }
+    free(chunk);
+    long long pos = cursor->pos;
+    long long at = tb->size;
+    long long len = with.len;
+    Chain old;
+    int was_modified = tb->modified;
+    tb->undo_group++;
+    spliceRange(tb, cursor, at, at, &with, &old);
+    pushUndo(tb, at, len, &old, pos);
+    closeUndo(tb);
+    tb->undo_group++;
+    tb->modified = was_modified;    // 디스크와 같은 내용을 받았을 뿐
+    gotoPosition(tb, cursor, pos);
+    if (tb->page_lines != NULL && tb->index_job == NULL && tb->page_count == (int)((tb->disk_size + NODE_MAX_SIZE - 1) / NODE_MAX_SIZE)) {
+        // 세션 캐시용 줄 색인도 이어 붙임 (마지막 페이지와 새 페이지는 다음에 열 때 셈)
+        int pages = (int)((to + NODE_MAX_SIZE - 1) / NODE_MAX_SIZE);
+        tb->page_lines = (int*)realloc(tb->page_lines, sizeof(int) * pages);
+        for (int i = (int)(tb->disk_size / NODE_MAX_SIZE); i < pages; i++) {
+            tb->page_lines[i] = -1;
+        }
+        tb->page_count = pages;
+    } else {
+        tb->page_count = 0;
+    }
+    setMessage("%s grew on disk: loaded %lld new bytes", tb->filename, len);
+}
+#endif
+
+/* 디스크 변경 반영 함수: 뒤에 덧붙기만 했으면 새 바이트만 읽어 붙이고,
+ * 다시 쓰였으면 기준본과 디스크, 기준본과 버퍼의 줄 단위 차이를 구해 겹치지 않는 덩어리만 버퍼에 적용 */
+void mergeDiskChanges(TextBuffer *tb, Cursor *cursor) {
+#ifndef _WIN32
+    struct stat st;
+    int fd = tb->filename ? open(tb->filename, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) != 0 || (st.st_size == tb->disk_size && statMtime(&st) == tb->disk_mtime
+        && (long long)st.st_ino == tb->disk_inode)) {
+        close(fd);
+        return;
+    }
+    if (tb->gzip) {
+        // 압축된 파일은 바이트 단위로 비교할 수 없음
+        setMessage("%s changed on disk; reopen it to reload", tb->filename);
+        close(fd);
+        rememberBase(tb);
+        return;
+    }
+    long long started = monotonicMs();
+    if ((long long)st.st_ino == tb->disk_inode && st.st_size > tb->disk_size && !tb->crlf
+        && tailHash(fd, tb->disk_size) == tb->disk_tail) {
+        mergeAppend(tb, cursor, fd, tb->disk_size, st.st_size);
+        close(fd);
+        rememberBase(tb);
+        return;
+    }
+    // 기준본: 고치지 않은 버퍼는 그 자체, 아니면 열어 둔 예전 파일 (제자리에서 다시 쓰였다면 잃음)
+    DiffSide ours = {tb, -1, tb->size, NULL};
+    DiffSide base = ours;
+    DiffSide theirs = {NULL, fd, st.st_size, NULL};
+    int in_place = (long long)st.st_ino == tb->disk_inode;
+    if (in_place && tb->source_fd >= 0) {
+        // 아직 읽지 않은 페이지가 바뀐 내용을 가리킴
+        setMessage("%s was rewritten in place; reopen it to reload", tb->filename);
+        close(fd);
+        return;
+    }
+    if (tb->modified) {
+        if (in_place || tb->base_fd < 0) {
+            setMessage("%s changed on disk; keeping your edits (no base to merge with)", tb->filename);
+            close(fd);
+            return;
+        }
+        base.tb = NULL;
+        base.fd = tb->base_fd;
+        base.size = tb->disk_size;
+    }
+    if (tb->crlf || tb->bom) {
+        // 버퍼는 BOM과 '\r'을 뗀 내용이므로 디스크 쪽도 같은 형식으로 읽어 비교
+        theirs.text = readNormalized(tb, fd, &theirs.size);
+        if (tb->modified) {
+            base.text = readNormalized(tb, base.fd, &base.size);
+        }
+        if (theirs.text == NULL || (tb->modified && base.text == NULL)) {
+            setMessage("%s changed on disk; could not read it", tb->filename);
+            free(theirs.text);
+            free(base.text);
+            close(fd);
+            return;
+        }
+    }
+
+    // 세 내용에 공통인 앞뒤는 건너뛰고 가운데만 읽어 비교
+    long long prefix = commonPrefix(&base, &theirs);
+    if (tb->modified) {
+        long long p = commonPrefix(&base, &ours);
+        if (p < prefix) prefix = p;
+    }
+    long long suffix = commonSuffix(&base, &theirs, prefix);
+    if (tb->modified) {
+        long long q = commonSuffix(&base, &ours, prefix);
+        if (q < suffix) suffix = q;
+    }
+    long long base_len = base.size - prefix - suffix;
+    long long their_len = theirs.size - prefix - suffix;
+    long long our_len = ours.size - prefix - suffix;
+    if (base_len > DIFF_MAX_BYTES || their_len > DIFF_MAX_BYTES || our_len > DIFF_MAX_BYTES) {
+        setMessage("%s changed on disk; too much changed to merge", tb->filename);
+        free(theirs.text);
+        free(base.text);
+        close(fd);
+        return;
+    }
+    char *base_text = (char*)malloc(base_len + 1);
+    char *their_text = (char*)malloc(their_len + 1);
+    char *our_text = tb->modified ? (char*)malloc(our_len + 1) : base_text;
+    if (readSide(&base, base_text, prefix, (int)base_len) < 0 || readSide(&theirs, their_text, prefix, (int)their_len) < 0
+        || (tb->modified && readSide(&ours, our_text, prefix, (int)our_len) < 0)) {
+        setMessage("%s changed on disk; could not read it", tb->filename);
+        free(base_text);
+        free(their_text);
+        if (tb->modified) free(our_text);
+        free(theirs.text);
+        free(base.text);
+        close(fd);
+        return;
+    }
+    DiffLine *base_lines, *their_lines, *our_lines;
+    int base_count = splitDiffLines(base_text, base_len, &base_lines);
+    int their_count = splitDiffLines(their_text, their_len, &their_lines);
+    int our_count = tb->modified ? splitDiffLines(our_text, our_len, &our_lines) : base_count;
+    if (!tb->modified) {
+        our_lines = base_lines;
+    }
+    Hunk *theirs_hunks, *ours_hunks = NULL;
+    int theirs_count = diffLines(base_lines, base_count, their_lines, their_count, &theirs_hunks);
+    int ours_count = tb->modified ? diffLines(base_lines, base_count, our_lines, our_count, &ours_hunks) : 0;
+
+    // 뒤쪽 덩어리부터 적용해 앞쪽 위치가 바뀌지 않게 함
+    long long pos = cursor->pos;
+    int was_modified = tb->modified;
+    int applied = 0, conflicts = 0;
+    long long changed_lines = 0;
+    tb->undo_group++;
+    for (int i = theirs_count - 1; i >= 0; i--) {
+        Hunk *h = &theirs_hunks[i];
+        int delta = 0;
+        int conflict = 0;
+        for (int j = 0; j < ours_count; j++) {
+            Hunk *g = &ours_hunks[j];
+            if (h->a0 <= g->a1 && g->a0 <= h->a1) {
+                conflict = 1;   // 같은 곳(맞닿은 곳 포함)을 양쪽이 고침: 버퍼 쪽을 남김
+                break;
+            }
+            if (g->a1 <= h->a0) {
+                delta += (g->b1 - g->b0) - (g->a1 - g->a0);
+            }
+        }
+        if (conflict) {
+            conflicts++;
+            continue;
+        }
+        long long start = prefix + lineOffset(our_lines, our_count, h->a0 + delta, our_text, our_len);
+        long long end = prefix + lineOffset(our_lines, our_count, h->a1 + delta, our_text, our_len);
+        long long from = lineOffset(their_lines, their_count, h->b0, their_text, their_len);
+        long long to = lineOffset(their_lines, their_count, h->b1, their_text, their_len);
+        Chain with = {NULL, NULL, 0};
+        Chain old;
+        chainAppend(tb, &with, their_text + from, to - from);
+        spliceRange(tb, cursor, start, end, &with, &old);
+        pushUndo(tb, start, to - from, &old, pos);
+        pos = shiftPosition(pos, start, end, to - from);
+        applied++;
+        changed_lines += (h->a1 - h->a0) + (h->b1 - h->b0);
+    }
+    closeUndo(tb);
+    tb->undo_group++;
+    tb->modified = was_modified;    // 고치지 않은 버퍼는 이제 디스크와 같음
+    gotoPosition(tb, cursor, pos);
+    trimResident(tb, cursor->current);
+    tb->page_count = 0;     // 페이지별 줄 수는 예전 내용의 것
+    if (conflicts > 0) {
+        setMessage("%s changed on disk: merged %d hunk%s, %d conflict%s kept as yours (%lld ms)", tb->filename,
+            applied, applied == 1 ? "" : "s", conflicts, conflicts == 1 ? "" : "s", monotonicMs() - started);
+    } else {
+        setMessage("%s changed on disk: merged %d hunk%s, %lld lines (%lld ms)", tb->filename,
+            applied, applied == 1 ? "" : "s", changed_lines, monotonicMs() - started);
+    }
+
+    free(theirs_hunks);
+    free(ours_hunks);
+    free(base_lines);
+    free(their_lines);
+    free(base_text);
+    free(their_text);
+    if (was_modified) {
+        free(our_lines);
+        free(our_text);
+    }
+    free(theirs.text);
+    free(base.text);
+    close(fd);
+    rememberBase(tb);
+#else
+    (void)tb;
+    (void)cursor;
+#endif
+}
+
+/* 스냅샷 자식의 zlib 할당 함수: 정적 영역에서 잘라 줌 (fork 뒤에는 malloc을 쓰지 않음) */
+static char snapshot_arena[SNAPSHOT_ARENA_SIZE];
+static size_t snapshot_used;
+
+voidpf arenaAlloc(voidpf opaque, uInt items, uInt size) {
+    (void)opaque;
+    size_t n = ((size_t)items * size + 15) & ~(size_t)15;
+    if (snapshot_used + n > sizeof(snapshot_arena)) {
+        return Z_NULL;
+    }
+    voidpf p = snapshot_arena + snapshot_used;
+    snapshot_used += n;
+    return p;
+}
+
+void arenaFree(voidpf opaque, voidpf p) {
+    (void)opaque;
+    (void)p;    // 자식은 곧 끝나므로 돌려받지 않음
+}
+
+/* 스냅샷 조각 쓰기 함수 (zs가 있으면 압축해서 씀, Z_FINISH면 gzip 꼬리까지) */
+int writeSnapshotChunk(z_stream *zs, int fd, const char *data, int len, int flush) {
+    static char out[NODE_MAX_SIZE];
+    if (zs == NULL) {
+        return writeAll(fd, data, len);
+    }
+    zs->next_in = (Bytef*)data;
+    zs->avail_in = (uInt)len;
+    do {
+        zs->next_out = (Bytef*)out;
+        zs->avail_out = sizeof(out);
+        if (deflate(zs, flush) == Z_STREAM_ERROR) {
+            return -1;
+        }
+        if (writeAll(fd, out, sizeof(out) - zs->avail_out) < 0) {
+            return -1;
+        }
+    } while (zs->avail_out == 0);
+    return 0;
+}
+
+/* 스냅샷 기록 함수: fork된 자식에서 실행되므로 malloc, stdio 없이 write만 사용 */
+int writeSnapshot(TextBuffer *tb, int fd) {
+    static char unpacked[NODE_MAX_SIZE];    // 압축된 노드를 풀 자리 (자식에서 malloc 금지)
+    static char expanded[2 * NODE_MAX_SIZE];    // '\n'을 "\r\n"으로 되돌릴 자리
+    z_stream stream;
+    z_stream *zs = NULL;
+    if (tb->gzip) {
+        memset(&stream, 0, sizeof(stream));
+        stream.zalloc = arenaAlloc;
+        stream.zfree = arenaFree;
+        if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return -1;
+        }
+        zs = &stream;
+    }
+    if (tb->bom && writeSnapshotChunk(zs, fd, "\xef\xbb\xbf", 3, Z_NO_FLUSH) < 0) {
+        return -1;
+    }
+    for (Node *temp = tb->head; temp != NULL; temp = temp->next) {
+        const char *data = temp->data;
+        if (data == NULL) {
+            // 압축본, 스크래치 파일, 원본 파일 어디에 있든 pread/압축 해제만으로 채움
+            if (readNodeInto(tb, temp, unpacked) < 0) {
+                return -1;
+            }
+            data = unpacked;
+        }
+        int len = temp->len;
+        if (tb->crlf) {
+            len = expandNewlines(data, len, expanded);
+            data = expanded;
+        }
+        if (writeSnapshotChunk(zs, fd, data, len, Z_NO_FLUSH) < 0) {
+            return -1;
+        }
+    }
+    if (zs != NULL && writeSnapshotChunk(zs, fd, "", 0, Z_FINISH) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* 저장 완료 처리 함수 (메인 스레드에서 실행) */
+void finishSave(void *arg) {
+    SaveJob *job = (SaveJob*)arg;
+    TextBuffer *tb = job->tb;
+    loop.save_job = NULL;
+
+    if (job->status != 0) {
+        setMessage("Failed to save %s", job->path);
+    } else if (!job->autosave) {
+        // 스냅샷 이후에 편집이 없었을 때만 수정 플래그를 내림
+        if (tb->version == job->version) {
+            tb->modified = 0;
+            clearAutosave(tb);
+        }
+        rememberFileState(job->path);
+        if (tb->filename != NULL && strcmp(job->path, tb->filename) == 0) {
+            tb->page_count = 0;
+            rememberBase(tb);
+        }
+        setMessage("Saved %s (%lld bytes, %lld ms)%s", job->path, loop.known_size,
+            monotonicMs() - job->started, tb->modified ? " - edited since snapshot" : "");
+    }
+    free(job->path);
+    free(job);
+
+    if (loop.save_again) {
+        loop.save_again = 0;
+        saveFileAsync(tb);
+    }
+}
+
+#ifndef _WIN32
+/* 자식 프로세스 종료를 기다렸다가 메인 루프에 알리는 스레드 */
+void *saveWaiter(void *arg) {
+    SaveJob *job = (SaveJob*)arg;
+    if (job->copy_fd >= 0) {
+        // 제자리 쓰기: 원본을 옮겨 끼운 뒤에야 자식이 파일을 자름 (편집 스레드는 기다리지 않음)
+        char go = copySource(job->source_fd, job->copy_fd) == 0;
+        close(job->copy_fd);
+        if (write(job->go_fd, &go, 1) < 0) {
+            // 자식이 이미 끝났으면 종료 상태로 실패가 드러남
+        }
+        close(job->go_fd);
+    }
+    int wstatus = 0;
+    pid_t r;
+    while ((r = waitpid(job->pid, &wstatus, 0)) < 0 && errno == EINTR) {
+    }
+    job->status = (r == job->pid && WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0) ? 0 : -1;
+    postEvent(finishSave, job);
+    return NULL;
+}
+#endif
+
+/* 백그라운드 저장 시작 함수
+ * fork한 자식이 copy-on-write로 공유된 노드 리스트를 임시 파일에 쓰고 rename 하므로
+ * 부모는 fork 비용만 치르고 바로 편집을 이어감 */
+void startSave(TextBuffer *tb, const char *path, int autosave) {
+    waitForGunzip(tb);      // 덜 풀린 gzip 버퍼를 쓰면 내용이 잘림
+    SaveJob *job = (SaveJob*)calloc(1, sizeof(SaveJob));
+    job->tb = tb;
+    job->path = strdup(path);
+    job->version = tb->version;
+    job->autosave = autosave;
+    job->started = monotonicMs();
+    loop.save_job = job;
+
+#ifdef _WIN32
+    // fork가 없으므로 동기 저장으로 대신함
+    job->status = writeBuffer(tb, path);
+    finishSave(job);
+#else
+    char target[4096];
+    char temp[4096];
+    int fd = openSaveTarget(tb, path, target, temp, &job->copy_fd);
+    int go[2] = {-1, -1};
+    if (fd >= 0 && job->copy_fd >= 0 && pipe(go) < 0) {
+        close(job->copy_fd);
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        job->status = -1;
+        finishSave(job);
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (go[0] >= 0) {
+            // 원본을 다 옮겼다는 알림을 받기 전에는 대상 파일을 건드리지 않음
+            char ready = 0;
+            close(go[1]);
+            while (read(go[0], &ready, 1) < 0 && errno == EINTR) {
+            }
+            // 자식의 fd 표는 따로이므로 원본 페이지도 사본에서 읽도록 여기서도 끼움
+            if (!ready || dup2(job->copy_fd, tb->source_fd) < 0) {
+                _exit(1);
+            }
+        }
+        int ok = (temp[0] != '\0' || ftruncate(fd, 0) == 0) && writeSnapshot(tb, fd) == 0 && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        _exit(commitSaveTarget(target, temp, ok) == 0 ? 0 : 1);
+    }
+    close(fd);
+    if (go[0] >= 0) {
+        close(go[0]);
+    }
+    if (pid < 0) {
+        if (go[1] >= 0) {
+            close(go[1]);
+            close(job->copy_fd);
+        }
+        commitSaveTarget(target, temp, 0);
+        job->status = -1;
+        finishSave(job);
+        return;
+    }
+    job->pid = pid;
+    job->source_fd = tb->source_fd;
+    job->go_fd = go[1];
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, saveWaiter, job);
+    pthread_detach(thread);
+#endif
+}
+
+/* 비동기 파일 저장 함수 (Ctrl-S) */
+void saveFileAsync(TextBuffer *tb) {
+    if (tb->filename == NULL) {
+        return;
+    }
+    if (loop.save_job != NULL) {
+        // 진행 중인 저장이 끝나면 최신 내용으로 한 번 더 저장
+        loop.save_again = 1;
+        setMessage("Save in progress...");
+        return;
+    }
+    startSave(tb, tb->filename, 0);
+    if (loop.save_job != NULL) {
+        setMessage("Saving %s...", tb->filename);
+    }
+}
+
+/* 진행 중인 저장이 끝날 때까지 기다리는 함수 (종료 직전) */
+void waitForSave(void) {
+    while (loop.save_job != NULL) {
+        while (readKey() != ERR) {
+            // 종료 중에 들어온 키는 버림
+        }
+        dispatchBackground(loop.tb, pollEvents());
+    }
+}
+
+/* 자동 저장 타이머 콜백 */
+void autosaveTimer(void *arg) {
+    TextBuffer *tb = (TextBuffer*)arg;
+    loop.autosave_timer = -1;
+    if (tb->modified && tb->filename && loop.save_job == NULL) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s%s", tb->filename, AUTOSAVE_SUFFIX);
+        startSave(tb, path, 1);
+    }
+}
+
+/* 창 크기 변경 타이머 콜백: 잠잠해진 뒤 화면을 한 번만 다시 배치
+ * 첫 줄 위치(top_pos)는 그대로 두므로 보던 줄이 화면 맨 위에 남고, 커서가 밀려나면 그리면서 맞춤 */
+void resizeTimer(void *arg) {
+    (void)arg;
+    loop.resize_timer = -1;
+    TextBuffer *tb = loop.tb;
+    if (tb != NULL) {
+        tb->hex_top -= tb->hex_top % hexRowBytes();
+    }
+    clearok(curscr, TRUE);  // 옛 크기로 남은 터미널 내용은 믿지 않고 전부 다시 씀
+    loop.dirty = 1;
+}
+
+/* 창 크기 변경을 받는 함수: 연달아 오면 타이머만 미뤄서 마지막 크기로 한 번만 그림 */
+void scheduleResize(void) {
+    cancelTimer(loop.resize_timer);
+    loop.resize_timer = addTimer(RESIZE_DEBOUNCE_MS, resizeTimer, NULL);
+    if (loop.resize_timer < 0) {
+        resizeTimer(NULL);  // 타이머 자리가 없으면 바로 반영
+    }
+}
+
+/* 수정된 버퍼에 자동 저장을 예약하는 함수 */
+void scheduleAutosave(TextBuffer *tb) {
+    if (tb->modified && tb->filename && loop.autosave_timer < 0) {
+        loop.autosave_timer = addTimer(AUTOSAVE_INTERVAL_MS, autosaveTimer, tb);
+    }
+}
+
+/* 자동 저장 파일 정리 함수 (정상 저장 후 호출) */
+void clearAutosave(TextBuffer *tb) {
+    cancelTimer(loop.autosave_timer);
+    loop.autosave_timer = -1;
+    if (tb->filename) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s%s", tb->filename, AUTOSAVE_SUFFIX);
+        remove(path);
+    }
+}
+
+/* 외부 명령 작업 정리 함수 */
+void closePipe(PipeJob *job) {
+#ifndef _WIN32
+    if (job->in_fd >= 0) close(job->in_fd);
+    if (job->out_fd >= 0) close(job->out_fd);
+    if (job->err_fd >= 0) close(job->err_fd);
+#endif
+    chainFree(&job->output);
+    free(job);
+    loop.pipe_job = NULL;
+    loop.dirty = 1;
+}
+
+/* 받은 출력으로 범위를 한 번에 교체하는 함수 */
+void applyPipe(TextBuffer *tb, PipeJob *job) {
+    Cursor *cursor = loop.cursor;
+    long long cursor_before = cursor->pos;
+    long long len = job->output.len;
+    Chain old;
+    spliceRange(tb, cursor, job->start, job->end, &job->output, &old);
+    pushUndo(tb, job->start, len, &old, cursor_before);
+    closeUndo(tb);
+    gotoPosition(tb, cursor, job->start);
+    trimResident(tb, cursor->current);
+    if (job->error_len > 0) {
+        setMessage("Piped %lld bytes through '%s' -> %lld bytes: %s",
+            job->end - job->start, job->command, len, job->errors);
+    } else {
+        setMessage("Piped %lld bytes through '%s' -> %lld bytes (exit %d, %lld ms)",
+            job->end - job->start, job->command, len, job->code, monotonicMs() - job->started);
+    }
+    closePipe(job);
+}
+
+/* 외부 명령 완료 처리 함수: 성공하면 바로 교체하고, 실패하면 확인을 기다림 */
+void finishPipe(TextBuffer *tb, PipeJob *job) {
+#ifndef _WIN32
+    int wstatus = 0;
+    while (waitpid(job->pid, &wstatus, 0) < 0 && errno == EINTR) {
+    }
+    job->code = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus)
+        : WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus) : 255;
+    // stderr는 한 줄로 접어 메시지 바에 보여 줌
+    while (job->error_len > 0 && (unsigned char)job->errors[job->error_len - 1] <= ' ') {
+        job->error_len--;
+    }
+    job->errors[job->error_len] = '\0';
+    for (int i = 0; i < job->error_len; i++) {
+        if ((unsigned char)job->errors[i] < ' ') {
+            job->errors[i] = ' ';
+        }
+    }
+    if (job->code == 0) {
+        applyPipe(tb, job);
+        return;
+    }
+    const char *errors = job->error_len > 0 ? job->errors : "no error output";
+    if (job->output.len == 0) {
+        setMessage("'%s' failed (exit %d): %s", job->command, job->code, errors);
+        closePipe(job);
+        return;
+    }
+    // 오류 메시지로 영역을 덮어쓰지 않도록 사용자가 고를 때까지 출력을 들고 있음
+    setMessage("'%s' failed (exit %d): %s -- replace region anyway? (y/N)", job->command, job->code, errors);
+#endif
+}
+
+/* 실패한 외부 명령의 출력으로 바꿀지 묻는 키 처리 함수 (y만 교체, 나머지는 버림) */
+void confirmPipe(TextBuffer *tb, int ch) {
+    PipeJob *job = loop.pipe_job;
+    if (ch == 'y' || ch == 'Y') {
+        applyPipe(tb, job);
+    } else {
+        setMessage("'%s' failed (exit %d), region unchanged", job->command, job->code);
+        closePipe(job);
+    }
+}
+
+/* 자식 fd 하나에서 읽을 수 있는 만큼 읽는 함수 (EOF면 닫고 -1로 바꿈) */
+void drainPipe(TextBuffer *tb, PipeJob *job, int *fd) {
+#ifndef _WIN32
+    char buf[PIPE_CHUNK];
+    while (*fd >= 0) {
+        ssize_t n = read(*fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            break;  // 다음 poll까지 기다림
+        }
+        if (n <= 0) {
+            close(*fd);
+            *fd = -1;
+            break;
+        }
+        if (fd == &job->out_fd) {
+            chainAppend(tb, &job->output, buf, n);
+        } else {
+            // stderr는 앞부분만 남기고 나머지는 읽어 버림 (자식이 막히지 않도록)
+            int k = (int)sizeof(job->errors) - 1 - job->error_len;
+            if (k > n) k = (int)n;
+            memcpy(job->errors + job->error_len, buf, k);
+            job->error_len += k;
+        }
+    }
+#endif
+}
+
+/* 외부 명령 입출력 함수 (이벤트 루프에서 fd가 준비될 때마다 호출)
+ * 보낼 수 있는 만큼 보내고 읽을 수 있는 만큼 읽으므로 어느 쪽도 막히지 않음 */
+void pumpPipe(TextBuffer *tb) {
+#ifndef _WIN32
+    PipeJob *job = loop.pipe_job;
+    if (job == NULL || job->code >= 0) {
+        return;
+    }
+    // 범위를 노드 단위로 잘라 자식 stdin에 씀
+    while (job->in_fd >= 0) {
+        long long left = job->end - job->feed.pos;
+        if (left <= 0 || !normalizeForward(&job->feed)) {
+            close(job->in_fd);
+            job->in_fd = -1;    // EOF를 알려야 sort 같은 명령이 출력을 시작함
+            break;
+        }
+        long long k = job->feed.current->len - job->feed.offset;
+        if (k > left) k = left;
+        if (k > PIPE_CHUNK) k = PIPE_CHUNK;
+        ssize_t n = write(job->in_fd, nodeData(tb, job->feed.current) + job->feed.offset, k);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            break;
+        }
+        if (n < 0) {
+            // 자식이 입력을 닫음 (head 등): 남은 입력은 버리고 출력만 받음
+            close(job->in_fd);
+            job->in_fd = -1;
+            break;
+        }
+        job->feed.offset += (int)n;
+        job->feed.pos += n;
+        trimResident(tb, job->feed.current);
+    }
+    // 자식 출력은 새 사슬에 이어 붙이고, stderr는 따로 모음
+    drainPipe(tb, job, &job->out_fd);
+    drainPipe(tb, job, &job->err_fd);
+    if (job->out_fd < 0 && job->err_fd < 0) {
+        finishPipe(tb, job);
+        return;
+    }
+    long long now = monotonicMs();
+    if (now - job->reported >= PIPE_REPORT_MS) {
+        job->reported = now;
+        setMessage("Piping through '%s': sent %lld/%lld bytes, received %lld (Esc to cancel)",
+            job->command, job->feed.pos - job->start, job->end - job->start, job->output.len);
+        loop.dirty = 1;
+    }
+#endif
+}
+
+/* 외부 명령 취소 함수 (Esc) */
+void cancelPipe(void) {
+#ifndef _WIN32
+    PipeJob *job = loop.pipe_job;
+    if (job->code < 0) {
+        // 이미 끝나 거둔 자식은 다시 죽이지 않음
+        kill(-job->pid, SIGTERM);
+        while (waitpid(job->pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+    }
+    closePipe(job);
+    setMessage("Pipe cancelled");
+#endif
+}
+
+/* 입력받은 외부 명령에 영역을 통과시키는 함수 */
+void pipeAnswer(TextBuffer *tb, Cursor *cursor, const char *command) {
+    if (command != NULL && command[0] != '\0') {
+        commandPipe(tb, cursor, command);
+    }
+}
+
+/* 영역(없으면 버퍼 전체)의 줄을 외부 명령에 통과시켜 그 출력으로 바꾸는 명령 (인자가 없으면 물음) */
+void commandPipe(TextBuffer *tb, Cursor *cursor, const char *arg) {
+#ifndef _WIN32
+    char command[256];
+    if (arg[0] == '\0') {
+        openPrompt("Pipe through: ", sizeof(command), NULL, 0, pipeAnswer);
+        return;
+    }
+    snprintf(command, sizeof(command), "%s", arg);
+    long long start, end;
+    lineRange(tb, cursor, &start, &end);
+    tb->mark = -1;
+
+    // stderr는 따로 받아 출력에 섞이지 않게 함 (jq 오류 메시지가 영역을 덮어쓰지 않도록)
+    int to_child[2], from_child[2], err_child[2];
+    if (pipe(to_child) < 0) {
+        setMessage("Cannot create pipe");
+        return;
+    }
+    if (pipe(from_child) < 0) {
+        close(to_child[0]);
+        close(to_child[1]);
+        setMessage("Cannot create pipe");
+        return;
+    }
+    if (pipe(err_child) < 0) {
+        close(to_child[0]);
+        close(to_child[1]);
+        close(from_child[0]);
+        close(from_child[1]);
+        setMessage("Cannot create pipe");
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);  // 취소할 때 셸이 띄운 프로세스까지 함께 종료하도록
+        dup2(to_child[0], STDIN_FILENO);
+        dup2(from_child[1], STDOUT_FILENO);
+        dup2(err_child[1], STDERR_FILENO);
+        close(to_child[0]);
+        close(to_child[1]);
+        close(from_child[0]);
+        close(from_child[1]);
+        close(err_child[0]);
+        close(err_child[1]);
+        execl("/bin/sh", "sh", "-c", command, (char*)NULL);
+        _exit(127);
+    }
+    if (pid > 0) {
+        setpgid(pid, pid);
+    }
+    close(to_child[0]);
+    close(from_child[1]);
+    close(err_child[1]);
+    if (pid < 0) {
+        close(to_child[1]);
+        close(from_child[0]);
+        close(err_child[0]);
+        setMessage("Cannot start '%s'", command);
+        return;
+    }
+    // 부모 쪽 끝은 논블로킹으로 두고 이벤트 루프에서 주고받음
+    fcntl(to_child[1], F_SETFL, O_NONBLOCK);
+    fcntl(from_child[0], F_SETFL, O_NONBLOCK);
+    fcntl(err_child[0], F_SETFL, O_NONBLOCK);
+    fcntl(to_child[1], F_SETFD, FD_CLOEXEC);
+    fcntl(from_child[0], F_SETFD, FD_CLOEXEC);
+    fcntl(err_child[0], F_SETFD, FD_CLOEXEC);
+
+    PipeJob *job = (PipeJob*)calloc(1, sizeof(PipeJob));
+    snprintf(job->command, sizeof(job->command), "%s", command);
+    job->start = start;
+    job->end = end;
+    seekPosition(tb, &job->feed, start);
+    job->in_fd = to_child[1];
+    job->out_fd = from_child[0];
+    job->err_fd = err_child[0];
+    job->code = -1;
+    job->pid = pid;
+    job->started = monotonicMs();
+    loop.pipe_job = job;
+    pumpPipe(tb);
+#else
+    setMessage("Pipe is not supported on this platform");
+#endif
+}
+
+#ifndef _WIN32
+/* 검색할 파일 경로를 큐에 넣는 함수 (순회 스레드) */
+void queueGrepFile(GrepJob *job, char *path) {
+    pthread_mutex_lock(&job->lock);
+    if (job->queue_head + job->queue_count == job->queue_cap) {
+        // 앞쪽의 처리된 자리를 당겨 쓰고, 그래도 모자라면 늘림
+        if (job->queue_head > 0) {
+            memmove(job->queue, job->queue + job->queue_head, sizeof(char*) * job->queue_count);
+            job->queue_head = 0;
+        }
+        if (job->queue_count == job->queue_cap) {
+            job->queue_cap = job->queue_cap ? job->queue_cap * 2 : 1024;
+            job->queue = (char**)realloc(job->queue, sizeof(char*) * job->queue_cap);
+        }
+    }
+    job->queue[job->queue_head + job->queue_count++] = path;
+    pthread_cond_signal(&job->ready);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* 디렉터리 트리 순회 함수: 숨김 항목과 심볼릭 링크는 건너뜀 */
+void walkTree(GrepJob *job, const char *dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL && !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED)) {
+        if (entry->d_name[0] == '.') {
+            continue;   // ., .., .git 같은 숨김 디렉터리
+        }
+        char path[4096];
+        if (strcmp(dir, ".") == 0) {
+            snprintf(path, sizeof(path), "%s", entry->d_name);
+        } else {
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        }
+        int type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(path, &st) < 0) {
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+        }
+        if (type == DT_DIR) {
+            walkTree(job, path);
+        } else if (type == DT_REG) {
+            queueGrepFile(job, strdup(path));
+        }
+    }
+    closedir(d);
+}
+
+/* 순회 스레드 */
+void *grepWalker(void *arg) {
+    GrepJob *job = (GrepJob*)arg;
+    walkTree(job, job->root);
+    pthread_mutex_lock(&job->lock);
+    job->walking = 0;
+    pthread_cond_broadcast(&job->ready);
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/* 워커가 찾은 결과를 메인 루프에서 목록에 붙이는 함수 */
+void grepDeliver(void *arg) {
+    GrepBatch *batch = (GrepBatch*)arg;
+    GrepJob *job = batch->job;
+    int i = 0;
+    if (job->hit_count < GREP_MAX_RESULTS) {
+        if (job->file_count == job->file_cap) {
+            job->file_cap = job->file_cap ? job->file_cap * 2 : 64;
+            job->files = (char**)realloc(job->files, sizeof(char*) * job->file_cap);
+        }
+        job->files[job->file_count] = batch->path;
+        batch->path = NULL;
+        for (; i < batch->count && job->hit_count < GREP_MAX_RESULTS; i++) {
+            if (job->hit_count == job->hit_cap) {
+                job->hit_cap = job->hit_cap ? job->hit_cap * 2 : 256;
+                job->hits = (GrepHit*)realloc(job->hits, sizeof(GrepHit) * job->hit_cap);
+            }
+            batch->hits[i].file = job->file_count;
+            job->hits[job->hit_count++] = batch->hits[i];
+        }
+        job->file_count++;
+        if (job->hit_count == GREP_MAX_RESULTS) {
+            job->truncated = 1;
+            __atomic_store_n(&job->cancel, 1, __ATOMIC_RELAXED);
+        }
+    }
+    for (; i < batch->count; i++) {
+        free(batch->hits[i].text);
+    }
+    free(batch->path);
+    free(batch->hits);
+    free(batch);
+    loop.dirty = 1;
+}
+
+/* 결과 한 줄 추가 함수 (워커) */
+void addGrepHit(GrepBatch *batch, long long line, const char *start, const char *end, long long offset) {
+    if (batch->count == batch->cap) {
+        batch->cap = batch->cap ? batch->cap * 2 : 16;
+        batch->hits = (GrepHit*)realloc(batch->hits, sizeof(GrepHit) * batch->cap);
+    }
+    int len = end - start < GREP_TEXT ? (int)(end - start) : GREP_TEXT;
+    char *text = (char*)malloc(len + 1);
+    for (int i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char)start[i];
+        text[i] = ch == '\t' ? ' ' : (ch < 32 || ch == 127) ? '.' : (char)ch;
+    }
+    text[len] = '\0';
+    GrepHit *hit = &batch->hits[batch->count++];
+    hit->file = -1;
+    hit->line = line;
+    hit->offset = offset;
+    hit->text = text;
+}
+
+/* 구간의 줄바꿈 수 (int 범위를 넘는 구간은 나눠 셈) */
+long long countNewlinesLong(const char *p, long long len) {
+    long long n = 0;
+    while (len > 0) {
+        int k = len > (1 << 30) ? 1 << 30 : (int)len;
+        n += countNewlines(p, k);
+        p += k;
+        len -= k;
+    }
+    return n;
+}
+
+/* 파일 하나 검색 함수 (워커): 통째로 mmap해 memmem으로 찾고 줄 번호는 일치 사이의 줄바꿈만 셈
+ * 앞부분에 NUL 바이트가 있으면 이진 파일로 보고 건너뜀 */
+void grepFile(GrepJob *job, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    if (st.st_size > job->max_size) {
+        close(fd);
+        __atomic_add_fetch(&job->skipped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    long long size = st.st_size;
+    char *base = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return;
+    }
+    madvise(base, size, MADV_SEQUENTIAL);
+    if (memchr(base, 0, size < GREP_PROBE ? size : GREP_PROBE) != NULL) {
+        munmap(base, size);
+        __atomic_add_fetch(&job->skipped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    GrepBatch *batch = (GrepBatch*)calloc(1, sizeof(GrepBatch));
+    batch->job = job;
+    const char *end = base + size;
+    const char *p = base;
+    const char *counted = base;     // 여기까지의 줄바꿈은 line에 반영됨
+    long long line = 1;
+    while (end - p >= job->query_len && !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED)) {
+        // 한 조각 안에서 시작하는 일치만 찾고 다음 조각으로 (조각마다 취소 확인)
+        long long span = end - p < GREP_SLICE + job->query_len ? end - p : GREP_SLICE + job->query_len - 1;
+        const char *m = (const char*)memmem(p, span, job->query, job->query_len);
+        if (m == NULL) {
+            p += span - (job->query_len - 1);
+            continue;
+        }
+        line += countNewlinesLong(counted, m - counted);
+        counted = m;
+        const char *start = m;
+        while (start > base && start[-1] != '\n') {
+            start--;
+        }
+        const char *stop = (const char*)memchr(m, '\n', end - m);
+        if (stop == NULL) {
+            stop = end;
+        }
+        addGrepHit(batch, line, start, stop, start - base);
+        p = stop < end ? stop + 1 : end;    // 한 줄에서는 한 번만
+        if (batch->count == GREP_BATCH) {
+            // 결과가 많은 파일은 나눠 넘겨 목록이 바로 늘어나게 함
+            GrepBatch *next = (GrepBatch*)calloc(1, sizeof(GrepBatch));
+            next->job = job;
+            batch->path = strdup(path);
+            postEvent(grepDeliver, batch);
+            batch = next;
+        }
+    }
+    munmap(base, size);
+    __atomic_add_fetch(&job->files_scanned, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&job->bytes_scanned, size, __ATOMIC_RELAXED);
+    if (batch->count > 0) {
+        batch->path = strdup(path);
+        postEvent(grepDeliver, batch);
+    } else {
+        free(batch);
+    }
+}
+
+/* 검색 완료 처리 함수 (마지막 워커가 넘김): 스레드를 거두고 결과 목록만 남김 */
+void grepFinish(void *arg) {
+    GrepJob *job = (GrepJob*)arg;
+    for (int i = 0; i < job->thread_count; i++) {
+        pthread_join(job->threads[i], NULL);
+    }
+    for (int i = 0; i < job->queue_count; i++) {
+        free(job->queue[job->queue_head + i]);
+    }
+    free(job->queue);
+    job->queue = NULL;
+    job->queue_count = 0;
+    job->running = 0;
+    job->elapsed = monotonicMs() - job->started;
+    cancelTimer(job->timer);
+    job->timer = -1;
+    loop.dirty = 1;
+}
+
+/* 검색 워커: 큐가 빌 때까지 파일을 하나씩 꺼내 검색 */
+void *grepWorker(void *arg) {
+    GrepJob *job = (GrepJob*)arg;
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        while (job->queue_count == 0 && job->walking && !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED)) {
+            pthread_cond_wait(&job->ready, &job->lock);
+        }
+        if (job->queue_count == 0 || __atomic_load_n(&job->cancel, __ATOMIC_RELAXED)) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        char *path = job->queue[job->queue_head++];
+        job->queue_count--;
+        pthread_mutex_unlock(&job->lock);
+        grepFile(job, path);
+        free(path);
+    }
+    pthread_mutex_lock(&job->lock);
+    int last = --job->active == 0;
+    pthread_mutex_unlock(&job->lock);
+    if (last) {
+        postEvent(grepFinish, job);
+    }
+    return NULL;
+}
+
+/* 진행 표시 갱신 타이머 */
+void grepTick(void *arg) {
+    GrepJob *job = (GrepJob*)arg;
+    loop.dirty = 1;
+    job->timer = addTimer(PIPE_REPORT_MS, grepTick, job);
+}
+
+/* 검색 취소 함수 (결과는 그때까지 찾은 만큼 남음) */
+void cancelGrep(GrepJob *job) {
+    pthread_mutex_lock(&job->lock);
+    __atomic_store_n(&job->cancel, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&job->ready);
+    pthread_mutex_unlock(&job->lock);
+}
+#endif
+
+/* 파일 검색 해제 함수 (끝난 검색만) */
+void freeGrep(GrepJob *job) {
+#ifndef _WIN32
+    for (int i = 0; i < job->file_count; i++) {
+        free(job->files[i]);
+    }
+    for (int i = 0; i < job->hit_count; i++) {
+        free(job->hits[i].text);
+    }
+    free(job->files);
+    free(job->hits);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->ready);
+    if (loop.grep == job) {
+        loop.grep = NULL;
+    }
+    free(job);
+    loop.dirty = 1;
+#endif
+}
+
+/* 종료 전에 진행 중인 파일 검색을 멈추고 해제하는 함수 */
+void stopGrep(void) {
+#ifndef _WIN32
+    GrepJob *job = loop.grep;
+    if (job == NULL) {
+        return;
+    }
+    if (job->running) {
+        cancelGrep(job);
+        while (job->running) {
+            dispatchBackground(loop.tb, pollEvents());
+        }
+    }
+    freeGrep(job);
+#endif
+}
+
+/* 파일 검색 명령: grep <text>
+ * 현재 디렉터리(서버에서는 버퍼 파일의 디렉터리) 아래 파일을 순회 스레드 하나와 코어 수만큼의 워커로 검색 */
+void commandGrep(TextBuffer *tb, Cursor *cursor, const char *arg) {
+#ifndef _WIN32
+    if (loop.grep != NULL && loop.grep->running) {
+        setMessage("A file search is already running (Esc to cancel)");
+        return;
+    }
+    if (loop.grep != NULL) {
+        freeGrep(loop.grep);
+    }
+    GrepJob *job = (GrepJob*)calloc(1, sizeof(GrepJob));
+    snprintf(job->query, sizeof(job->query), "%s", arg);
+    job->query_len = (int)strlen(job->query);
+    strcpy(job->root, ".");
+    const char *slash = tb->filename != NULL ? strrchr(tb->filename, '/') : NULL;
+    if (server.enabled && slash != NULL && slash != tb->filename) {
+        // 서버의 작업 디렉터리는 클라이언트와 다르므로 열어 둔 파일 옆에서 찾음
+        snprintf(job->root, sizeof(job->root), "%.*s", (int)(slash - tb->filename), tb->filename);
+        job->display_skip = (int)(slash - tb->filename) + 1;
+    }
+    const char *env = getenv("VIVA_GREP_MAX_MB");
+    long long max_mb = env ? atoll(env) : GREP_MAX_FILE_MB;
+    job->max_size = (max_mb > 0 ? max_mb : GREP_MAX_FILE_MB) << 20;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->ready, NULL);
+    job->walking = 1;
+    job->running = 1;
+    job->shown = 1;
+    job->started = monotonicMs();
+    int workers = cpuCount();
+    job->active = workers;
+    pthread_create(&job->threads[0], NULL, grepWalker, job);
+    for (int i = 1; i <= workers; i++) {
+        pthread_create(&job->threads[i], NULL, grepWorker, job);
+    }
+    job->thread_count = workers + 1;
+    job->timer = addTimer(PIPE_REPORT_MS, grepTick, job);
+    loop.grep = job;
+#else
+    setMessage("File search is not supported on this platform");
+#endif
+}
+
+/* 입력받은 말로 파일을 검색하는 함수: 빈 입력이면 지난 결과 목록을 다시 엶 */
+void grepAnswer(TextBuffer *tb, Cursor *cursor, const char *query) {
+    if (query != NULL && query[0] != '\0') {
+        commandGrep(tb, cursor, query);
+    } else if (loop.grep != NULL) {
+        loop.grep->shown = 1;
+    }
+}
+
+/* 파일 검색 프롬프트 (ESC+/) */
+void promptGrep(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    openPrompt("Search in files: ", 256, NULL, 0, grepAnswer);
+}
+
+/* 잘라낸 내용이 지금 파일의 원본이나 스크래치 파일을 가리키지 않게 하는 함수 (다른 파일을 열기 전) */
+void detachKillRing(TextBuffer *tb) {
+    for (int i = 0; i < KILL_RING_SIZE; i++) {
+        for (Node *node = loop.kill_ring[i].head; node != NULL; node = node->next) {
+            if (node->data == NULL && node->packed == NULL) {
+                node->data = (char*)malloc(node->len);
+                if (readNodeInto(tb, node, node->data) < 0) {
+                    memset(node->data, 0, node->len);
+                }
+                packNode(node);
+                free(node->data);
+                node->data = NULL;
+            }
+            node->file_off = -1;
+            node->swap_off = -1;
+        }
+    }
+}
+
+/* 지금 버퍼를 닫고 다른 파일을 여는 함수 (바뀐 내용은 종료할 때처럼 저장) */
+void switchFile(TextBuffer *tb, Cursor *cursor, const char *filename) {
+    waitForSave();
+    stopIndexer(tb);
+    stopGunzip(tb);
+    if (tb->modified && tb->filename) {
+        saveFile(tb);
+    }
+    storeSession(tb, cursor);
+    clearAutosave(tb);
+    detachKillRing(tb);
+    char *path = strdup(filename);     // filename이 버퍼 것일 수도 있으므로 먼저 복사
+    releaseBuffer(tb);
+    long long resident_limit = tb->resident_limit;
+    long long packed_limit = tb->packed_limit;
+    memset(tb, 0, sizeof(TextBuffer));
+    tb->resident_limit = resident_limit;
+    tb->packed_limit = packed_limit;
+    tb->source_fd = -1;
+    tb->swap_fd = -1;
+    tb->base_fd = -1;
+    tb->mark = -1;
+    memset(cursor, 0, sizeof(Cursor));
+    loop.yank_version = -1;     // 붙여넣기 바꾸기는 예전 버퍼에서만 의미가 있음
+    loadFile(tb, cursor, path);
+    free(path);
+#ifdef __linux__
+    if (loop.watch_fd >= 0) {
+        close(loop.watch_fd);
+        loop.watch_fd = -1;
+    }
+#endif
+    watchFile(tb->filename);
+}
+
+/* 고른 결과의 파일을 그 줄에서 여는 함수 */
+void openGrepResult(TextBuffer *tb, Cursor *cursor) {
+#ifndef _WIN32
+    GrepJob *job = loop.grep;
+    GrepHit *hit = &job->hits[job->selected];
+    const char *path = job->files[hit->file];
+    char want[4096], have[4096];
+    int same = tb->filename != NULL && realpath(path, want) != NULL
+        && realpath(tb->filename, have) != NULL && strcmp(want, have) == 0;
+    if (!same && server.enabled) {
+        // 서버는 파일마다 버퍼를 두므로 이 세션만 그 버퍼로 옮김
+        TextBuffer *other = realpath(path, want) != NULL ? serverBuffer(want) : NULL;
+        if (other == NULL) {
+            setMessage("Cannot open %s", path);
+            return;
+        }
+        server.active->tb = other;
+        loop.tb = other;
+        tb = other;
+        cursor->current = NULL;
+    } else if (!same) {
+        switchFile(tb, cursor, path);
+    }
+    job->shown = 0;
+    gotoPosition(tb, cursor, hit->offset);
+    tb->rows_stale = 1;
+    setMessage("%s:%lld", path + job->display_skip, hit->line);
+#endif
+}
+
+/* 결과 목록 키 처리 함수 (처리하지 않은 키는 0을 반환)
+ * 위아래로 고르고 Enter로 열며, Esc는 진행 중이면 검색을 멈추고 끝났으면 목록을 닫음 */
+int handleGrepKey(TextBuffer *tb, Cursor *cursor, int ch) {
+#ifndef _WIN32
+    GrepJob *job = loop.grep;
+    int page = TEXT_ROWS - 1;
+    switch (ch) {
+        case KEY_UP: job->selected--; break;
+        case KEY_DOWN: job->selected++; break;
+        case KEY_PPAGE: job->selected -= page; break;
+        case KEY_NPAGE: job->selected += page; break;
+        case KEY_HOME: job->selected = 0; break;
+        case KEY_END: job->selected = job->hit_count - 1; break;
+        case '\n':
+        case '\r':
+            if (job->hit_count > 0) {
+                openGrepResult(tb, cursor);
+            }
+            return 1;
+        case 27: {
+            int next = readKey();
+            if (next != ERR) {
+                // ESC 조합은 목록을 닫고 평소처럼 처리
+                job->shown = 0;
+                ungetch(next);
+                return 0;
+            }
+            if (job->running) {
+                cancelGrep(job);
+                setMessage("File search cancelled");
+            } else {
+                job->shown = 0;
+            }
+            return 1;
+        }
+        case 17:
+            return 0;   // Ctrl-Q (종료)
+        default:
+            return 1;
+    }
+    if (job->selected >= job->hit_count) job->selected = job->hit_count - 1;
+    if (job->selected < 0) job->selected = 0;
+#endif
+    return 1;
+}
+
+/* 결과 목록 표시 함수: 찾는 동안에도 들어온 만큼 보여 줌 */
+void displayGrep(WINDOW *win) {
+#ifndef _WIN32
+    GrepJob *job = loop.grep;
+    int rows = TEXT_ROWS;
+    if (job->selected < job->top) {
+        job->top = job->selected;
+    } else if (job->selected >= job->top + rows) {
+        job->top = job->selected - rows + 1;
+    }
+    wclear(win);
+    for (int y = 0; y < rows && job->top + y < job->hit_count; y++) {
+        GrepHit *hit = &job->hits[job->top + y];
+        char line[512];
+        snprintf(line, sizeof(line), "%s:%lld: %s", job->files[hit->file] + job->display_skip, hit->line, hit->text);
+        chtype attr = job->top + y == job->selected ? A_REVERSE : 0;
+        for (int x = 0; x < COLS && line[x] != '\0'; x++) {
+            mvwaddch(win, y, x, (unsigned char)line[x] | attr);
+        }
+    }
+    char size[32];
+    formatSize(size, sizeof(size), __atomic_load_n(&job->bytes_scanned, __ATOMIC_RELAXED));
+    long long ms = job->running ? monotonicMs() - job->started : job->elapsed;
+    char status[COLS + 1];
+    snprintf(status, sizeof(status), " grep \"%s\": %d matches in %d files%s | scanned %lld files, %s, skipped %lld | %s %lld ms",
+        job->query, job->hit_count, job->file_count, job->truncated ? " (limit)" : "",
+        __atomic_load_n(&job->files_scanned, __ATOMIC_RELAXED), size,
+        __atomic_load_n(&job->skipped, __ATOMIC_RELAXED),
+        job->running ? "searching" : __atomic_load_n(&job->cancel, __ATOMIC_RELAXED) && !job->truncated ? "cancelled" : "done", ms);
+    wattron(win, A_REVERSE);
+    mvwprintw(win, LINES - 2, 0, "%-*s", COLS - 1, status);
+    wattroff(win, A_REVERSE);
+    mvwprintw(win, LINES - 1, 0, "%-*s", COLS - 1, loop.message[0] != '\0' ? loop.message
+        : job->running ? "Enter = open | Esc = stop searching" : "Enter = open | Esc = close | ESC+/ then Enter = reopen list");
+    move(job->selected - job->top, 0);
+    wrefresh(win);
+#endif
+}
+
+/* 이벤트 루프 초기화 함수 */
+void initEventLoop(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    memset(&loop, 0, sizeof(loop));
+    loop.win = win;
+    loop.tb = tb;
+    loop.cursor = cursor;
+    loop.dirty = 1;
+    loop.autosave_timer = -1;
+    loop.resize_timer = -1;
+    loop.timer_fd = -1;
+    loop.watch_fd = -1;
+    loop.wake_fd[0] = loop.wake_fd[1] = -1;
+    loop.stats.enabled = getenv("VIVA_STATS") != NULL;
+    pthread_mutex_init(&loop.lock, NULL);
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);   // 외부 명령이 입력을 다 읽지 않고 끝나도 죽지 않도록
+#endif
+#ifdef __linux__
+    loop.wake_fd[0] = loop.wake_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loop.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+#elif !defined(_WIN32)
+    if (pipe(loop.wake_fd) == 0) {
+        fcntl(loop.wake_fd[0], F_SETFL, O_NONBLOCK);
+        fcntl(loop.wake_fd[1], F_SETFL, O_NONBLOCK);
+    }
+#else
+    loop.wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+#endif
+    if (tb != NULL && tb->filename) {
+        watchFile(tb->filename);
+    }
+}
+
+/* 이벤트 루프 정리 함수 */
+void closeEventLoop(void) {
+#ifndef _WIN32
+    if (loop.watch_fd >= 0) close(loop.watch_fd);
+    if (loop.timer_fd >= 0) close(loop.timer_fd);
+    if (loop.wake_fd[0] >= 0) close(loop.wake_fd[0]);
+    if (loop.wake_fd[1] >= 0 && loop.wake_fd[1] != loop.wake_fd[0]) close(loop.wake_fd[1]);
+#else
+    if (loop.wake_event != NULL) CloseHandle(loop.wake_event);
+#endif
+    runPostedEvents();  // 남은 작업의 메모리 정리
+    pthread_mutex_destroy(&loop.lock);
+}
+
+#define PENDING_KEY   1
+#define PENDING_WAKE  2
+#define PENDING_TIMER 4
+#define PENDING_WATCH 8
+#define PENDING_PIPE  16
+#define PENDING_ACCEPT 32
+
+/* 가장 이른 타이머까지 남은 시간 (ms, 타이머가 없으면 -1)
+ * timerfd가 없는 환경에서 대기 시간으로 씀 */
+int timerTimeout(void) {
+    int timeout = -1;
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        if (loop.timers[i].deadline != 0) {
+            long long left = loop.timers[i].deadline - monotonicMs();
+            if (left < 0) left = 0;
+            if (timeout < 0 || left < timeout) timeout = (int)left;
+        }
+    }
+    return timeout;
+}
+
+/* 이벤트 대기 함수: 터미널, 워커 알림, 타이머, 파일 감시 중 하나가 준비될 때까지 잠듦 */
+int pollEvents(void) {
+#ifdef _WIN32
+    // wingui PDCurses는 콘솔 입력 핸들 없이 창 메시지로 키를 받으므로
+    // 워커 알림 이벤트와 이 스레드의 창 메시지를 함께 기다리고, 가장 이른 타이머까지만 잠듦
+    int count = loop.wake_event != NULL ? 1 : 0;
+    int timeout = timerTimeout();
+    DWORD woke = MsgWaitForMultipleObjectsEx(count, &loop.wake_event,
+        timeout < 0 ? INFINITE : (DWORD)timeout, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+    if (woke == WAIT_OBJECT_0 + count) {
+        // 쌓인 메시지를 모두 창 프로시저로 넘김 (키는 PDCurses 입력 큐에 들어가 getch가 읽음)
+        MSG msg;
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+    }
+    // 깨어나면 모든 소스를 확인
+    return PENDING_KEY | PENDING_WAKE | PENDING_TIMER;
+#else
+    struct pollfd fds[7 + 2 * SERVER_MAX_CLIENTS];
+    int kinds[7 + 2 * SERVER_MAX_CLIENTS];
+    Session *owners[7 + 2 * SERVER_MAX_CLIENTS];
+    int n = 0;
+    memset(owners, 0, sizeof(owners));
+    if (!server.enabled) {
+        fds[n].fd = STDIN_FILENO; fds[n].events = POLLIN; kinds[n++] = PENDING_KEY;
+    } else {
+        // 서버는 모든 클라이언트 터미널과 연결을 기다림 (프롬프트는 세션마다 따로라 막지 않음)
+        fds[n].fd = server.listen_fd; fds[n].events = POLLIN; kinds[n++] = PENDING_ACCEPT;
+        for (int i = 0; i < server.count; i++) {
+            Session *s = server.sessions[i];
+            owners[n] = s; fds[n].fd = fileno(s->in); fds[n].events = POLLIN; kinds[n++] = PENDING_KEY;
+            owners[n] = s; fds[n].fd = s->sock; fds[n].events = POLLIN; kinds[n++] = PENDING_ACCEPT;
+        }
+    }
+    fds[n].fd = loop.wake_fd[0]; fds[n].events = POLLIN; kinds[n++] = PENDING_WAKE;
+    if (loop.timer_fd >= 0) {
+        fds[n].fd = loop.timer_fd; fds[n].events = POLLIN; kinds[n++] = PENDING_TIMER;
+    }
+    if (loop.watch_fd >= 0) {
+        fds[n].fd = loop.watch_fd; fds[n].events = POLLIN; kinds[n++] = PENDING_WATCH;
+    }
+    if (loop.pipe_job != NULL) {
+        // 자식에게 보낼 수 있을 때와 자식 출력이 있을 때 깨어남
+        if (loop.pipe_job->in_fd >= 0) {
+            fds[n].fd = loop.pipe_job->in_fd; fds[n].events = POLLOUT; kinds[n++] = PENDING_PIPE;
+        }
+        if (loop.pipe_job->out_fd >= 0) {
+            fds[n].fd = loop.pipe_job->out_fd; fds[n].events = POLLIN; kinds[n++] = PENDING_PIPE;
+        }
+        if (loop.pipe_job->err_fd >= 0) {
+            fds[n].fd = loop.pipe_job->err_fd; fds[n].events = POLLIN; kinds[n++] = PENDING_PIPE;
+        }
+    }
+
+    int timeout = -1;   // 할 일이 없으면 무한정 잠듦 (유휴 CPU 0)
+#ifndef __linux__
+    // timerfd가 없는 환경에서는 가장 이른 타이머까지만 잠듦
+    timeout = timerTimeout();
+#endif
+
+    int pending = 0;
+    if (poll(fds, n, timeout) < 0) {
+        // 시그널(SIGWINCH 등)로 깨어난 경우 curses가 KEY_RESIZE를 넣어 둠
+        return PENDING_KEY;
+    }
+    for (int i = 0; i < n; i++) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+        if (owners[i] == NULL) {
+            pending |= kinds[i];
+        } else if (kinds[i] == PENDING_KEY) {
+            owners[i]->key_ready = 1;
+            pending |= PENDING_KEY;
+        } else {
+            owners[i]->sock_ready = 1;
+        }
+    }
+#ifndef __linux__
+    pending |= PENDING_TIMER;
+#endif
+    return pending;
+#endif
+}
+
+/* 키 입력을 제외한 이벤트 처리 함수 */
+void dispatchBackground(TextBuffer *tb, int pending) {
+    if (pending & PENDING_WAKE) {
+        runPostedEvents();
+    }
+    if (pending & PENDING_TIMER) {
+    #ifdef __linux__
+        unsigned long long expirations;
+        if (read(loop.timer_fd, &expirations, sizeof(expirations)) < 0) {
+            // 이미 읽힌 경우 무시
+        }
+    #endif
+        runExpiredTimers();
+    }
+    if (pending & PENDING_WATCH) {
+        handleWatchEvents(tb);
+    }
+    if (pending & PENDING_PIPE) {
+        pumpPipe(tb);
+    }
+}
+
+/* 블로킹 없이 키 하나를 읽는 함수 (없으면 ERR) */
+int readKey(void) {
+    if (server.enabled && server.active == NULL) {
+        return ERR;     // 붙은 클라이언트가 없음
+    }
+    if (loop.replaying) {
+        // 재생 중에는 녹화된 키를 돌려줌
+        if (loop.replay_left == 0) {
+            return ERR;
+        }
+        loop.replay_left--;
+        return *loop.replay_keys++;
+    }
+    nodelay(stdscr, TRUE);
+    int ch;
+    while ((ch = getch()) == KEY_RESIZE) {
+        // 크기 변경은 키로 다루지 않음 (녹화하지도 않음)
+        // 바뀐 stdscr을 getch가 바로 그리지 않도록 해 두고, 타이머가 끝나면 한 번만 다시 그림
+        untouchwin(stdscr);
+        scheduleResize();
+    }
+    nodelay(stdscr, FALSE);
+    if (ch != ERR && loop.is_recording) {
+        if (loop.stroke_len == loop.stroke_cap) {
+            loop.stroke_cap = loop.stroke_cap ? loop.stroke_cap * 2 : 16;
+            loop.stroke = (int*)realloc(loop.stroke, sizeof(int) * loop.stroke_cap);
+        }
+        loop.stroke[loop.stroke_len++] = ch;
+    }
+    return ch;
+}
+
+/* 글자로 입력할 키인지 확인하는 함수
+ * 출력 가능한 ASCII와 8비트 바이트(UTF-8 조각 등)는 그대로 넣고, 255보다 큰 값은 curses 특수 키 */
+int isTextKey(int ch) {
+    return (ch >= 32 && ch <= 126) || (ch >= 128 && ch <= 255);
+}
+
+/* 단조 시계 함수 (us, 프레임 계측용) */
+long long monotonicUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* 프로세스가 지금까지 쓴 바이트 수 (리눅스 /proc/self/io의 wchar, 없으면 -1)
+ * 프레임 동안 늘어난 양은 거의 모두 터미널 출력 */
+long long writtenBytes(void) {
+#ifdef __linux__
+    char buf[512];
+    int fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    char *p = strstr(buf, "wchar:");
+    return p != NULL ? atoll(p + 6) : -1;
+#else
+    return -1;
+#endif
+}
+
+/* 프로세스 상주 메모리 (리눅스는 현재 값, 그 외에는 최대값) */
+long long residentSetSize(void) {
+#ifdef __linux__
+    long long pages = 0, rss = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%lld %lld", &pages, &rss) != 2) {
+            rss = 0;
+        }
+        fclose(f);
+    }
+    return rss * sysconf(_SC_PAGESIZE);
+#elif !defined(_WIN32)
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    return (long long)ru.ru_maxrss;
+#else
+    return (long long)ru.ru_maxrss * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+/* 계측 링에 값 하나 추가 */
+void pushSample(long long *ring, long long count, long long value) {
+    ring[count % STATS_SAMPLES] = value;
+}
+
+int compareLongLong(const void *a, const void *b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* 링에 남은 최근 값들의 백분위수 (값이 없으면 0) */
+long long percentile(const long long *ring, long long count, int pct) {
+    int n = count < STATS_SAMPLES ? (int)count : STATS_SAMPLES;
+    if (n == 0) {
+        return 0;
+    }
+    long long sorted[STATS_SAMPLES];
+    memcpy(sorted, ring, sizeof(long long) * n);
+    qsort(sorted, n, sizeof(long long), compareLongLong);
+    return sorted[(n - 1) * pct / 100];
+}
+
+/* 링의 가장 최근 값 */
+long long lastSample(const long long *ring, long long count) {
+    return count > 0 ? ring[(count - 1) % STATS_SAMPLES] : 0;
+}
+
+/* 계측 오버레이 (ESC+D): 화면 오른쪽 위에 지난 프레임까지의 값을 그림 */
+void drawOverlay(WINDOW *win, TextBuffer *tb) {
+    FrameStats *st = &loop.stats;
+    char lines[6][96];
+    char out_last[32], out_p99[32], res[32], packed[32], rss[32];
+    formatSize(out_last, sizeof(out_last), lastSample(st->bytes, st->frames));
+    formatSize(out_p99, sizeof(out_p99), percentile(st->bytes, st->frames, 99));
+    formatSize(res, sizeof(res), tb->resident);
+    formatSize(packed, sizeof(packed), tb->packed);
+    formatSize(rss, sizeof(rss), residentSetSize());
+    snprintf(lines[0], sizeof(lines[0]), "frame   %7.2f ms  p99 %7.2f ms",
+        lastSample(st->frame_us, st->frames) / 1000.0, percentile(st->frame_us, st->frames, 99) / 1000.0);
+    snprintf(lines[1], sizeof(lines[1]), "key     %7.2f ms  p99 %7.2f ms",
+        lastSample(st->latency_us, st->keyed) / 1000.0, percentile(st->latency_us, st->keyed, 99) / 1000.0);
+    snprintf(lines[2], sizeof(lines[2]), "output  %10s  p99 %10s", out_last, out_p99);
+    snprintf(lines[3], sizeof(lines[3]), "nodes   %10d  frames %7lld", tb->node_count, st->frames);
+    snprintf(lines[4], sizeof(lines[4]), "memory  %10s  packed %7s", res, packed);
+    snprintf(lines[5], sizeof(lines[5]), "rss     %10s", rss);
+    int width = 36;
+    int x = COLS - width;
+    if (x < 0) x = 0;
+    wattron(win, A_REVERSE);
+    for (int i = 0; i < 6 && i < TEXT_ROWS; i++) {
+        mvwprintw(win, i, x, " %-*.*s", width - 1, width - 1, lines[i]);
+    }
+    wattroff(win, A_REVERSE);
+}
+
+/* 프레임 하나의 계측 기록 함수 (그리기 시작 시각과 그때까지 쓴 바이트를 받음) */
+void recordFrame(long long start, long long written) {
+    FrameStats *st = &loop.stats;
+    long long now = monotonicUs();
+    long long after = writtenBytes();
+    pushSample(st->frame_us, st->frames, now - start);
+    pushSample(st->bytes, st->frames, written >= 0 && after >= written ? after - written : 0);
+    st->frames++;
+    if (st->key_at != 0) {
+        pushSample(st->latency_us, st->keyed, now - st->key_at);
+        st->keyed++;
+        st->key_at = 0;
+    }
+}
+
+/* 오버레이 전환 함수 */
+void toggleOverlay(void) {
+    loop.stats.overlay = !loop.stats.overlay;
+    loop.stats.enabled = loop.stats.overlay || getenv("VIVA_STATS") != NULL;
+    loop.dirty = 1;
+}
+
+/* 노드 내용 요약 함수: 통계 패널이 필요할 때만 세고 내용이 바뀌기 전까지 재사용 */
+void summarizeText(TextBuffer *tb, Node *node) {
+    if (!node->stats.known) {
+        summarizeBytes(&node->stats, nodeData(tb, node), node->len);
+    }
+}
+
+/* 합계에 들어 있는 가장 가까운 이웃 노드 (빈 노드, 다시 셀 노드는 건너뜀) */
+Node* countedNeighbor(Node *node, int forward) {
+    while (node != NULL && (!node->stats.known || node->len == 0)) {
+        node = forward ? node->next : node->prev;
+    }
+    return node;
+}
+
+/* 두 노드 경계에 걸친 단어 수 (앞 노드 끝과 뒤 노드 처음이 모두 단어 글자면 1) */
+int wordJoin(Node *a, Node *b) {
+    return a != NULL && b != NULL && a->stats.last_word && b->stats.first_word;
+}
+
+/* node부터 앞쪽으로 (forward면 뒤쪽으로) 첫 줄바꿈까지의 글자 수
+ * 아직 다시 세지 않은 노드를 만나거나 너무 멀리 가야 하면 -1 */
+long long lineRun(Node *node, int forward) {
+    long long run = 0;
+    int walked = 0;
+    for (; node != NULL; node = forward ? node->next : node->prev) {
+        if (node->len == 0) {
+            continue;
+        }
+        if (!node->stats.known || ++walked > STATS_WALK) {
+            return -1;
+        }
+        NodeStats *s = &node->stats;
+        if (s->newlines > 0) {
+            return run + (forward ? s->head : s->tail);
+        }
+        run += s->chars;
+    }
+    return run;
+}
+
+/* 노드가 들어오거나 (sign = 1) 빠질 때 가장 긴 줄을 고치는 함수
+ * 노드에 걸친 줄들과 노드가 없을 때 양쪽이 이어진 줄 중 사라지는 쪽이 가장 긴 줄일 수 있으면 다시 훑도록 표시 */
+void adjustLongest(TextStats *st, Node *node, int sign) {
+    if (!st->longest_known) {
+        return;
+    }
+    long long before = lineRun(node->prev, 0);
+    long long after = lineRun(node->next, 1);
+    if (before < 0 || after < 0) {
+        st->longest_known = 0;
+        return;
+    }
+    NodeStats *s = &node->stats;
+    long long joined = before + after;
+    long long own = before + s->chars + after;
+    if (s->newlines > 0) {
+        own = before + s->head;
+        if (s->widest > own) own = s->widest;
+        if (s->tail + after > own) own = s->tail + after;
+    }
+    long long gone = sign > 0 ? joined : own;
+    long long added = sign > 0 ? own : joined;
+    if (gone >= st->longest) {
+        st->longest_known = 0;
+    } else if (added > st->longest) {
+        st->longest = added;
+    }
+}
+
+/* 노드 요약을 합계에 더하거나 빼는 함수 (sign = 1, -1)
+ * 이웃 두 노드 사이에 끼우는 것으로 보고, 두 이웃의 경계 대신 양쪽 새 경계의 단어를 셈 */
+void countNodeStats(TextBuffer *tb, Node *node, int sign) {
+    if (node->len == 0) {
+        return;
+    }
+    TextStats *st = &tb->text_stats;
+    NodeStats *s = &node->stats;
+    Node *prev = countedNeighbor(node->prev, 0);
+    Node *next = countedNeighbor(node->next, 1);
+    int joined = wordJoin(prev, next) - wordJoin(prev, node) - wordJoin(node, next);
+    st->chars += sign * s->chars;
+    st->words += sign * (s->words + joined);
+    st->newlines += sign * s->newlines;
+    adjustLongest(st, node, sign);
+}
+
+/* 리스트에 이은 노드를 합계에 더하는 함수 (요약이 없으면 다음 갱신 때 세도록 미뤄 둠) */
+void addStats(TextBuffer *tb, Node *node) {
+    TextStats *st = &tb->text_stats;
+    if (!st->valid) {
+        return;
+    }
+    if (node->stats.known) {
+        countNodeStats(tb, node, 1);
+    } else if (st->stale_count < STATS_STALE) {
+        st->stale[st->stale_count++] = node;
+    } else {
+        st->valid = 0;  // 한 번에 너무 많이 바뀌면 처음부터 셈
+    }
+}
+
+/* 노드를 합계에서 빼는 함수 (리스트에서 떼기 전, 또는 내용이 바뀌기 전에 호출)
+ * stale이면 다시 셀 목록에 넣고, 이미 목록에 있던 노드를 떼면 목록에서만 뺌 */
+void dropStats(TextBuffer *tb, Node *node, int stale) {
+    TextStats *st = &tb->text_stats;
+    if (!st->valid) {
+        return;
+    }
+    if (node->stats.known) {
+        countNodeStats(tb, node, -1);
+        if (stale) {
+            node->stats.known = 0;
+            addStats(tb, node);
+        }
+        return;
+    }
+    if (!stale) {
+        for (int i = 0; i < st->stale_count; i++) {
+            if (st->stale[i] == node) {
+                st->stale[i] = st->stale[--st->stale_count];
+                break;
+            }
+        }
+    }
+}
+
+/* 버퍼 전체 통계 갱신 함수: 편집 때마다 고친 합계에 바뀐 노드만 다시 세어 더함
+ * 가장 긴 줄이 줄었을 수 있을 때만 요약을 한 번 훑어 다시 구함 (내용은 다시 읽지 않음)
+ * 페이지 단위로 연 파일은 색인 스레드가 페이지 요약을 함께 만들므로 끝날 때까지 기다림 */
+void updateTextStats(TextBuffer *tb, Cursor *cursor) {
+    TextStats *st = &tb->text_stats;
+    st->pending = tb->index_job != NULL;
+    if (st->pending) {
+        return;
+    }
+    if (!st->valid) {
+        // 처음 열었거나 합계를 놓쳤으면 노드 요약을 앞에서부터 이어 붙임
+        long long chars = 0, words = 0, newlines = 0;
+        int prev_word = 0;
+        for (Node *node = tb->head; node != NULL; node = node->next) {
+            if (!node->stats.known) {
+                summarizeText(tb, node);
+                trimResident(tb, cursor->current);
+            }
+            NodeStats *s = &node->stats;
+            chars += s->chars;
+            words += s->words - (prev_word && s->first_word);   // 노드 경계에 걸친 단어는 한 번만
+            newlines += s->newlines;
+            if (node->len > 0) {
+                prev_word = s->last_word;
+            }
+        }
+        st->chars = chars;
+        st->words = words;
+        st->newlines = newlines;
+        st->stale_count = 0;
+        st->valid = 1;
+        st->longest_known = 0;
+    }
+    // 편집으로 합계에서 뺀 노드를 새 요약으로 다시 더함
+    while (st->stale_count > 0) {
+        Node *node = st->stale[--st->stale_count];
+        summarizeText(tb, node);
+        countNodeStats(tb, node, 1);
+        trimResident(tb, cursor->current);
+    }
+    long long run = lineRun(tb->tail, 0);   // 마지막 줄의 글자 수
+    if (!st->longest_known || run < 0) {
+        long long longest = 0;
+        run = 0;    // 아직 끝나지 않은 줄의 글자 수
+        for (Node *node = tb->head; node != NULL; node = node->next) {
+            NodeStats *s = &node->stats;
+            if (s->newlines == 0) {
+                run += s->chars;
+            } else {
+                if (run + s->head > longest) longest = run + s->head;
+                if (s->widest > longest) longest = s->widest;
+                run = s->tail;
+            }
+        }
+        if (run > longest) longest = run;
+        st->longest = longest;
+        st->longest_known = 1;
+    }
+    st->bytes = tb->size;
+    st->lines = st->newlines + (run > 0);
+}
+
+/* 통계 패널 (ESC+I): 화면 오른쪽 위 (계측 오버레이가 켜져 있으면 그 아래)에 그림 */
+void drawTextStats(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    TextStats *st = &tb->text_stats;
+    updateTextStats(tb, cursor);
+    char lines[5][48];
+    int count = 5;
+    if (st->pending) {
+        IndexJob *job = tb->index_job;
+        int done = __atomic_load_n(&job->done, __ATOMIC_ACQUIRE);
+        snprintf(lines[0], sizeof(lines[0]), "counting... %d%%", (int)((long long)done * 100 / job->pages));
+        count = 1;
+    } else {
+        snprintf(lines[0], sizeof(lines[0]), "bytes   %14lld", st->bytes);
+        snprintf(lines[1], sizeof(lines[1]), "chars   %14lld", st->chars);
+        snprintf(lines[2], sizeof(lines[2]), "words   %14lld", st->words);
+        snprintf(lines[3], sizeof(lines[3]), "lines   %14lld", st->lines);
+        snprintf(lines[4], sizeof(lines[4]), "longest %14lld", st->longest);
+    }
+    int width = 24;
+    int x = COLS - width;
+    int y = loop.stats.overlay ? 7 : 0;
+    if (x < 0) x = 0;
+    wattron(win, A_REVERSE);
+    for (int i = 0; i < count && y + i < TEXT_ROWS; i++) {
+        mvwprintw(win, y + i, x, " %-*.*s", width - 1, width - 1, lines[i]);
+    }
+    wattroff(win, A_REVERSE);
+}
+
+/* 통계 패널 전환 함수 */
+void toggleTextStats(void) {
+    loop.text_panel = !loop.text_panel;
+    if (!loop.text_panel) {
+        loop.tb->text_stats.valid = 0;  // 닫혀 있는 동안은 편집마다 합계를 고치지 않음
+    }
+    loop.dirty = 1;
+}
+
+/* 종료할 때 계측 값을 VIVA_STATS 파일에 쓰는 함수 */
+void dumpStats(TextBuffer *tb) {
+    const char *path = getenv("VIVA_STATS");
+    if (path == NULL || path[0] == '\0') {
+        return;
+    }
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return;
+    }
+    FrameStats *st = &loop.stats;
+    fprintf(f, "frames %lld\n", st->frames);
+    fprintf(f, "frame_us last %lld p50 %lld p99 %lld max %lld\n", lastSample(st->frame_us, st->frames),
+        percentile(st->frame_us, st->frames, 50), percentile(st->frame_us, st->frames, 99),
+        percentile(st->frame_us, st->frames, 100));
+    fprintf(f, "key_latency_us samples %lld last %lld p50 %lld p99 %lld max %lld\n", st->keyed,
+        lastSample(st->latency_us, st->keyed), percentile(st->latency_us, st->keyed, 50),
+        percentile(st->latency_us, st->keyed, 99), percentile(st->latency_us, st->keyed, 100));
+    fprintf(f, "output_bytes last %lld p50 %lld p99 %lld max %lld\n", lastSample(st->bytes, st->frames),
+        percentile(st->bytes, st->frames, 50), percentile(st->bytes, st->frames, 99),
+        percentile(st->bytes, st->frames, 100));
+    if (tb != NULL) {
+        fprintf(f, "nodes %d\n", tb->node_count);
+        fprintf(f, "resident_bytes %lld\n", tb->resident);
+        fprintf(f, "packed_bytes %lld\n", tb->packed);
+    }
+    fprintf(f, "rss_bytes %lld\n", residentSetSize());
+    fclose(f);
+}
+
+/* 화면 그리기 함수 (본문, 16진, 표, 파일 검색 목록 중 하나) */
+void drawScreen(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    if (loop.grep != NULL && loop.grep->shown) {
+        displayGrep(win);
+        refresh();
+        loop.dirty = 0;
+        return;
+    }
+    if (tb->table != NULL && !tb->hex_view) {
+        if (tb->rows_stale) {
+            relocateRows(tb, cursor);
+        }
+        displayTable(win, tb, cursor);
+        move(cursor->y, cursor->x);
+        refresh();
+        loop.dirty = 0;
+        return;
+    }
+    if (tb->hex_view) {
+        // 줄 번호는 16진 보기를 나갈 때 다시 셈
+        displayHex(win, tb, cursor);
+        move(cursor->y, cursor->x);
+        refresh();
+        loop.dirty = 0;
+        return;
+    }
+    if (tb->rows_stale) {
+        relocateRows(tb, cursor);
+    }
+    displayList(win, tb, cursor);
+    if (loop.prompt.search != NULL) {
+        highlightMatch(win, cursor, loop.prompt.search);
+    }
+    move(cursor->y, cursor->x);
+    refresh();
+    loop.dirty = 0;
+}
+
+/* 화면 갱신 함수 (계측이 켜져 있으면 그리기 시간과 출력량을 잼) */
+void refreshScreen(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    if (loop.replaying) {
+        return;
+    }
+    long long start = 0;
+    long long written = 0;
+    if (loop.stats.enabled) {
+        start = monotonicUs();
+        written = writtenBytes();
+    }
+    drawScreen(win, tb, cursor);
+    if (loop.stats.overlay || loop.text_panel) {
+        int y, x;
+        getyx(win, y, x);
+        if (loop.stats.overlay) {
+            drawOverlay(win, tb);
+        }
+        if (loop.text_panel) {
+            drawTextStats(win, tb, cursor);
+        }
+        wmove(win, y, x);
+        wrefresh(win);
+    }
+    if (loop.prompt.active && loop.prompt.search == NULL) {
+        // 터미널 커서는 프롬프트 입력 끝에 둠
+        int x = (int)(strlen(loop.prompt.label) + loop.prompt.len);
+        wmove(win, LINES - 1, x < COLS - 1 ? x : COLS - 1);
+        wrefresh(win);
+    }
+    if (loop.stats.enabled) {
+        recordFrame(start, written);
+    }
+}
+
+/* 매크로 해제 함수 */
+void freeMacro(Macro *macro) {
+    for (int i = 0; i < macro->count; i++) {
+        free(macro->ops[i].text);
+        free(macro->ops[i].keys);
+    }
+    free(macro->ops);
+    macro->ops = NULL;
+    macro->count = 0;
+    macro->cap = 0;
+}
+
+/* 매크로 연산 추가 함수 */
+MacroOp* addMacroOp(Macro *macro, int kind) {
+    if (macro->count == macro->cap) {
+        macro->cap = macro->cap ? macro->cap * 2 : 16;
+        macro->ops = (MacroOp*)realloc(macro->ops, sizeof(MacroOp) * macro->cap);
+    }
+    MacroOp *op = &macro->ops[macro->count++];
+    memset(op, 0, sizeof(MacroOp));
+    op->kind = kind;
+    return op;
+}
+
+/* 검색 키 묶음을 검색 연산으로 옮기는 함수
+ * (검색 키, 검색어, Enter, 오른쪽 화살표 n번, Enter) 꼴만 옮기고 나머지는 0 반환 */
+int compileSearch(Macro *macro, const int *keys, int n) {
+    int i;
+#ifdef __APPLE__
+    if (n < 2 || keys[0] != 27 || (keys[1] != 'f' && keys[1] != 'F')) {
+        return 0;
+    }
+    i = 2;
+#else
+    if (n < 1 || keys[0] != 6) {
+        return 0;
+    }
+    i = 1;
+#endif
+    char query[256];
+    int len = 0;
+    for (; i < n && keys[i] != '\n' && keys[i] != '\r' && keys[i] != KEY_ENTER; i++) {
+        if (keys[i] == KEY_BACKSPACE || keys[i] == 127 || keys[i] == 8) {
+            if (len > 0) len--;
+        } else if (isTextKey(keys[i]) && len < (int)sizeof(query) - 1) {
+            query[len++] = (char)keys[i];
+        } else {
+            return 0;   // Esc로 취소했거나 알 수 없는 키
+        }
+    }
+    if (i++ == n || len == 0) {
+        return 0;
+    }
+    int skip = 0;
+    for (; i < n && keys[i] == KEY_RIGHT; i++) {
+        skip++;
+    }
+    // 결과가 없던 검색은 첫 Enter에서 끝나고, 있던 검색은 Enter로 이동해야 함
+    if (i < n && (keys[i] == '\n' || keys[i] == '\r' || keys[i] == KEY_ENTER)) {
+        i++;
+    }
+    if (i != n) {
+        return 0;
+    }
+    MacroOp *op = addMacroOp(macro, MACRO_SEARCH);
+    op->text = (char*)malloc(len + 1);
+    memcpy(op->text, query, len);
+    op->text[len] = '\0';
+    op->len = len;
+    op->skip = skip;
+    return 1;
+}
+
+/* 키 하나로 시작된 입력을 녹화 중인 매크로에 옮기는 함수 */
+void endStroke(void) {
+    Macro *macro = &loop.recording;
+    int *keys = loop.stroke;
+    int n = loop.stroke_len;
+    loop.stroke_len = 0;
+    if (n == 0) {
+        return;
+    }
+    if (n == 1 && isTextKey(keys[0])) {
+        // 이어 친 글자는 한 번의 삽입으로 합침
+        MacroOp *op = macro->count > 0 ? &macro->ops[macro->count - 1] : NULL;
+        if (op == NULL || op->kind != MACRO_TEXT) {
+            op = addMacroOp(macro, MACRO_TEXT);
+        }
+        op->text = (char*)realloc(op->text, op->len + 1);
+        op->text[op->len++] = (char)keys[0];
+        return;
+    }
+    if (compileSearch(macro, keys, n)) {
+        return;
+    }
+    MacroOp *op = addMacroOp(macro, MACRO_KEYS);
+    op->keys = (int*)malloc(sizeof(int) * n);
+    memcpy(op->keys, keys, sizeof(int) * n);
+    op->len = n;
+}
+
+/* 매크로 녹화 시작 함수 */
+void startMacro(void) {
+    if (loop.replaying) {
+        return;
+    }
+    freeMacro(&loop.recording);
+    loop.stroke_len = 0;
+    loop.is_recording = 1;
+    setMessage("Recording macro (ESC+) to stop)");
+}
+
+/* 매크로 녹화 끝 함수 */
+void stopMacro(void) {
+    if (!loop.is_recording) {
+        return;
+    }
+    loop.is_recording = 0;
+    loop.stroke_len = 0;    // 녹화를 끝낸 키는 넣지 않음
+    freeMacro(&loop.macro);
+    loop.macro = loop.recording;
+    memset(&loop.recording, 0, sizeof(Macro));
+    setMessage("Macro recorded: %d steps (ESC+E to replay)", loop.macro.count);
+}
+
+/* 커서 다음에서 검색어를 찾는 함수 (없으면 -1) */
+long long findForward(TextBuffer *tb, long long from, const char *query, int query_len) {
+    Cursor t = {NULL, 0, 0};
+    seekPosition(tb, &t, from);
+    if (!normalizeForward(&t)) {
+        return -1;
+    }
+    long long base = t.pos - t.offset;
+    for (Node *node = t.current; node != NULL; base += node->len, node = node->next) {
+        char *data = nodeData(tb, node);
+        char *p = node == t.current ? data + t.offset : data;
+        char *stop = data + node->len;
+        while (p < stop && (p = memchr(p, query[0], stop - p)) != NULL) {
+            if (matchAt(tb, node, (int)(p - data), query, query_len)) {
+                return base + (p - data);
+            }
+            p++;
+        }
+        trimResident(tb, node);
+    }
+    return -1;
+}
+
+/* 매크로 연산 하나 실행 함수 (검색이 실패하면 0 반환) */
+int runMacroOp(WINDOW *win, TextBuffer *tb, Cursor *cursor, const MacroOp *op) {
+    if (op->kind == MACRO_TEXT) {
+        if (tb->cursor_count > 0) {
+            // 추가 커서가 있으면 글자마다 모든 커서에 적용
+            for (int i = 0; i < op->len; i++) {
+                handleEditKey(tb, cursor, (unsigned char)op->text[i]);
+            }
+        } else {
+            insertBytes(tb, cursor, op->text, op->len);
+        }
+    } else if (op->kind == MACRO_SEARCH) {
+        // 대화형 검색과 같은 규칙: 커서 다음의 첫 결과에서 skip개 건너뜀 (돌아가지 않음)
+        long long at = cursor->pos == 0 ? 0 : cursor->pos + 1;
+        long long hit = -1;
+        for (int i = 0; i <= op->skip; i++) {
+            hit = findForward(tb, at, op->text, op->len);
+            if (hit < 0) {
+                return 0;
+            }
+            at = hit + 1;
+        }
+        closeUndo(tb);
+        gotoPosition(tb, cursor, hit);
+    } else {
+        loop.replay_keys = op->keys + 1;
+        loop.replay_left = op->len - 1;
+        handleKey(win, tb, cursor, op->keys[0]);
+        // 키가 연 프롬프트에는 녹화된 나머지 키를 넣고, 키가 끝나도 열려 있으면 취소된 것으로 봄
+        while (loop.prompt.active && loop.replay_left > 0) {
+            handleKey(win, tb, cursor, readKey());
+        }
+        if (loop.prompt.active) {
+            promptKey(tb, cursor, 27);
+        }
+        loop.replay_left = 0;
+    }
+    return 1;
+}
+
+/* 재생 중 Esc가 눌렸는지 확인하는 함수 (다른 키는 되돌려 둠) */
+int macroInterrupted(void) {
+    nodelay(stdscr, TRUE);
+    int ch = getch();
+    nodelay(stdscr, FALSE);
+    if (ch == 27) {
+        return 1;
+    }
+    if (ch != ERR) {
+        ungetch(ch);
+    }
+    return 0;
+}
+
+/* 입력받은 횟수만큼 매크로를 재생하는 함수
+ * 녹화된 키를 다시 입력하지 않고 버퍼 연산으로 실행하며, 끝난 뒤 한 번만 그림 */
+void repeatMacro(TextBuffer *tb, Cursor *cursor, const char *answer) {
+    WINDOW *win = loop.win;
+    if (answer == NULL) {
+        return;
+    }
+    int has_search = 0;
+    for (int i = 0; i < loop.macro.count; i++) {
+        has_search |= loop.macro.ops[i].kind == MACRO_SEARCH;
+    }
+    long long times = atoll(answer);
+    int until_fail = answer[0] == '\0' && has_search;
+    if (answer[0] == '\0' && !has_search) {
+        times = 1;
+    }
+    if (times <= 0 && !until_fail) {
+        return;
+    }
+
+    long long started = monotonicMs();
+    long long done = 0;
+    const char *stopped = NULL;
+    loop.replaying = 1;
+    tb->undo_group++;   // 재생 전체를 한 번에 되돌림
+    closeUndo(tb);
+    while ((until_fail || done < times) && stopped == NULL) {
+        long version = tb->version;
+        long long pos = cursor->pos;
+        int i;
+        for (i = 0; i < loop.macro.count; i++) {
+            if (!runMacroOp(win, tb, cursor, &loop.macro.ops[i])) {
+                stopped = "search failed";
+                break;
+            }
+            if (!loop.running || loop.pipe_job != NULL) {
+                stopped = "macro ended";
+                break;
+            }
+        }
+        if (i == loop.macro.count) {
+            done++;
+        }
+        trimResident(tb, cursor->current);
+        if (stopped == NULL && until_fail && tb->version == version && cursor->pos == pos) {
+            stopped = "no progress";   // 같은 자리에서 끝없이 돌지 않도록
+        }
+        if (stopped == NULL && done % MACRO_CHECK_EVERY == 0 && macroInterrupted()) {
+            stopped = "interrupted";
+        }
+    }
+    loop.replaying = 0;
+    closeUndo(tb);
+    loop.dirty = 1;
+    setMessage("Macro ran %lld times in %lld ms%s%s", done, monotonicMs() - started,
+        stopped ? ", " : "", stopped ? stopped : "");
+}
+
+/* 매크로 재생 함수: 몇 번 되풀이할지 물음 */
+void replayMacro(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    if (loop.replaying) {
+        return;
+    }
+    if (loop.is_recording) {
+        setMessage("Stop recording (ESC+)) before replaying");
+        return;
+    }
+    if (loop.macro.count == 0) {
+        setMessage("No macro recorded (ESC+( to start)");
+        return;
+    }
+    openPrompt("Repeat macro (empty = until search fails): ", 32, NULL, 0, repeatMacro);
+}
+
+/* 편집 키 처리 함수 */
+void handleEditKey(TextBuffer *tb, Cursor *cursor, int ch) {
+    if (tb->hex_view) {
+        handleHexKey(tb, cursor, ch);
+        return;
+    }
+    if (tb->table != NULL && (ch == KEY_LEFT || ch == KEY_RIGHT || ch == KEY_UP || ch == KEY_DOWN
+        || ch == KEY_PPAGE || ch == KEY_NPAGE)) {
+        handleTableKey(tb, cursor, ch);
+        return;
+    }
+    if (tb->cursor_count > 0 && (ch == KEY_LEFT || ch == KEY_RIGHT || ch == KEY_UP || ch == KEY_DOWN
+        || ch == KEY_BACKSPACE || ch == 127 || ch == '\n' || ch == '\r' || isTextKey(ch))) {
+        // 추가 커서가 있으면 모든 커서에 한 번에 적용
+        applyToCursors(tb, cursor, ch);
+        return;
+    }
+    switch (ch) {
+        case KEY_LEFT:
+            closeUndo(tb);
+            moveCursorLeft(tb, cursor);
+            break;
+        case KEY_RIGHT:
+            closeUndo(tb);
+            moveCursorRight(tb, cursor);
+            break;
+        case KEY_UP:
+            closeUndo(tb);
+            moveCursorUp(tb, cursor);
+            break;
+        case KEY_DOWN:
+            closeUndo(tb);
+            moveCursorDown(tb, cursor);
+            break;
+        case KEY_BACKSPACE:
+        case 127:
+    #ifdef _WIN32
+        case 8:
+    #endif
+            /* 백스페이스 처리 (줄, 열은 deleteNode가 갱신) */
+            deleteNode(tb, cursor);
+            break;
+        default:
+            if (isTextKey(ch)) { // 출력 가능한 문자 (UTF-8 등 8비트 바이트 포함)
+                insertNode(tb, cursor, (char)ch);
+            } else if (ch == '\n' || ch == '\r') {
+                insertNode(tb, cursor, '\n');
+                closeUndo(tb);  // 되돌리기는 줄 단위로 끊음
+            }
+            break;
+    }
+}
+
+/* 키 하나 처리 함수 */
+void handleKey(WINDOW *win, TextBuffer *tb, Cursor *cursor, int ch) {
+    loop.message[0] = '\0';     // 새 입력이 오면 이전 알림은 지움
+    loop.dirty = 1;
+    if (!loop.replaying) {
+        tb->undo_group++;       // 키 하나로 생긴 편집은 한 번에 되돌림 (재생 전체는 한 묶음)
+    }
+    if (loop.prompt.active && loop.pipe_job == NULL) {
+        // 이 세션의 프롬프트가 열려 있으면 키는 모두 프롬프트로 (외부 명령이 도는 동안은 아래에서 막음)
+        promptKey(tb, cursor, ch);
+        return;
+    }
+    if (loop.grep != NULL && loop.grep->shown && handleGrepKey(tb, cursor, ch)) {
+        return;
+    }
+    if (loop.pipe_job != NULL) {
+        // 외부 명령이 끝날 때까지 편집을 막고 Esc만 받음
+        if (loop.pipe_job->code >= 0) {
+            confirmPipe(tb, ch);    // 실패한 명령: 출력으로 바꿀지 답을 기다리는 중
+        } else if (ch == 27) {
+            cancelPipe();
+        } else {
+            setMessage("Piping through '%s' (Esc to cancel)", loop.pipe_job->command);
+        }
+        return;
+    }
+    /* ESC 시퀀스 처리 (macOS는 저장, 종료, 검색도 ESC 조합) */
+    if (ch == 27) { // ESC 키를 눌렀을 때
+        int next_ch = readKey();
+        if (next_ch == ERR) {
+            // ESC 키만 눌린 경우 추가 커서와 영역 표시를 해제
+            clearCursors(tb);
+            tb->mark = -1;
+            return;
+        }
+        // ESC + 다른 키 조합 처리
+        switch (next_ch) {
+#ifdef __APPLE__
+            case 's':
+            case 'S':
+                // ESC + S 눌렀을 때 저장
+                saveFileAsync(tb);
+                break;
+            case 'q':
+            case 'Q':
+                // ESC + Q 눌렀을 때 종료
+                loop.running = 0;
+                break;
+            case 'f':
+            case 'F':
+                searchFunction(win, tb, cursor);
+                break;
+#endif
+            case 'x':
+            case 'X':
+                // ESC + X: 명령 실행
+                runCommand(win, tb, cursor);
+                break;
+            case 'r':
+            case 'R':
+                // ESC + R: 모두 바꾸기
+                commandReplace(tb, cursor, "");
+                break;
+            case 'm':
+            case 'M':
+                // ESC + M: 모든 일치 위치에 커서
+                cursorsAtMatches(tb, cursor);
+                break;
+            case 'n':
+            case 'N':
+                // ESC + N: 다음 일치에 커서 추가
+                cursorAtNextMatch(tb, cursor);
+                break;
+            case '(':
+                // ESC + (: 매크로 녹화 시작
+                startMacro();
+                break;
+            case ')':
+                // ESC + ): 매크로 녹화 끝
+                stopMacro();
+                break;
+            case 'e':
+            case 'E':
+                // ESC + E: 매크로 재생
+                replayMacro(win, tb, cursor);
+                break;
+            case 'h':
+            case 'H':
+                // ESC + H: 16진 보기 전환
+                toggleHexView(tb, cursor);
+                break;
+            case 't':
+            case 'T':
+                // ESC + T: 표 보기 전환
+                toggleTableView(tb, cursor);
+                break;
+            case 'g':
+            case 'G':
+                // ESC + G: 바이트 위치로 이동
+                gotoOffset(win, tb, cursor);
+                break;
+            case ']':
+                // ESC + ]: 짝 괄호로 이동
+                jumpToBracket(tb, cursor);
+                break;
+            case '-':
+                // ESC + -: 커서 줄 접기/펼치기
+                toggleFold(tb, cursor);
+                break;
+            case 'd':
+            case 'D':
+                // ESC + D: 계측 오버레이 전환
+                toggleOverlay();
+                break;
+            case 'i':
+            case 'I':
+                // ESC + I: 통계 패널 전환
+                toggleTextStats();
+                break;
+            case '/':
+                // ESC + /: 파일 검색
+                promptGrep(win, tb, cursor);
+                break;
+            case '|':
+                // ESC + |: 영역을 외부 명령에 통과
+                commandPipe(tb, cursor, "");
+                break;
+            case 'v':
+            case 'V':
+                // ESC + V: 방금 붙여 넣은 것을 이전 항목으로 바꿈
+                pastePrevious(tb, cursor);
+                break;
+            case 'z':
+            case 'Z':
+                undoEdit(tb, cursor);
+                break;
+            case 'y':
+            case 'Y':
+                redoEdit(tb, cursor);
+                break;
+            default:
+                break;
+        }
+        return;
+    }
+#ifndef __APPLE__
+    /* Windows, Linux에서 Ctrl 키 조합 처리 */
+    if (ch == 19) { // Ctrl-S (저장)
+        saveFileAsync(tb);
+        return;
+    } else if (ch == 17) { // Ctrl-Q (종료)
+        loop.running = 0;
+        return;
+    } else if (ch == 6) { // Ctrl-F (검색)
+        searchFunction(win, tb, cursor);
+        return;
+    } else if (ch == 18) { // Ctrl-R (모두 바꾸기)
+        commandReplace(tb, cursor, "");
+        return;
+    }
+#endif
+    if (ch == 0) { // Ctrl-Space (영역 시작 표시)
+        tb->mark = cursor->pos;
+        setMessage("Mark set");
+        return;
+    } else if (ch == 26) { // Ctrl-Z (되돌리기)
+        undoEdit(tb, cursor);
+        return;
+    } else if (ch == 25) { // Ctrl-Y (다시 실행)
+        redoEdit(tb, cursor);
+        return;
+    } else if (ch == 24) { // Ctrl-X (잘라내기)
+        cutRegion(tb, cursor);
+        return;
+    } else if (ch == 3) { // Ctrl-C (복사)
+        copyRegion(tb, cursor);
+        return;
+    } else if (ch == 22) { // Ctrl-V (붙여넣기)
+        pasteKill(tb, cursor);
         return;
     }
-    tb->modified = 1; // 수정됨 표시
-    Node *dNode = cursor->current;
-
-    if (dNode->prev != NULL) {
-        dNode->prev->next = dNode->next;
-        cursor->current = dNode->prev;
-    } else {
-        // 헤드 노드 삭제
-        tb->head = dNode->next;
-        cursor->current = tb->head;
-    }
+    /* 기존 입력 처리 */
+    handleEditKey(tb, cursor, ch);
+}
 
-    if (dNode->next != NULL) {
-        dNode->next->prev = dNode->prev;
-    } else {
-        // 테일 노드 삭제
-        tb->tail = dNode->prev;
-    }
+/* 사용자 키 입력 처리 (이벤트 루프) */
+void processInput(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
+    loop.running = 1;
+    while (loop.running) {
+        /* 바뀐 것이 있을 때만 반복당 한 번 화면 업데이트 */
+        if (loop.dirty) {
+            refreshScreen(win, tb, cursor);
+        }
 
-    free(dNode);
-}
+        int pending = pollEvents();
 
-/* 라인 수 계산 함수 */
-int countLines(TextBuffer *tb) {
-    int lines = 1;
-    Node *temp = tb->head;
-    while (temp != NULL) {
-        if (temp->character == '\n') {
-            lines++;
+        /* 키 입력을 먼저 모두 처리해 백그라운드 작업이 타이핑을 늦추지 않도록 함 */
+        if (pending & PENDING_KEY) {
+            int ch;
+            if (loop.stats.enabled && loop.stats.key_at == 0) {
+                loop.stats.key_at = monotonicUs();
+            }
+            while (loop.running && (ch = readKey()) != ERR) {
+                handleKey(win, tb, cursor, ch);
+                if (loop.is_recording && !loop.prompt.active) {
+                    endStroke();    // 프롬프트에 친 키는 연 키와 한 묶음
+                }
+            }
         }
-        temp = temp->next;
+        dispatchBackground(tb, pending);
+        scheduleAutosave(tb);
+        // 화면에서 먼 노드는 압축해 상주 한도를 지킴
+        trimResident(tb, cursor->current);
     }
-    return lines;
 }
 
-/* 상태 바 표시 함수 */
-void displayStatusBar(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
-    int status_bar = LINES - 2;
-    char status[COLS];
-    int total_lines = countLines(tb);
-    snprintf(status, COLS, " [%s] - %d lines | Cursor: (%d:%d) ", 
-        tb->filename ? tb->filename : "No Name", total_lines, cursor->row + 1, cursor->col + 1);
-    // 반전 효과
-    wattron(win, A_REVERSE);
-    mvwprintw(win, status_bar, 0, "%-*s", COLS - 1, status);
-    wattroff(win, A_REVERSE);
-    wrefresh(win);
+/* 서버 소켓 경로 (VIVA_SOCKET으로 바꿀 수 있음) */
+void serverSocketPath(char *path, size_t size) {
+    const char *env = getenv("VIVA_SOCKET");
+    if (env != NULL && env[0] != '\0') {
+        snprintf(path, size, "%s", env);
+        return;
+    }
+#ifndef _WIN32
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, size, "%s/viva-%d.sock", dir ? dir : "/tmp", (int)getuid());
+#endif
 }
 
-/* 메시지 바 표시 함수 */
-void displayMessageBar(WINDOW *win) {
-    int message_bar = LINES - 1;
-    char message[COLS];
-    snprintf(message, COLS, "HELP: %s = save | %s = quit | %s = find",
-        SAVE_KEY, QUIT_KEY, FIND_KEY);
-    mvwprintw(win, message_bar, 0, "%-*s", COLS - 1, message);
-    wrefresh(win);
+/* 다른 세션이 편집한 만큼 세션에 저장해 둔 위치를 옮기는 함수 */
+long long shiftPosition(long long x, long long start, long long end, long long inserted) {
+    if (x >= end) {
+        return x + inserted - (end - start);
+    }
+    return x > start ? start : x;
 }
 
-/* 텍스트 버퍼를 화면에 표시하는 함수 */
-void displayList(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
-    wclear(win);
-    Node *temp = tb->head;
-    int x = 0, y = 0;
-
-    while (temp != NULL) {
-        if (temp->character == '\n') {
-            x = 0;
-            y++;
-        } else {
-            mvwaddch(win, y, x, temp->character);
-            x++;
-            if (x >= COLS) {
-                x = 0;
-                y++;
-            }
+/* 편집 위치 보정 함수: 같은 버퍼를 보는 다른 세션의 커서, 영역, 화면 위치 */
+void adjustSessions(TextBuffer *tb, long long start, long long end, long long inserted) {
+#ifndef _WIN32
+    for (int i = 0; i < server.count; i++) {
+        Session *s = server.sessions[i];
+        if (s == server.active || s->tb != tb) {
+            continue;
         }
-        if (temp == cursor->current) {
-            wmove(win, y, x);
-            cursor->row = y;
-            cursor->col = x;
-        }
-        temp = temp->next;
-        if (y >= LINES - 4) {
-            // 화면의 표시 가능한 영역을 초과하면 더 이상 출력하지 않음
-            break;
+        s->pos = shiftPosition(s->pos, start, end, inserted);
+        s->top_pos = shiftPosition(s->top_pos, start, end, inserted);
+        if (s->mark >= 0) {
+            s->mark = shiftPosition(s->mark, start, end, inserted);
         }
     }
-    wrefresh(win);
-    displayStatusBar(win, tb, cursor);
-    displayMessageBar(win);
+#endif
 }
 
-/* 파일 로드 함수 */
-void loadFile(TextBuffer *tb, Cursor *cursor, const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file) {
-        int ch;
-        while ((ch = fgetc(file)) != EOF) {
-            insertNode(tb, cursor, (char)ch);
-        }
-        fclose(file);
-        tb->modified = 0;
-        tb->filename = strdup(filename);
-        cursor->current = tb->tail;
-    } else {
-        tb->filename = strdup(filename);
+#ifndef _WIN32
+/* 세션 활성화 함수: 터미널을 바꾸고 버퍼의 화면 상태를 이 세션 것으로 맞춤 */
+void activateSession(Session *s) {
+    if (server.active == s) {
+        return;
     }
+    Session *old = server.active;
+    if (old != NULL) {
+        // 비활성 세션은 노드 포인터 대신 위치만 들고 있음 (다른 세션의 편집으로 노드가 바뀔 수 있음)
+        old->pos = old->cursor.pos;
+        old->top_pos = old->tb->top_pos;
+        old->mark = old->tb->mark;
+        memcpy(old->message, loop.message, sizeof(old->message));
+        old->prompt = loop.prompt;
+        clearCursors(old->tb);
+    }
+    server.active = s;
+    set_term(s->screen);
+    loop.win = stdscr;
+    loop.tb = s->tb;
+    loop.cursor = &s->cursor;
+    memcpy(loop.message, s->message, sizeof(loop.message));
+    loop.prompt = s->prompt;
+
+    TextBuffer *tb = s->tb;
+    Cursor top = {NULL, 0, 0};
+    seekPosition(tb, &top, s->top_pos);
+    moveToLineStart(tb, &top);
+    tb->top_pos = top.pos;
+    tb->mark = s->mark;
+    s->cursor.current = NULL;
+    gotoPosition(tb, &s->cursor, s->pos);
+    tb->rows_stale = 1;     // 첫 줄 번호는 그리기 전에 다시 셈
 }
 
-/* 파일 저장 함수 */
-void saveFile(TextBuffer *tb) {
-    if (tb->filename) {
-        FILE *file = fopen(tb->filename, "w");
-        if (file) {
-            Node *temp = tb->head;
-            while (temp != NULL) {
-                fputc(temp->character, file);
-                temp = temp->next;
-            }
-            fclose(file);
-            tb->modified = 0; // 저장 후 수정되지 않음으로 표시
+/* 경로로 서버가 가진 버퍼를 찾고, 없으면 불러오는 함수 */
+TextBuffer* serverBuffer(const char *path) {
+    for (int i = 0; i < server.buffer_count; i++) {
+        if (strcmp(server.buffers[i]->filename, path) == 0) {
+            return server.buffers[i];
         }
     }
+    if (server.buffer_count == SERVER_MAX_CLIENTS) {
+        return NULL;
+    }
+    TextBuffer *tb = (TextBuffer*)calloc(1, sizeof(TextBuffer));
+    Cursor cursor = {NULL, 0, 0};
+    tb->source_fd = -1;
+    tb->swap_fd = -1;
+    tb->base_fd = -1;
+    tb->mark = -1;
+    setMemoryLimits(tb);
+    loadFile(tb, &cursor, path);
+    server.buffers[server.buffer_count++] = tb;
+    return tb;
 }
 
-/* 왼쪽 커서 이동 */
-void moveCursorLeft(Cursor *cursor) {
-    if (cursor->current != NULL && cursor->current->prev != NULL) {
-        cursor->current = cursor->current->prev;
-        if (cursor->current->character == '\n') {
-            // 이전 줄의 끝으로 이동
-            cursor->current = cursor->current->prev; // '\n' 이전 문자로 이동
-            cursor->row--;
-            cursor->col = 0;
-            Node *temp = cursor->current;
-            while (temp != NULL && temp->character != '\n') {
-                temp = temp->prev;
-                cursor->col++;
-            }
-        } else {
-            cursor->col--;
-        }
+/* 클라이언트 연결 수락 함수: 경로와 TERM, 터미널 fd 두 개(SCM_RIGHTS)를 받아 세션을 만듦 */
+void acceptClient(void) {
+    int sock = accept(server.listen_fd, NULL, NULL);
+    if (sock < 0) {
+        return;
+    }
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+#ifdef __linux__
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0 || cred.uid != getuid()) {
+        close(sock);
+        return;
+    }
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(sock, &uid, &gid) < 0 || uid != getuid()) {
+        close(sock);
+        return;
+    }
+#endif
+    char request[4096 + 128];
+    int fds[2] = {-1, -1};
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {request, sizeof(request) - 1};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(sock, &msg, 0);
+    struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))
+        || server.count == SERVER_MAX_CLIENTS) {
+        close(sock);
+        return;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    request[n] = '\0';
+    const char *path = request;
+    const char *term = request + strlen(request) + 1;
+    if (term >= request + n || term[0] == '\0') {
+        term = "xterm";
     }
-}
 
-/* 오른쪽 커서 이동 */
-void moveCursorRight(Cursor *cursor) {
-    if (cursor->current != NULL && cursor->current->next != NULL) {
-        cursor->current = cursor->current->next;
-        if (cursor->current->character == '\n') {
-            cursor->row++;
-            cursor->col = 0;
-        } else {
-            cursor->col++;
+    TextBuffer *tb = serverBuffer(path);
+    FILE *in = fdopen(fds[0], "r");
+    FILE *out = fdopen(fds[1], "w");
+    SCREEN *screen = (tb && in && out) ? newterm(term, out, in) : NULL;
+    if (screen == NULL) {
+        if (in) fclose(in); else close(fds[0]);
+        if (out) fclose(out); else close(fds[1]);
+        close(sock);
+        return;
+    }
+    Session *s = (Session*)calloc(1, sizeof(Session));
+    s->sock = sock;
+    s->in = in;
+    s->out = out;
+    s->screen = screen;
+    s->tb = tb;
+    s->mark = -1;
+    s->dirty = 1;
+    server.sessions[server.count++] = s;
+
+    // 다른 세션이 이미 이 버퍼를 보고 있으면 그 위치에서 시작
+    for (int i = 0; i < server.count - 1; i++) {
+        if (server.sessions[i]->tb == tb) {
+            Session *other = server.sessions[i];
+            s->pos = other == server.active ? other->cursor.pos : other->pos;
+            s->top_pos = other == server.active ? tb->top_pos : other->top_pos;
+            break;
         }
     }
+    activateSession(s);
+    raw();
+    noecho();
+    keypad(stdscr, TRUE);
+    int viewers = 0;
+    for (int i = 0; i < server.count; i++) {
+        viewers += server.sessions[i]->tb == tb;
+    }
+    setMessage("Attached to viva server (%d client%s on this buffer)", viewers, viewers > 1 ? "s" : "");
 }
 
-/* 위쪽 커서 이동 */
-void moveCursorUp(Cursor *cursor) {
-    if (cursor->row > 0) {
-        int selected_col = cursor->col;
-        // 현재 줄의 시작으로 이동
-        while (cursor->current->prev != NULL && cursor->current->character != '\n') {
-            cursor->current = cursor->current->prev;
+/* 세션 종료 함수: 터미널을 돌려주고 연결을 끊음 (버퍼는 다음 연결을 위해 남겨 둠) */
+void closeSession(Session *s) {
+    activateSession(s);
+    closePrompt();
+    if (loop.pipe_job != NULL) {
+        cancelPipe();
+    }
+    endwin();
+    close(s->sock);     // 클라이언트는 연결이 끊기면 터미널 설정을 되돌리고 끝남
+
+    int viewers = 0;
+    for (int i = 0; i < server.count; i++) {
+        if (server.sessions[i] == s) {
+            server.sessions[i] = server.sessions[--server.count];
+            i--;
+        } else if (server.sessions[i]->tb == s->tb) {
+            viewers++;
         }
-        if (cursor->current->prev != NULL) {
-            cursor->current = cursor->current->prev; // 이전 줄의 끝의 '\n'로 이동
-            cursor->row--;
-            cursor->col = 0;
-            // 이전 줄의 시작으로 이동
-            while (cursor->current->prev != NULL && cursor->current->character != '\n') {
-                cursor->current = cursor->current->prev;
-            }
-            if (cursor->current->character == '\n' && cursor->current->next != NULL) {
-                cursor->current = cursor->current->next;
-            }
-            // 원하는 열로 이동
-            while (cursor->col < selected_col && cursor->current->next != NULL && cursor->current->character != '\n') {
-                cursor->current = cursor->current->next;
-                cursor->col++;
-            }
+    }
+    // 단독 실행에서 종료할 때처럼, 마지막으로 보던 세션이 나가면 저장
+    if (viewers == 0 && s->tb->modified && s->tb->filename) {
+        saveFileAsync(s->tb);
+    }
+    server.active = NULL;
+    loop.cursor = NULL;
+
+    // delscreen은 모든 화면의 창 목록을 함께 지우므로 붙어 있는 세션이 없을 때 한꺼번에 정리
+    if (server.retired_count == server.retired_cap) {
+        server.retired_cap = server.retired_cap ? server.retired_cap * 2 : 8;
+        server.retired = (Session**)realloc(server.retired, sizeof(Session*) * server.retired_cap);
+    }
+    server.retired[server.retired_count++] = s;
+    if (server.count == 0) {
+        for (int i = 0; i < server.retired_count; i++) {
+            Session *r = server.retired[i];
+            delscreen(r->screen);
+            fclose(r->in);
+            fclose(r->out);
+            free(r);
         }
+        server.retired_count = 0;
+        set_term(NULL);
     }
 }
 
-/* 아래쪽 커서 이동 */
-void moveCursorDown(Cursor *cursor) {
-    Node *temp = cursor->current;
-    int selected_col = cursor->col;
-    // 현재 줄의 끝으로 이동
-    while (temp != NULL && temp->character != '\n') {
-        temp = temp->next;
+/* 클라이언트 메시지 처리 함수 ('R': 터미널 크기 변경, 연결 끊김: 세션 종료) */
+void handleClientMessage(Session *s) {
+    char buf[64];
+    ssize_t n = read(s->sock, buf, sizeof(buf));
+    if (n <= 0) {
+        closeSession(s);
+        return;
     }
-    if (temp != NULL && temp->next != NULL) {
-        cursor->current = temp->next; // 다음 줄의 시작으로 이동
-        cursor->row++;
-        cursor->col = 0;
-        // 원하는 열로 이동
-        while (cursor->col < selected_col && cursor->current->next != NULL && cursor->current->character != '\n') {
-            cursor->current = cursor->current->next;
-            cursor->col++;
+    if (memchr(buf, 'R', n) != NULL) {
+        struct winsize ws;
+        activateSession(s);
+        if (ioctl(fileno(s->out), TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+            resize_term(ws.ws_row, ws.ws_col);
         }
+        s->dirty = 1;
     }
 }
 
-/* 검색 기능 흐름 처리 */
-void searchFunction(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
-    SearchContext sc;
-    sc.result_count = 0;
-    sc.current_index = 0;
-    sc.results = NULL;
-    sc.original_cursor = *cursor; // 검색 이전의 커서 위치 저장
-
-    echo(); // 입력 에코 활성화
-    curs_set(1); // 커서 표시
-
-    // 사용자로부터 검색어 입력 받기
-    displayPrompt(win, "Search: ", sc.query, sizeof(sc.query));
+static volatile sig_atomic_t server_stop = 0;
 
-    noecho(); // 입력 에코 비활성화
-    curs_set(0); // 커서 숨김
+/* 서버 종료 시그널 처리 함수 */
+void stopServer(int sig) {
+    (void)sig;
+    server_stop = 1;
+}
 
-    if (strlen(sc.query) == 0) {
-        // 검색어가 비어있으면 검색 취소
-        return;
+/* 서버 실행 함수: 터미널 없이 버퍼를 들고 있다가 클라이언트가 넘겨준 터미널에 직접 그림 */
+int runServer(void) {
+    char path[4096];
+    serverSocketPath(path, sizeof(path));
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "viva: socket path too long: %s\n", path);
+        return 1;
     }
+    strcpy(addr.sun_path, path);
 
-    // 검색 결과 찾기
-    findMatches(tb, &sc);
-
-    if (sc.result_count == 0) {
-        // 검색 결과가 없을 경우 메시지 표시
-        mvwprintw(win, tb->lines + 1, 0, "No matches found.");
-        wrefresh(win);
-        getch(); // 사용자 입력 대기
-        return;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "viva: server already running on %s\n", path);
+        close(fd);
+        return 1;
     }
-
-    // 첫 번째 검색 결과 하이라이트
-    highlightMatch(win, tb, &sc);
-
-    int ch;
-    while (1) {
-        ch = getch();
-        if (ch == KEY_LEFT) {
-            // 이전 검색 결과로 이동
-            clearHighlight(win, tb, &sc);
-            sc.current_index = (sc.current_index - 1 + sc.result_count) % sc.result_count;
-            highlightMatch(win, tb, &sc);
-        } else if (ch == KEY_RIGHT) {
-            // 다음 검색 결과로 이동
-            clearHighlight(win, tb, &sc);
-            sc.current_index = (sc.current_index + 1) % sc.result_count;
-            highlightMatch(win, tb, &sc);
-        } else if (ch == '\n' || ch == '\r') {
-            // Enter 키 눌렀을 때 검색 종료 및 편집 시작
-            *cursor = getCursorFromNode(tb, sc.results[sc.current_index]);
-            break;
-        } else if (ch == 27) {
-            // ESC 키 눌렀을 때 검색 취소 및 커서 복원
-            clearHighlight(win, tb, &sc);
-            *cursor = sc.original_cursor;
-            break;
-        }
+    if (fd >= 0) close(fd);
+    unlink(path);   // 이전 서버가 남긴 소켓 파일
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t mask = umask(077);   // 소켓은 소유자만 접근
+    int bound = server.listen_fd >= 0 && bind(server.listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    umask(mask);
+    if (!bound || listen(server.listen_fd, 16) < 0) {
+        fprintf(stderr, "viva: cannot listen on %s: %s\n", path, strerror(errno));
+        return 1;
     }
+    fcntl(server.listen_fd, F_SETFD, FD_CLOEXEC);
+    fprintf(stderr, "viva: server listening on %s\n", path);
 
-    // 메모리 해제
-    free(sc.results);
-
-    // 화면 갱신
-    displayList(win, tb, cursor);
-    move(cursor->row, cursor->col);
-    refresh();
-}
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopServer;     // SA_RESTART 없이: poll이 깨어나 종료를 확인
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
 
-/* 검색 위치 저장 함수 */
-void findMatches(TextBuffer *tb, SearchContext *sc) {
-    Node *current = tb->head;
-    int query_len = strlen(sc->query);
-    sc->result_count = 0;
+    server.enabled = 1;
+    initEventLoop(NULL, NULL, NULL);
+    loop.running = 1;
+    while (!server_stop) {
+        // 바뀐 세션만 그림 (백그라운드 작업이 남긴 변경은 모든 세션에)
+        int all = loop.dirty;
+        for (int i = 0; i < server.count; i++) {
+            Session *s = server.sessions[i];
+            if (s->dirty || all) {
+                activateSession(s);
+                loop.dirty = 1;
+                refreshScreen(stdscr, s->tb, &s->cursor);
+                s->dirty = 0;
+            }
+        }
+        loop.dirty = 0;
 
-    // 첫 번째 패스: 검색 결과 개수 세기
-    while (current != NULL) {
-        if (current->character == sc->query[0]) {
-            Node *temp = current;
-            int i = 0;
-            while (temp != NULL && sc->query[i] != '\0' && temp->character == sc->query[i]) {
-                temp = temp->next;
-                i++;
+        int pending = pollEvents();
+        if (pending & PENDING_ACCEPT) {
+            acceptClient();
+        }
+        for (int i = server.count - 1; i >= 0; i--) {
+            Session *s = server.sessions[i];
+            if (s->sock_ready) {
+                s->sock_ready = 0;
+                s->key_ready = 0;
+                handleClientMessage(s);
+                continue;
+            }
+            if (!s->key_ready) {
+                continue;
+            }
+            s->key_ready = 0;
+            activateSession(s);
+            if (loop.stats.enabled && loop.stats.key_at == 0) {
+                loop.stats.key_at = monotonicUs();
             }
-            if (sc->query[i] == '\0') {
-                sc->result_count++;
+            long version = s->tb->version;
+            int ch;
+            while (loop.running && (ch = readKey()) != ERR) {
+                handleKey(stdscr, s->tb, &s->cursor, ch);
+                if (loop.is_recording && !loop.prompt.active) {
+                    endStroke();    // 프롬프트에 친 키는 연 키와 한 묶음
+                }
+            }
+            s->dirty = 1;
+            if (!loop.running) {
+                // 종료 키는 세션만 닫음
+                loop.running = 1;
+                closeSession(s);
+                continue;
+            }
+            for (int j = 0; j < server.count; j++) {
+                if (server.sessions[j]->tb == s->tb && s->tb->version != version) {
+                    server.sessions[j]->dirty = 1;  // 같은 버퍼를 보는 다른 클라이언트도 다시 그림
+                }
             }
+            scheduleAutosave(s->tb);
+            trimResident(s->tb, s->cursor.current);
         }
-        current = current->next;
+        dispatchBackground(loop.tb, pending);
     }
 
-    if (sc->result_count == 0) {
-        sc->results = NULL;
-        return;
+    while (server.count > 0) {
+        closeSession(server.sessions[server.count - 1]);
     }
-
-    // 메모리 할당
-    sc->results = (Node **)malloc(sizeof(Node *) * sc->result_count);
-
-    // 두 번째 패스: 검색 결과 저장
-    current = tb->head;
-    int index = 0;
-    while (current != NULL) {
-        if (current->character == sc->query[0]) {
-            Node *temp = current;
-            int i = 0;
-            while (temp != NULL && sc->query[i] != '\0' && temp->character == sc->query[i]) {
-                temp = temp->next;
-                i++;
-            }
-            if (sc->query[i] == '\0') {
-                sc->results[index++] = current;
-            }
+    free(server.retired);
+    waitForSave();
+    stopGrep();
+    dumpStats(server.buffer_count > 0 ? server.buffers[0] : NULL);
+    close(server.listen_fd);
+    unlink(path);
+    for (int i = 0; i < server.buffer_count; i++) {
+        TextBuffer *tb = server.buffers[i];
+        stopIndexer(tb);
+        stopGunzip(tb);
+        if (tb->modified && tb->filename) {
+            saveFile(tb);
         }
-        current = current->next;
+        freeResource(tb);
+        free(tb);
     }
+    closeEventLoop();
+    return 0;
 }
 
-/* 검색 결과 하이라이트 함수 */
-void highlightMatch(WINDOW *win, TextBuffer *tb, SearchContext *sc) {
-    Node *current = sc->results[sc->current_index];
-    int query_len = strlen(sc->query);
-
-    // 현재 속성 저장
-    attr_t attrs;
-    short pair;
-    wattr_get(win, &attrs, &pair, NULL);
+static volatile sig_atomic_t client_resized = 0;
 
-    // 하이라이트 속성 적용
-    wattron(win, A_REVERSE);
+/* 클라이언트 창 크기 변경 시그널 처리 함수 */
+void clientResized(int sig) {
+    (void)sig;
+    client_resized = 1;
+}
+#endif
 
-    int row = 0, col = 0;
-    Node *temp = tb->head;
-    while (temp != current && temp != NULL) {
-        if (temp->character == '\n') {
-            row++;
-            col = 0;
-        } else {
-            col++;
-        }
-        temp = temp->next;
+/* 클라이언트 실행 함수: 서버가 있으면 터미널을 넘겨주고 세션이 끝날 때까지 기다림
+ * 서버가 없으면 0을 반환해 혼자 실행함 */
+int runClient(const char *filename) {
+#ifndef _WIN32
+    char path[4096];
+    serverSocketPath(path, sizeof(path));
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path) || !isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) {
+        return 0;
+    }
+    strcpy(addr.sun_path, path);
+    // 다른 사용자가 만든 소켓에는 터미널을 넘기지 않음
+    struct stat st;
+    if (lstat(path, &st) < 0 || !S_ISSOCK(st.st_mode) || st.st_uid != getuid()) {
+        return 0;
+    }
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return 0;
+    }
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return 0;
     }
 
-    for (int i = 0; i < query_len && temp != NULL; i++) {
-        mvwaddch(win, row, col, temp->character);
-        if (temp->character == '\n') {
-            row++;
-            col = 0;
+    // 서버는 절대 경로로 버퍼를 찾음
+    char request[4096 + 128];
+    char absolute[4096];
+    if (realpath(filename, absolute) == NULL) {
+        char cwd[4096];
+        if (filename[0] == '/' || getcwd(cwd, sizeof(cwd)) == NULL) {
+            snprintf(absolute, sizeof(absolute), "%s", filename);
         } else {
-            col++;
+            snprintf(absolute, sizeof(absolute), "%.2047s/%.2047s", cwd, filename);
         }
-        temp = temp->next;
     }
+    const char *term = getenv("TERM");
+    // 요청은 "경로\0TERM\0"
+    int len = snprintf(request, sizeof(request), "%s%c%.63s", absolute, '\0', term ? term : "");
 
-    // 이전 속성 복원
-    wattroff(win, A_REVERSE);
-    wattr_set(win, attrs, pair, NULL);
-
-    wrefresh(win);
-}
-
-/* 언하이라이트 함수 */
-void clearHighlight(WINDOW *win, TextBuffer *tb, SearchContext *sc) {
-    // 전체 텍스트 버퍼를 다시 표시하여 하이라이트 제거
-    displayList(win, tb, NULL);
-}
-
-/* 프롬프트 표시 함수 */
-void displayPrompt(WINDOW *win, const char *prompt, char *buffer, int buffer_size) {
-    int y, x;
-    getmaxyx(win, y, x);
-    mvwprintw(win, y - 1, 0, "%s", prompt);
-    wclrtoeol(win); // 줄의 나머지 부분 지우기
-    wrefresh(win);
-    wgetnstr(win, buffer, buffer_size - 1);
-}
+    int fds[2] = {STDIN_FILENO, STDOUT_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {request, (size_t)len + 1};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
 
-/* 노드 위치 계산 함수 */ 
-Cursor getCursorFromNode(TextBuffer *tb, Node *node) {
-    Cursor cursor;
-    cursor.current = node;
-    cursor.row = 0;
-    cursor.col = 0;
-
-    Node *temp = tb->head;
-    while (temp != node && temp != NULL) {
-        if (temp->character == '\n') {
-            cursor.row++;
-            cursor.col = 0;
-        } else {
-            cursor.col++;
-        }
-        temp = temp->next;
+    struct termios saved;
+    int have_saved = tcgetattr(STDIN_FILENO, &saved) == 0;
+    if (sendmsg(sock, &msg, 0) < 0) {
+        close(sock);
+        return 0;
     }
-    return cursor;
-}
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = clientResized;
+    sigaction(SIGWINCH, &sa, NULL);
+    signal(SIGINT, SIG_IGN);
 
-/* 사용자 키 입력 처리 */
-void processInput(WINDOW *win, TextBuffer *tb, Cursor *cursor) {
-    int ch;
+    // 서버가 연결을 닫으면 세션이 끝난 것
+    char buf[64];
     while (1) {
-        ch = getch();
-    #ifdef _WIN32
-        /* Windows에서 Ctrl 키 조합 처리 */
-        if (ch == 19) { // Ctrl-S (저장)
-            saveFile(tb);
-        } else if (ch == 17) { // Ctrl-Q (종료)
-            return;
-        } else if (ch == 6) { // Ctrl-F (검색)
-            searchFunction(win, tb, cursor);
-        } else {
-            /* 기존 입력 처리 */
-            switch (ch) {
-                case KEY_LEFT:
-                    moveCursorLeft(cursor);
-                    break;
-                case KEY_RIGHT:
-                    moveCursorRight(cursor);
-                    break;
-                case KEY_UP:
-                    moveCursorUp(cursor);
-                    break;
-                case KEY_DOWN:
-                    moveCursorDown(cursor);
+        ssize_t n = read(sock, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            if (client_resized) {
+                client_resized = 0;
+                if (write(sock, "R", 1) < 0) {
                     break;
-                case KEY_BACKSPACE:
-                case 127:
-                case 8:
-                    /* 백스페이스 처리 */
-                    deleteNode(tb, cursor);
-                    if (cursor->col > 0)
-                        cursor->col--;
-                    else if (cursor->row > 0) {
-                        cursor->row--;
-                        // 이전 줄의 끝으로 이동
-                        cursor->col = 0;
-                        Node *temp = cursor->current;
-                        while (temp != NULL && temp->character != '\n') {
-                            temp = temp->prev;
-                            cursor->col++;
-                        }
-                    }
-                    break;
-                default:
-                    if (ch >= 32 && ch <= 126) { // 출력 가능한 문자
-                        insertNode(tb, cursor, (char)ch);
-                        cursor->col++;
-                    } else if (ch == '\n' || ch == '\r') {
-                        insertNode(tb, cursor, '\n');
-                        cursor->col = 0;
-                        cursor->row++;
-                    }
-                    break;
-            }
-        }
-    #elif defined(__APPLE__)
-        /* macOS에서 ESC 시퀀스 처리 */
-        if (ch == 27) { // ESC 키를 눌렀을 때
-            nodelay(win, TRUE); // 논블로킹 모드로 전환
-            int next_ch = getch();
-            nodelay(win, FALSE); // 블로킹 모드로 복원
-            if (next_ch == ERR) {
-                // ESC 키만 눌린 경우 계속 진행
-                continue;
-            } else {
-                // ESC + 다른 키 조합 처리
-                switch (next_ch) {
-                    case 's':
-                    case 'S':
-                        // ESC + S 눌렀을 때 저장
-                        saveFile(tb);
-                        break;
-                    case 'q':
-                    case 'Q':
-                        // ESC + Q 눌렀을 때 종료
-                        return;
-                    case 'f':
-                    case 'F':
-                        searchFunction(win, tb, cursor);
-                        break;
-                    default:
-                        break;
                 }
-                continue;
-            }
-        } else {
-            /* 기존 입력 처리 */
-            switch (ch) {
-                case KEY_LEFT:
-                    moveCursorLeft(cursor);
-                    break;
-                case KEY_RIGHT:
-                    moveCursorRight(cursor);
-                    break;
-                case KEY_UP:
-                    moveCursorUp(cursor);
-                    break;
-                case KEY_DOWN:
-                    moveCursorDown(cursor);
-                    break;
-                case KEY_BACKSPACE:
-                case 127:
-                    /* 백스페이스 처리 */
-                    deleteNode(tb, cursor);
-                    if (cursor->col > 0)
-                        cursor->col--;
-                    else if (cursor->row > 0) {
-                        cursor->row--;
-                        // 이전 줄의 끝으로 이동
-                        cursor->col = 0;
-                        Node *temp = cursor->current;
-                        while (temp != NULL && temp->character != '\n') {
-                            temp = temp->prev;
-                            cursor->col++;
-                        }
-                    }
-                    break;
-                default:
-                    if (ch >= 32 && ch <= 126) { // 출력 가능한 문자
-                        insertNode(tb, cursor, (char)ch);
-                        cursor->col++;
-                    } else if (ch == '\n' || ch == '\r') {
-                        insertNode(tb, cursor, '\n');
-                        cursor->col = 0;
-                        cursor->row++;
-                    }
-                    break;
             }
+            continue;
         }
-    #else
-        /* 기타 운영체제(Linux)에서 기본적으로 Ctrl 키 조합 사용 */
-        if (ch == 19) { // Ctrl-S (저장)
-            saveFile(tb);
-        } else if (ch == 17) { // Ctrl-Q (종료)
-            return;
-        } else if (ch == 6) { // Ctrl-F (검색)
-            searchFunction(win, tb, cursor);
-        } else {
-            /* 기존 입력 처리 */
-            switch (ch) {
-                case KEY_LEFT:
-                    moveCursorLeft(cursor);
-                    break;
-                case KEY_RIGHT:
-                    moveCursorRight(cursor);
-                    break;
-                case KEY_UP:
-                    moveCursorUp(cursor);
-                    break;
-                case KEY_DOWN:
-                    moveCursorDown(cursor);
-                    break;
-                case KEY_BACKSPACE:
-                case 127:
-                    /* 백스페이스 처리 */
-                    deleteNode(tb, cursor);
-                    if (cursor->col > 0)
-                        cursor->col--;
-                    else if (cursor->row > 0) {
-                        cursor->row--;
-                        // 이전 줄의 끝으로 이동
-                        cursor->col = 0;
-                        Node *temp = cursor->current;
-                        while (temp != NULL && temp->character != '\n') {
-                            temp = temp->prev;
-                            cursor->col++;
-                        }
-                    }
-                    break;
-                default:
-                    if (ch >= 32 && ch <= 126) { // 출력 가능한 문자
-                        insertNode(tb, cursor, (char)ch);
-                        cursor->col++;
-                    } else if (ch == '\n' || ch == '\r') {
-                        insertNode(tb, cursor, '\n');
-                        cursor->col = 0;
-                        cursor->row++;
-                    }
-                    break;
-            }
+        if (n <= 0) {
+            break;
         }
-    #endif
-        /* 화면 업데이트 */
-        displayList(win, tb, cursor);
-        move(cursor->row, cursor->col);
-        refresh();
     }
+    close(sock);
+    if (have_saved) {
+        // 서버가 비정상 종료했어도 터미널은 원래대로
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    }
+    return 1;
+#else
+    (void)filename;
+    return 0;
+#endif
 }
 
-/* 메모리 해제 함수 */
-void freeResource(TextBuffer *tb) {
+/* 버퍼가 가진 노드, 편집 기록, 파일 핸들 해제 함수 (다른 파일을 열 때도 사용) */
+void releaseBuffer(TextBuffer *tb) {
     Node *temp;
+    tb->text_stats.valid = 0;   // 노드를 떼지 않고 바로 해제하므로 합계도 버림
     while (tb->head != NULL) {
         temp = tb->head;
         tb->head = tb->head->next;
-        free(temp);
+        freeNode(temp);
     }
 
+    freeUndoList(tb->undo);
+    freeUndoList(tb->redo);
+    free(tb->cursors);
+    free(tb->page_lines);
+    free(tb->folds);
+#ifndef _WIN32
+    if (tb->base_fd >= 0) close(tb->base_fd);
+#endif
+    freeTable(tb);
+
     if (tb->filename) {
         free(tb->filename);
     }
+#ifndef _WIN32
+    if (tb->source_fd >= 0) close(tb->source_fd);
+    if (tb->swap_fd >= 0) close(tb->swap_fd);
+#endif
+}
+
+/* 메모리 해제 함수 */
+void freeResource(TextBuffer *tb) {
+    if (loop.pipe_job != NULL) {
+        cancelPipe();
+    }
+    releaseBuffer(tb);
+    for (int i = 0; i < KILL_RING_SIZE; i++) {
+        chainFree(&loop.kill_ring[i]);
+    }
+    freeMacro(&loop.macro);
+    freeMacro(&loop.recording);
+    free(loop.stroke);
+    loop.stroke = NULL;
+    loop.stroke_len = loop.stroke_cap = 0;
 }
 
 /* main */
 int main(int argc, char *argv[]) {
+#ifndef _WIN32
+    if (argc > 1 && strcmp(argv[1], "--server") == 0) {
+        return runServer();
+    }
+#endif
+    // 서버가 떠 있으면 터미널만 넘기고 바로 붙음 (파일은 서버가 이미 들고 있을 수 있음)
+    if (argc > 1 && runClient(argv[1])) {
+        return 0;
+    }
     // ncurses 기본 세팅
     initscr();
-    cbreak();
+    raw();      // Ctrl-S, Ctrl-Q가 흐름 제어에 먹히지 않도록 raw 모드 사용
     noecho();
     keypad(stdscr, TRUE);
 
     TextBuffer tb = {NULL, NULL, 0, NULL};
     Cursor cursor = {NULL, 0, 0};
+    tb.source_fd = -1;
+    tb.swap_fd = -1;
+    tb.base_fd = -1;
+    tb.mark = -1;
+    setMemoryLimits(&tb);
 
+    // 불러오며 시작하는 백그라운드 작업(줄 색인, gzip 풀기)이 알림을 보낼 수 있도록 이벤트 루프를 먼저 준비
+    initEventLoop(stdscr, &tb, &cursor);
     if (argc > 1) {
         // 파일이 제공되었을 때
         loadFile(&tb, &cursor, argv[1]);
+        watchFile(tb.filename);
     }
-
-    displayList(stdscr, &tb, &cursor);
-    move(cursor.row, cursor.col);
-
     processInput(stdscr, &tb, &cursor);
+    waitForSave();
+    stopIndexer(&tb);
+    stopGunzip(&tb);
+    stopGrep();
 
     endwin();
+    dumpStats(&tb);
 
     // 파일 저장
     if (tb.modified && tb.filename) {
         saveFile(&tb);
     }
+    storeSession(&tb, &cursor);
+    closeEventLoop();
 
     // 메모리 해제
     freeResource(&tb);